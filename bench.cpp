@@ -0,0 +1,472 @@
+// picam-bench: drive the capture pipeline (encode, EXIF, write) from a
+// synthetic or replayed frame source and report throughput and latency.
+// Needs neither a camera nor GPIO, so it runs on any Linux box.
+
+#include <algorithm>
+#include <iostream>
+#include <filesystem>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include "capture_pipeline.h"
+#include "display_service.h"
+#include "exposure_assistant.h"
+#include "latency_trace.h"
+#include "metrics.h"
+#include "paced_source.h"
+#include "spool_file.h"
+#include "tapes_catalog.h"
+#include "yuv_scale.h"
+
+namespace fs = std::filesystem;
+using namespace std::chrono;
+
+// Panel size of the LCD HAT, for the stand-in display
+constexpr int DISPLAY_SIZE = 240;
+// Settings the stand-in frames report, and the presets the exposure meter
+// picks from, as on the camera
+constexpr int32_t EXPOSURE_TIME_US = 16666;
+constexpr float ANALOGUE_GAIN = 4.0f;
+constexpr uint32_t METER_SAMPLES = 1 << 18;
+
+struct BenchOptions {
+    std::string source = "synthetic";
+    FrameFormat format{4624, 3472, 0, 4};
+    double fps = 10;
+    uint64_t frames = 50;
+    std::string outDir;  // Empty: a temp directory, removed afterwards
+    std::string traceFile;
+    std::string metricsFile;
+    std::string display = "memory:25";  // Used with a viewfinder
+    bool defer = false;
+    bool catalog = false;
+    PipelineSettings pipeline;
+};
+
+static size_t countSpoolFiles(const std::string &directory) {
+    size_t count = 0;
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(directory, ec)) {
+        count += entry.path().extension() == SPOOL_EXTENSION;
+    }
+    return count;
+}
+
+static void printUsage(const char *argv0) {
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "  --source synthetic|replay:<file>  Frame source (default synthetic)\n"
+              << "  --size WxH                        Frame size (default 4624x3472)\n"
+              << "  --stride N                        Luma stride in bytes (default: width aligned to 64)\n"
+              << "  --buffers N                       Source buffers (default 4)\n"
+              << "  --fps N                           Frame rate, 0 = as fast as the pipeline goes (default 10)\n"
+              << "  --frames N                        Frames to deliver (default 50)\n"
+              << "  --workers N                       Encoder workers (default 2)\n"
+              << "  --max-in-flight N                 Captures holding source buffers (default 2)\n"
+              << "  --backpressure block|drop-oldest|reduce-resolution|spill\n"
+              << "  --queue-memory MB                 Spill: queued frames copied to memory before the spill file (default 256)\n"
+              << "  --spill-file MB                   Spill: largest spill file (default 2048)\n"
+              << "  --fsync none|file|dir             (default file)\n"
+              << "  --strips N                        JPEG strips per frame, 0 = one per core (default 0)\n"
+              << "  --quality N                       JPEG quality (default 90)\n"
+              << "  --out DIR                         Keep the files in DIR\n"
+              << "  --trace FILE                      Write a trace event JSON file\n"
+              << "  --metrics FILE                    Write a metrics snapshot at the end\n"
+              << "  --viewfinder WxH                  Also draw a viewfinder of this size on a stand-in display\n"
+              << "  --display memory[:MS]|file:<ppm>  Stand-in display: in memory, taking MS per frame like the\n"
+              << "                                    LCD's SPI link (default memory:25), or a PPM file\n"
+              << "  --raw on|off                      Also save a DNG of a mosaiced raw frame per capture (default off)\n"
+              << "  --stack N                         Average every N consecutive frames into one capture (default off)\n"
+              << "  --defer on|off                    Spool captures losslessly instead of encoding them (default off)\n"
+              << "  --catalog on|off                  Catalog the files written, as the camera app does (default off)\n"
+              << "  --pin-encoders on|off             Keep each encoder worker on a core of its own (default off)\n"
+              << "  --lock-memory huge|on|off         Lock frame arenas in RAM, on huge pages with huge (default off)" << std::endl;
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help") {
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--source") {
+            options.source = value;
+        } else if (arg == "--size") {
+            if (sscanf(value.c_str(), "%dx%d", &options.format.width, &options.format.height) != 2) {
+                std::cerr << "Bad size: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--stride") {
+            options.format.stride = atoi(value.c_str());
+        } else if (arg == "--buffers") {
+            options.format.bufferCount = static_cast<unsigned int>(std::max(2, atoi(value.c_str())));
+        } else if (arg == "--fps") {
+            options.fps = std::max(0.0, atof(value.c_str()));
+        } else if (arg == "--frames") {
+            options.frames = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--workers") {
+            options.pipeline.encoderWorkers = std::max(1, atoi(value.c_str()));
+        } else if (arg == "--max-in-flight") {
+            options.pipeline.maxInFlight = std::max(1, atoi(value.c_str()));
+        } else if (arg == "--queue-memory") {
+            options.pipeline.queueMemoryBytes = static_cast<size_t>(std::max(0, atoi(value.c_str()))) << 20;
+        } else if (arg == "--spill-file") {
+            options.pipeline.spillFileBytes = static_cast<size_t>(std::max(0, atoi(value.c_str()))) << 20;
+        } else if (arg == "--backpressure") {
+            bool known = false;
+            for (Backpressure p : {Backpressure::Block, Backpressure::DropOldest, Backpressure::ReduceResolution,
+                                   Backpressure::Spill}) {
+                if (value == backpressureName(p)) {
+                    options.pipeline.backpressure = p;
+                    known = true;
+                }
+            }
+            if (!known) {
+                std::cerr << "Unknown backpressure policy: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--fsync") {
+            if (value == "none") {
+                options.pipeline.fsyncPolicy = FsyncPolicy::None;
+            } else if (value == "file") {
+                options.pipeline.fsyncPolicy = FsyncPolicy::File;
+            } else if (value == "dir") {
+                options.pipeline.fsyncPolicy = FsyncPolicy::FileAndDir;
+            } else {
+                std::cerr << "Unknown fsync policy: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--strips") {
+            options.pipeline.jpegStrips = static_cast<unsigned int>(std::max(0, atoi(value.c_str())));
+        } else if (arg == "--quality") {
+            options.pipeline.jpegQuality = std::min(100, std::max(1, atoi(value.c_str())));
+        } else if (arg == "--out") {
+            options.outDir = value;
+        } else if (arg == "--trace") {
+            options.traceFile = value;
+        } else if (arg == "--metrics") {
+            options.metricsFile = value;
+        } else if (arg == "--viewfinder") {
+            if (sscanf(value.c_str(), "%dx%d", &options.format.viewfinderWidth, &options.format.viewfinderHeight) != 2) {
+                std::cerr << "Bad viewfinder size: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--display") {
+            options.display = value;
+        } else if (arg == "--raw") {
+            options.format.raw = value == "on";
+        } else if (arg == "--defer") {
+            options.defer = value == "on";
+        } else if (arg == "--catalog") {
+            options.catalog = value == "on";
+        } else if (arg == "--stack") {
+            options.pipeline.stackFrames = std::clamp(atoi(value.c_str()), 0, FrameStacker::MAX_FRAMES);
+        } else if (arg == "--pin-encoders") {
+            options.pipeline.pinEncoders = value == "on";
+        } else if (arg == "--lock-memory") {
+            options.pipeline.lockMemory = value != "off";
+            options.pipeline.hugePages = value == "huge";
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return options.frames > 0;
+}
+
+static std::string exifTimestamp() {
+    auto time = system_clock::to_time_t(system_clock::now());
+    std::tm tm = *std::localtime(&time);
+    std::ostringstream oss;
+    oss << std::put_time(&tm, "%Y:%m:%d %H:%M:%S");
+    return oss.str();
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<PacedSource> source;
+    if (options.source == "synthetic") {
+        source = std::make_unique<SyntheticSource>(options.fps);
+    } else if (options.source.rfind("replay:", 0) == 0) {
+        source = std::make_unique<ReplaySource>(options.source.substr(7), options.fps);
+    } else {
+        std::cerr << "Unknown source: " << options.source << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    bool tempDir = options.outDir.empty();
+    if (tempDir) {
+        char pattern[] = "/tmp/picam-bench-XXXXXX";
+        if (!mkdtemp(pattern)) {
+            std::cerr << "Failed to create temp directory: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        options.outDir = pattern;
+    }
+    fs::create_directories(options.outDir);
+    options.pipeline.directory = options.outDir;
+    if (options.defer) {
+        options.pipeline.spoolDirectory = options.outDir + "/.spool";
+    }
+
+    LatencyTrace trace;
+    Metrics metrics(trace);
+    if (!options.traceFile.empty() && !trace.openTraceFile(options.traceFile)) {
+        std::cerr << "Failed to open trace file " << options.traceFile << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    FrameFormat format = options.format;
+    if (!source->configure(format)) {
+        return 1;
+    }
+    source->setControls(EXPOSURE_TIME_US, ANALOGUE_GAIN);
+
+    std::unique_ptr<DisplaySink> sink;
+    if (options.display.rfind("file:", 0) == 0) {
+        sink = std::make_unique<FileSink>(options.display.substr(5), DISPLAY_SIZE, DISPLAY_SIZE);
+    } else if (options.display.rfind("memory", 0) == 0) {
+        size_t colon = options.display.find(':');
+        int transferMs = colon == std::string::npos ? 0 : atoi(options.display.c_str() + colon + 1);
+        sink = std::make_unique<MemorySink>(DISPLAY_SIZE, DISPLAY_SIZE, milliseconds(transferMs));
+    } else {
+        std::cerr << "Unknown display: " << options.display << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+    DisplayService display(*sink);
+    if (format.viewfinderWidth > 0) {
+        display.start();
+        display.setViewfinder(true);
+    }
+
+    CapturePipeline pipeline(options.pipeline, trace, metrics);
+    std::atomic<uint64_t> saved{0}, failed{0}, bytes{0};
+    pipeline.onSaved = [&](uint64_t, const WriteResult &result) {
+        if (result.ok) {
+            saved++;
+            bytes += result.bytes;
+        } else {
+            failed++;
+        }
+    };
+    TapesCatalog catalog;
+    std::atomic<int64_t> catalogNs{0}, catalogAppends{0};
+    if (options.catalog && catalog.open(options.outDir)) {
+        pipeline.onCommitted = [&](const WriteResult &result, const CaptureInfo &info) {
+            auto start = steady_clock::now();
+            CatalogEntry entry = catalogEntry(result.path, result.bytes, result.hash);
+            snprintf(entry.captureTime, sizeof(entry.captureTime), "%s", info.timestamp.c_str());
+            entry.exposureTimeUs = info.exposureTimeUs;
+            entry.analogueGain = info.analogueGain;
+            catalog.append(entry);
+            catalogNs += duration_cast<std::chrono::nanoseconds>(steady_clock::now() - start).count();
+            catalogAppends++;
+        };
+    }
+    if (!pipeline.start(format)) {
+        return 1;
+    }
+
+    std::cout << "Source: " << source->describe() << ", " << format.bufferCount << " buffers, "
+              << (options.fps > 0 ? std::to_string(options.fps) + " fps" : std::string("unpaced")) << std::endl;
+    std::cout << "Pipeline: " << options.pipeline.encoderWorkers << " encoder worker(s), "
+              << pipeline.jpegStrips() << " JPEG strips, max in flight " << options.pipeline.maxInFlight
+              << ", backpressure " << backpressureName(options.pipeline.backpressure) << std::endl;
+    if (display.running()) {
+        std::cout << "Viewfinder: " << format.viewfinderWidth << "x" << format.viewfinderHeight
+                  << " on " << sink->describe() << std::endl;
+    }
+    if (options.pipeline.stackFrames > 1) {
+        std::cout << "Stacking: " << options.pipeline.stackFrames << " frames per capture" << std::endl;
+    }
+    if (format.rawLayout.width > 0) {
+        std::cout << "Raw: " << format.rawLayout.width << "x" << format.rawLayout.height << ", "
+                  << format.rawLayout.bits << " bits, saved as DNG" << std::endl;
+    }
+
+    // Offer every frame for capture, like a burst held down forever
+    std::mutex doneMutex;
+    std::condition_variable doneCV;
+    bool done = false;
+    std::string sourceError;
+    uint64_t delivered = 0, captured = 0, refused = 0;
+    // Stacking takes every frame, in runs of stackFrames per file
+    uint64_t stackFrames = static_cast<uint64_t>(std::max(1, options.pipeline.stackFrames));
+
+    // Exposure meter on every frame, as the camera app runs it
+    ExposureAssistant assistant({1000000 / 250, 1000000 / 60, 1000000 / 15, 1000000 / 2}, {2.0f, 4.0f, 8.0f});
+    LumaStats lumaStats;
+    ExposureSuggestion suggestion;
+    duration<double, std::micro> meterTotal{0}, meterMax{0};
+
+    auto onFrame = [&](const SourceFrame &frame) {
+        if (delivered >= options.frames) {
+            return;
+        }
+        delivered++;
+        if (frame.viewfinder.planes[0]) {
+            display.offerViewfinder(frame.viewfinder);
+        }
+
+        auto meterStart = steady_clock::now();
+        measureLuma(frame.viewfinder.planes[0] ? frame.viewfinder : frame.image, METER_SAMPLES, lumaStats);
+        suggestion = assistant.update(lumaStats, frame.exposureTimeUs, frame.analogueGain);
+        duration<double, std::micro> meterTime = steady_clock::now() - meterStart;
+        meterTotal += meterTime;
+        meterMax = std::max(meterMax, meterTime);
+        if (suggestion.valid) {
+            display.setExposureMeter(suggestion.ev, suggestion.clipping);
+        }
+
+        bool reduced = false;
+        bool admitted = pipeline.admit(reduced);
+        // Unpaced, wait for room rather than spin on refused frames
+        while (!admitted && options.fps == 0) {
+            std::this_thread::sleep_for(milliseconds(1));
+            admitted = pipeline.admit(reduced);
+        }
+        if (admitted) {
+            CaptureInfo info;
+            std::ostringstream name;
+            name << "bench_" << std::setw(6) << std::setfill('0') << frame.index;
+            info.name = name.str();
+            info.exposureTimeUs = EXPOSURE_TIME_US;
+            info.analogueGain = ANALOGUE_GAIN;
+            info.timestamp = exifTimestamp();
+            info.shutterTime = frame.arrival;
+            if (stackFrames > 1) {
+                pipeline.submitStacked(frame, static_cast<int>(captured % stackFrames), std::move(info));
+            } else {
+                pipeline.submit(frame, reduced, std::move(info));
+            }
+            captured++;
+        } else {
+            refused++;
+        }
+
+        if (delivered == options.frames) {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            done = true;
+            doneCV.notify_all();
+        }
+    };
+    auto onError = [&](const std::string &error) {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        sourceError = error;
+        done = true;
+        doneCV.notify_all();
+    };
+
+    auto started = steady_clock::now();
+    if (!source->start(onFrame, onError)) {
+        return 1;
+    }
+    {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCV.wait(lock, [&] { return done; });
+    }
+    source->stop();
+    pipeline.stop();  // Encodes and writes everything captured
+    double seconds = duration<double>(steady_clock::now() - started).count();
+    display.stop();
+
+    if (!sourceError.empty()) {
+        std::cerr << "Source failed: " << sourceError << std::endl;
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "\nFrames: " << delivered << " delivered, " << captured << " captured, "
+              << refused << " refused by backpressure, " << source->droppedFrames() << " dropped by the source\n"
+              << "Files: " << saved << " written, " << failed << " failed, "
+              << (captured + stackFrames - 1) / stackFrames - saved - failed << " dropped from the queue, "
+              << bytes / (1024.0 * 1024.0) << " MB\n"
+              << "Time: " << seconds << " s, " << std::setprecision(2) << saved / seconds << " captures/s, "
+              << bytes / (1024.0 * 1024.0) / seconds << " MB/s" << std::endl;
+    CatalogEntry latest;
+    if (options.catalog && catalog.entry(catalog.latest(CatalogKind::Jpeg), latest)) {
+        std::cout << std::setprecision(1) << "Catalog: " << catalog.size() << " entries, "
+                  << catalogNs.load() / 1000.0 / std::max<int64_t>(1, catalogAppends.load())
+                  << " us per append, latest " << latest.name << std::endl;
+    }
+    if (format.viewfinderWidth > 0) {
+        DisplayService::ViewfinderStats stats = display.viewfinderStats();
+        std::cout << "Viewfinder: " << stats.drawn << " of " << stats.offered << " frames drawn, "
+                  << stats.skipped << " skipped, " << stats.drawn / seconds << " fps" << std::endl;
+    }
+    if (delivered > 0) {
+        std::cout << std::setprecision(1) << "Meter: " << meterTotal.count() / delivered << " us per frame, max "
+                  << meterMax.count() << " us; mean " << lumaStats.mean << ", " << lumaStats.clipped * 100
+                  << "% clipped, suggest " << suggestion.exposureTimeUs << " us at gain "
+                  << suggestion.analogueGain << " (" << std::showpos << suggestion.ev << std::noshowpos
+                  << " EV)" << std::endl;
+    }
+    if (options.defer && saved > 0) {
+        std::cout << std::setprecision(2) << "Spool: "
+                  << static_cast<double>(saved) * yuv420Size(format.width, format.height) / bytes
+                  << "x smaller than the frames" << std::endl;
+    }
+    std::cout << std::endl;
+    trace.report(std::cout);
+
+    // Then turn the spool into JPEGs, as the camera app does once idle, on a
+    // fresh pipeline that finds the files as left by an earlier run
+    if (options.defer) {
+        PipelineSettings settings = options.pipeline;
+        settings.transcodeIdleMs = 0;
+        CapturePipeline transcoder(settings, trace, metrics);
+        size_t spooled = countSpoolFiles(settings.spoolDirectory);
+        auto transcodeStart = steady_clock::now();
+        if (transcoder.start(format)) {
+            // Until the spool is empty, or stops shrinking
+            size_t left = spooled;
+            auto progress = steady_clock::now();
+            while (left > 0 && steady_clock::now() - progress < std::chrono::seconds(10)) {
+                std::this_thread::sleep_for(milliseconds(20));
+                size_t now = countSpoolFiles(settings.spoolDirectory);
+                if (now < left) {
+                    progress = steady_clock::now();
+                }
+                left = now;
+            }
+            transcoder.stop();
+        }
+        size_t transcoded = spooled - countSpoolFiles(settings.spoolDirectory);
+        double transcodeSeconds = duration<double>(steady_clock::now() - transcodeStart).count();
+        std::cout << std::setprecision(1) << "\nTranscode: " << transcoded << " of " << spooled
+                  << " spool files to JPEG in " << transcodeSeconds << " s" << std::endl;
+    }
+    trace.closeTraceFile();
+    if (!options.metricsFile.empty()) {
+        metrics.writeSnapshot(options.metricsFile);
+    }
+
+    if (tempDir) {
+        std::error_code ec;
+        fs::remove_all(options.outDir, ec);
+    } else {
+        std::cout << "Files kept in " << options.outDir << std::endl;
+    }
+    return sourceError.empty() && failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,927 @@
+#include "capture_pipeline.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dng_writer.h"
+#include "exif_writer.h"
+#include "jpeg_strips.h"
+#include "spool_file.h"
+#include "thread_policy.h"
+#include "yuv_scale.h"
+
+using namespace std::chrono;
+
+namespace {
+
+constexpr int THUMBNAIL_QUALITY = 75;
+constexpr int TRANSCODE_NICE = 19;
+constexpr auto TRANSCODE_POLL = std::chrono::milliseconds(250);
+
+// Compare file names with runs of digits taken as numbers, so a collision
+// suffix orders as written: "x_2" before "x_10". The timestamp digits in a
+// name are fixed width, so they still order by time.
+bool captureOrderLess(const std::string &a, const std::string &b) {
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (std::isdigit(static_cast<unsigned char>(a[i])) &&
+            std::isdigit(static_cast<unsigned char>(b[j]))) {
+            size_t iEnd = i, jEnd = j;
+            while (iEnd < a.size() && std::isdigit(static_cast<unsigned char>(a[iEnd]))) iEnd++;
+            while (jEnd < b.size() && std::isdigit(static_cast<unsigned char>(b[jEnd]))) jEnd++;
+            // Leading zeros don't count towards a number's size
+            while (i + 1 < iEnd && a[i] == '0') i++;
+            while (j + 1 < jEnd && b[j] == '0') j++;
+            if (iEnd - i != jEnd - j) {
+                return iEnd - i < jEnd - j;
+            }
+            int order = a.compare(i, iEnd - i, b, j, jEnd - j);
+            if (order != 0) {
+                return order < 0;
+            }
+            i = iEnd;
+            j = jEnd;
+        } else if (a[i] != b[j]) {
+            return a[i] < b[j];
+        } else {
+            i++;
+            j++;
+        }
+    }
+    return a.size() - i < b.size() - j;
+}
+
+}  // namespace
+
+const char *backpressureName(Backpressure policy) {
+    switch (policy) {
+        case Backpressure::Block: return "block";
+        case Backpressure::DropOldest: return "drop-oldest";
+        case Backpressure::ReduceResolution: return "reduce-resolution";
+        case Backpressure::Spill: return "spill";
+    }
+    return "block";
+}
+
+// --- Ordered completion ---
+void CapturePipeline::CommitSequencer::waitTurn(uint64_t sequence) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] { return next_ == sequence; });
+}
+
+void CapturePipeline::CommitSequencer::finish(uint64_t sequence) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished_.insert(sequence);
+        while (!finished_.empty() && *finished_.begin() == next_) {
+            finished_.erase(finished_.begin());
+            next_++;
+        }
+    }
+    cv_.notify_all();
+}
+
+// --- Lifecycle ---
+CapturePipeline::CapturePipeline(PipelineSettings settings, LatencyTrace &trace, Metrics &metrics)
+    : settings_(std::move(settings)), trace_(trace), metrics_(metrics) {}
+
+CapturePipeline::~CapturePipeline() {
+    stop();
+}
+
+bool CapturePipeline::start(const FrameFormat &format) {
+    if (settings_.stackFrames > 1 && settings_.backpressure == Backpressure::ReduceResolution) {
+        std::cerr << "Stacking cannot use reduce-resolution backpressure: stacks are added at full size"
+                  << std::endl;
+        return false;
+    }
+    format_ = format;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = false;
+    }
+
+    // Initialize one turbojpeg compressor per encoder worker
+    for (int i = 0; i < settings_.encoderWorkers; i++) {
+        tjhandle handle = tjInitCompress();
+        if (!handle) {
+            std::cerr << "Failed to initialize turbojpeg" << std::endl;
+            return false;
+        }
+        encoderHandles_.push_back(handle);
+    }
+
+    // One encode pool thread per core besides the calling encoder worker
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    encodePool_ = std::make_unique<WorkerPool>(cores - 1);
+
+    // Only arenas of whole frames are locked. Encoder output (JPEG, spool)
+    // is sized for the worst case and mostly never touched, and the park
+    // arena is a budget for frames that may never queue up, so those stay
+    // pageable and cost only the memory they use.
+    FrameArena *memoryArenas[] = {&scaleArena_, &rawArena_, &stackArena_, &transcodeArena_};
+    for (FrameArena *arena : memoryArenas) {
+        arena->setMemoryPolicy(settings_.lockMemory, settings_.hugePages);
+    }
+
+    // Size the JPEG output arena for the worst case of the source's format
+    jpegStrips_ = jpegStripCount(format.width, format.height,
+                                 settings_.jpegStrips ? settings_.jpegStrips : encodePool_->concurrency());
+    if (!jpegArena_.allocate(jpegStripBufferSize(format.width, format.height, jpegStrips_),
+                             settings_.encoderWorkers + settings_.writeQueueDepth)) {
+        std::cerr << "Failed to allocate JPEG arena" << std::endl;
+        return false;
+    }
+    if (settings_.backpressure == Backpressure::ReduceResolution &&
+        !scaleArena_.allocate(yuv420Size(format.width / 2, format.height / 2), settings_.encoderWorkers)) {
+        std::cerr << "Failed to allocate half-resolution arena" << std::endl;
+        return false;
+    }
+
+    // Spill backpressure: copies of queued frames, in memory up to the budget
+    // and then in a spill file next to the captures
+    if (settings_.backpressure == Backpressure::Spill) {
+        size_t frameSize = yuv420Size(format.width & ~1, format.height & ~1);
+        size_t memorySlots = settings_.queueMemoryBytes / frameSize;
+        size_t fileSlots = settings_.spillFileBytes / frameSize;
+        if ((memorySlots > 0 && !parkArena_.allocate(frameSize, memorySlots)) ||
+            (fileSlots > 0 && !spillArena_.allocateFile(settings_.directory, frameSize, fileSlots))) {
+            std::cerr << "Failed to allocate capture queue" << std::endl;
+            return false;
+        }
+        std::cout << "Capture queue: " << memorySlots << " frame(s) in memory, then " << fileSlots
+                  << " in the spill file" << std::endl;
+    }
+
+    storageWriter_ = std::make_unique<StorageWriter>(settings_.directory, settings_.fsyncPolicy);
+    storageWriter_->removeStaleTempFiles();
+    storageWriter_->start();
+
+    // Raw frames are copied out packed and only unpacked while written
+    const RawLayout &raw = format.rawLayout;
+    if (raw.width > 0 && settings_.rawQueueDepth > 0) {
+        if (!rawArena_.allocate(static_cast<size_t>(raw.stride) * raw.height, settings_.rawQueueDepth)) {
+            std::cerr << "Failed to allocate raw arena" << std::endl;
+            return false;
+        }
+        rawWriter_ = std::make_unique<StorageWriter>(settings_.directory, settings_.fsyncPolicy);
+        rawWriter_->start();
+    }
+
+    // The stacker shares the encode pool; stacks are added between encodes
+    if (settings_.stackFrames > 1) {
+        stacker_ = std::make_unique<FrameStacker>(*encodePool_);
+        stacker_->allocate(format.width, format.height);
+        if (!stackArena_.allocate(yuv420Size(format.width & ~1, format.height & ~1), 1)) {
+            std::cerr << "Failed to allocate stack arena" << std::endl;
+            return false;
+        }
+        stackStopping_ = false;
+        stackerThread_ = std::thread(&CapturePipeline::stackerThreadFunc, this);
+    }
+
+    // Deferred encoding: packed frames go to the spool directory, and come
+    // back one at a time to be encoded
+    if (!settings_.spoolDirectory.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(settings_.spoolDirectory, ec);
+        if (!spoolArena_.allocate(spoolFileBound(format.width, format.height),
+                                  settings_.encoderWorkers + settings_.writeQueueDepth) ||
+            !transcodeArena_.allocate(yuv420Size(format.width & ~1, format.height & ~1), 1)) {
+            std::cerr << "Failed to allocate spool arenas" << std::endl;
+            return false;
+        }
+        spoolWriter_ = std::make_unique<StorageWriter>(settings_.spoolDirectory, settings_.fsyncPolicy);
+        spoolWriter_->removeStaleTempFiles();
+        spoolWriter_->start();
+    }
+
+    if (settings_.lockMemory) {
+        size_t locked = 0;
+        for (FrameArena *arena : memoryArenas) {
+            locked += arena->locked() ? arena->slotSize() * arena->slotCount() : 0;
+        }
+        std::cout << "Frame arenas: " << locked / (1024 * 1024) << " MB locked in memory"
+                  << (settings_.hugePages ? ", on huge pages where available" : "") << std::endl;
+    }
+
+    // Start encoder workers
+    for (size_t i = 0; i < encoderHandles_.size(); i++) {
+        encoderThreads_.emplace_back(&CapturePipeline::encoderThreadFunc, this, encoderHandles_[i],
+                                     static_cast<int>(i));
+    }
+    if (spoolWriter_) {
+        lastCapture_ = steady_clock::now();
+        transcodeStopping_ = false;
+        transcoderThread_ = std::thread(&CapturePipeline::transcoderThreadFunc, this);
+    }
+    return true;
+}
+
+void CapturePipeline::stop() {
+    // Spool files not transcoded yet stay for the next run
+    {
+        std::lock_guard<std::mutex> lock(transcodeMutex_);
+        transcodeStopping_ = true;
+    }
+    transcodeCv_.notify_all();
+    if (transcoderThread_.joinable()) {
+        transcoderThread_.join();
+    }
+
+    // The stacker queues the stacks it has, even a partial one, first
+    {
+        std::lock_guard<std::mutex> lock(stackMutex_);
+        stackStopping_ = true;
+    }
+    stackCv_.notify_all();
+    if (stackerThread_.joinable()) {
+        stackerThread_.join();
+    }
+    stacker_.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+
+    // Workers finish pending jobs before exiting
+    for (auto &t : encoderThreads_) {
+        t.join();
+    }
+    encoderThreads_.clear();
+    if (storageWriter_) {
+        storageWriter_->stop();
+        storageWriter_.reset();
+    }
+    if (spoolWriter_) {
+        spoolWriter_->stop();
+        spoolWriter_.reset();
+    }
+    // After the JPEGs and spool files, whose completions queue the DNGs
+    if (rawWriter_) {
+        rawWriter_->stop();
+        rawWriter_.reset();
+    }
+
+    encodePool_.reset();
+    for (tjhandle handle : encoderHandles_) {
+        tjDestroy(handle);
+    }
+    encoderHandles_.clear();
+}
+
+// --- Admission and backpressure ---
+bool CapturePipeline::admit(bool &reduced) {
+    int buffers = static_cast<int>(format_.bufferCount);
+    int limit = std::min(settings_.maxInFlight, buffers - 1);
+    if (framesInFlight_.load() < limit) {
+        return true;
+    }
+
+    switch (settings_.backpressure) {
+        case Backpressure::Block:
+            return false;
+        case Backpressure::DropOldest: {
+            // Only a job holding a source buffer makes room. Transcodes and
+            // stacked averages hold none, and a stack's frames have already
+            // gone back to the source, so they are never dropped.
+            Job dropped;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto job = std::find_if(queue_.begin(), queue_.end(), [](const Job &j) { return j.holdsSource; });
+                if (job == queue_.end()) {
+                    return false;  // Everything holding a buffer is already encoding
+                }
+                dropped = std::move(*job);
+                queue_.erase(job);
+            }
+            std::cout << "Capture queue full, dropping " << dropped.info.name << std::endl;
+            metrics_.add(Counter::CapturesDropped);
+            commitSequencer_.finish(dropped.sequence);
+            return true;  // The dropped job returns its buffer on destruction
+        }
+        case Backpressure::ReduceResolution:
+            if (framesInFlight_.load() >= buffers - 1) {
+                return false;
+            }
+            reduced = true;
+            return true;
+        case Backpressure::Spill:
+            // Past the limit frames queue up to the source's last buffer, and
+            // are then copied out to make room
+            return parkOldest() || framesInFlight_.load() < buffers - 1;
+    }
+    return false;
+}
+
+// Copy the oldest queued frame that still holds a source buffer out of it,
+// into memory or else the spill file, which hands the buffer back. Done under
+// the queue lock, so the encoders can't take the job meanwhile; they are busy
+// anyway, or the queue would not have filled.
+bool CapturePipeline::parkOldest() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto job = std::find_if(queue_.begin(), queue_.end(), [](const Job &j) { return j.holdsSource; });
+    if (job == queue_.end()) {
+        return false;  // Everything holding a buffer is already encoding
+    }
+
+    FrameArena *arena = &parkArena_;
+    uint8_t *slot = parkArena_.tryAcquire();
+    if (!slot) {
+        arena = &spillArena_;
+        slot = spillArena_.tryAcquire();
+    }
+    if (!slot) {
+        std::cout << "Capture queue: " << queue_.size() << " waiting, memory and spill file full, holding frames"
+                  << std::endl;
+        return false;
+    }
+
+    YuvFrame copy = packedYuv420(slot, job->frame.width & ~1, job->frame.height & ~1);
+    for (int i = 0; i < 3; i++) {
+        int width = i == 0 ? copy.width : copy.width / 2;
+        int height = i == 0 ? copy.height : copy.height / 2;
+        for (int row = 0; row < height; row++) {
+            memcpy(const_cast<uint8_t *>(copy.planes[i]) + static_cast<size_t>(row) * copy.strides[i],
+                   job->frame.planes[i] + static_cast<size_t>(row) * job->frame.strides[i], width);
+        }
+    }
+    arena->writeBack(slot);
+    keepRaw(*job);
+    metrics_.add(arena == &parkArena_ ? Counter::FramesParked : Counter::FramesSpilled);
+
+    size_t bytes = yuv420Size(copy.width, copy.height);
+    std::atomic<size_t> &held = arena == &parkArena_ ? parkedBytes_ : spilledBytes_;
+    held += bytes;
+    job->frame = copy;
+    job->holdsSource = false;
+    job->lease = std::shared_ptr<void>(slot, [arena, &held, bytes](void *s) {
+        arena->recycle(static_cast<uint8_t *>(s));
+        held -= bytes;
+    });
+    std::cout << "Capture queue: " << queue_.size() << " waiting, " << parkedBytes_.load() / (1024 * 1024)
+              << " MB copied to memory, " << spilledBytes_.load() / (1024 * 1024) << " MB spilled" << std::endl;
+    return true;
+}
+
+uint64_t CapturePipeline::submit(const SourceFrame &frame, bool reduced, CaptureInfo info) {
+    std::cout << "Capture: " << frame.image.width << "x" << frame.image.height
+              << (reduced ? " (queuing for half-resolution encoding)" : " (queuing for encoding)") << std::endl;
+    if (reduced) {
+        metrics_.add(Counter::CapturesReduced);
+    }
+
+    // The job points straight into the source buffer and keeps it leased,
+    // counted as in flight, until the encoder drops it
+    Job job;
+    framesInFlight_++;
+    job.lease = std::shared_ptr<void>(nullptr, [this, lease = frame.lease](void *) mutable {
+        lease.reset();
+        framesInFlight_--;  // Only once the source has its buffer back
+    });
+    job.frame = frame.image;
+    job.holdsSource = true;
+    if (rawWriter_) {
+        job.raw = frame.raw;
+    }
+    job.reduced = reduced;
+    job.info = std::move(info);
+    lastCapture_ = steady_clock::now();
+
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sequence = job.sequence = nextSequence_++;
+        job.queuedTime = steady_clock::now();
+        queue_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+    trace_.record(LatencyStage::Handoff, sequence, frame.arrival, steady_clock::now());
+    return sequence;
+}
+
+// --- Stacking ---
+uint64_t CapturePipeline::submitStacked(const SourceFrame &frame, int index, CaptureInfo info) {
+    StackedFrame stacked;
+    framesInFlight_++;
+    stacked.lease = std::shared_ptr<void>(nullptr, [this, lease = frame.lease](void *) mutable {
+        lease.reset();
+        framesInFlight_--;  // Only once the source has its buffer back
+    });
+    stacked.frame = frame.image;
+    stacked.index = index;
+    stacked.info = std::move(info);
+    lastCapture_ = steady_clock::now();
+
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(stackMutex_);
+        if (index == 0) {
+            std::lock_guard<std::mutex> queueLock(mutex_);
+            stackSequence_ = nextSequence_++;
+        }
+        sequence = stacked.sequence = stackSequence_;
+        stackQueue_.push(std::move(stacked));
+    }
+    stackCv_.notify_one();
+    trace_.record(LatencyStage::Handoff, sequence, frame.arrival, steady_clock::now());
+    return sequence;
+}
+
+void CapturePipeline::stackerThreadFunc() {
+    trace_.nameThread("stacker");
+
+    bool open = false;  // A stack has frames that are not queued yet
+    uint64_t sequence = 0;
+    CaptureInfo info;
+    int maxShift = 0;
+    while (true) {
+        StackedFrame stacked;
+        {
+            std::unique_lock<std::mutex> lock(stackMutex_);
+            stackCv_.wait(lock, [this] { return !stackQueue_.empty() || stackStopping_; });
+            if (stackQueue_.empty()) {
+                break;  // Stopping and drained
+            }
+            stacked = std::move(stackQueue_.front());
+            stackQueue_.pop();
+        }
+
+        if (stacked.index == 0) {
+            if (open) {
+                finishStack(sequence, std::move(info));  // Cut short by the next press
+            }
+            stacker_->begin();
+            sequence = stacked.sequence;
+            info = std::move(stacked.info);
+            maxShift = 0;
+            open = true;
+        } else if (!open) {
+            continue;  // Its stack has already been queued
+        }
+
+        auto addStart = steady_clock::now();
+        int dx, dy;
+        stacker_->add(stacked.frame, dx, dy);
+        stacked.lease.reset();
+        trace_.record(LatencyStage::Stack, sequence, addStart, steady_clock::now());
+        maxShift = std::max({maxShift, std::abs(dx), std::abs(dy)});
+
+        if (stacked.index + 1 >= settings_.stackFrames) {
+            std::cout << "Stacked " << stacker_->frames() << " frames for " << info.name << ", up to "
+                      << maxShift << " px apart" << std::endl;
+            finishStack(sequence, std::move(info));
+            open = false;
+        }
+    }
+    if (open) {
+        std::cout << "Stopping, queuing a partial stack of " << stacker_->frames() << " frames" << std::endl;
+        finishStack(sequence, std::move(info));
+    }
+}
+
+void CapturePipeline::finishStack(uint64_t sequence, CaptureInfo info) {
+    // Waits for the encoder to take the previous stack. The average is leased
+    // from the stack arena, not the source, so backpressure never drops it.
+    uint8_t *slot = stackArena_.acquire();
+    Job job;
+    job.frame = stacker_->finish(slot);
+    job.lease = std::shared_ptr<void>(slot, [this](void *s) { stackArena_.recycle(static_cast<uint8_t *>(s)); });
+    job.sequence = sequence;
+    job.info = std::move(info);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job.queuedTime = steady_clock::now();
+        queue_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+}
+
+// --- Encoder workers ---
+// Several of these run at once, each with its own compressor
+void CapturePipeline::encoderThreadFunc(tjhandle tjInstance, int index) {
+    trace_.nameThread("encoder " + std::to_string(index));
+    if (settings_.pinEncoders) {
+        // From the last core down, leaving the first to the camera and event
+        // threads; only worth it with a core for each
+        unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        if (cores > encoderHandles_.size()) {
+            pinToCore(("Encoder " + std::to_string(index)).c_str(), cores - 1 - index);
+        } else {
+            std::cout << "Encoder " << index << ": not pinned, " << cores << " core(s) for "
+                      << encoderHandles_.size() << " encoders" << std::endl;
+        }
+    }
+
+    // Per-worker preview buffers, reused for every capture
+    bool thumbnails = settings_.thumbnailWidth > 0 && settings_.thumbnailHeight > 0;
+    std::vector<uint8_t> thumbYuv(thumbnails ? yuv420Size(settings_.thumbnailWidth, settings_.thumbnailHeight) : 0);
+    std::vector<uint8_t> thumbJpeg(thumbnails ? tjBufSize(settings_.thumbnailWidth, settings_.thumbnailHeight, TJSAMP_420) : 0);
+
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return !queue_.empty() || stopping_; });
+
+            if (queue_.empty()) {
+                break;  // Stopping and drained
+            }
+
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        auto encodeStart = steady_clock::now();
+        trace_.record(LatencyStage::QueueWait, job.sequence, job.queuedTime, encodeStart);
+
+        // Frames admitted under reduce-resolution backpressure are halved
+        // first, which returns the source buffer before the cheaper encode
+        uint8_t *scaled = job.reduced ? scaleArena_.acquire() : nullptr;
+        uint8_t *rawSlot = nullptr;
+        if (scaled) {
+            YuvFrame half = halfSizeYuv420(job.frame, scaled);
+            int bands = static_cast<int>(encodePool_->concurrency());
+            int bandRows = ((half.height + bands - 1) / bands + 1) & ~1;
+            encodePool_->parallelFor(bands, [&](size_t i) {
+                int row = static_cast<int>(i) * bandRows;
+                halveYuv420(job.frame, scaled, row, row + bandRows);
+            });
+            job.frame = half;
+            rawSlot = keepRaw(job);
+            job.lease.reset();
+        }
+
+        // Deferred: store the frame packed, to be encoded later
+        if (spoolWriter_ && job.spoolPath.empty()) {
+            if (!scaled) {
+                rawSlot = keepRaw(job);
+            }
+            spoolJob(job, rawSlot, encodeStart);
+            scaleArena_.recycle(scaled);
+            continue;
+        }
+
+        // Encode straight from the source planes, one strip per core.
+        // turbojpeg honours the per-plane strides, so the stride padding
+        // never has to be removed. Output goes into a preallocated arena slot.
+        unsigned char *jpegBuf = jpegArena_.acquire();
+        unsigned long jpegSize = 0;
+        std::string encodeError;
+
+        bool encoded = jpegBuf && compressStripsToJpeg(*encodePool_, tjInstance, job.frame, jpegStrips_,
+                                                       settings_.jpegQuality, TJFLAG_FASTDCT, jpegBuf, jpegSize,
+                                                       encodeError);
+
+        auto encodeEnd = steady_clock::now();
+        trace_.record(LatencyStage::Encode, job.sequence, encodeStart, encodeEnd);
+
+        // Preview for review, sampled from the planes while they are still
+        // held. Review then never has to decode the full image.
+        std::vector<uint8_t> thumbnail;
+        if (encoded && thumbnails) {
+            int width, height;
+            fitYuv420(job.frame, settings_.thumbnailWidth, settings_.thumbnailHeight, width, height);
+            sampleYuv420(job.frame, thumbYuv.data(), width, height);
+            YuvFrame small = packedYuv420(thumbYuv.data(), width, height);
+
+            unsigned char *out = thumbJpeg.data();
+            unsigned long outSize = thumbJpeg.size();
+            if (tjCompressFromYUVPlanes(tjInstance, small.planes, width, small.strides, height, TJSAMP_420,
+                                        &out, &outSize, THUMBNAIL_QUALITY, TJFLAG_NOREALLOC | TJFLAG_FASTDCT) == 0) {
+                thumbnail.assign(out, out + outSize);
+            } else {
+                std::cerr << "Thumbnail encoding failed: " << tjGetErrorStr2(tjInstance) << std::endl;
+            }
+        }
+
+        // Encoding no longer needs the source buffer, hand it back
+        if (!scaled) {
+            rawSlot = keepRaw(job);
+        }
+        job.lease.reset();
+        auto thumbnailEnd = steady_clock::now();
+        if (!thumbnail.empty()) {
+            trace_.record(LatencyStage::Thumbnail, job.sequence, encodeEnd, thumbnailEnd);
+        }
+
+        if (encoded) {
+            // EXIF goes in as an APP1 segment while writing, so the file is
+            // written once and never reopened
+            ExifInfo exif;
+            exif.width = job.frame.width;
+            exif.height = job.frame.height;
+            exif.exposureTimeUs = job.info.exposureTimeUs;
+            exif.analogueGain = job.info.analogueGain;
+            exif.timestamp = job.info.timestamp;
+            exif.thumbnail = std::move(thumbnail);
+            std::vector<uint8_t> app1 = buildExifApp1(exif);
+            size_t split = exifInsertOffset(jpegBuf, jpegSize);
+            trace_.record(LatencyStage::Exif, job.sequence, thumbnailEnd, steady_clock::now());
+
+            // Hand the file to the storage writer in capture order. The arena
+            // slot is recycled once the file is committed.
+            WriteJob write;
+            write.stem = job.info.name;
+            write.extension = ".jpg";
+            write.storage.push_back(std::move(app1));
+            write.segments = {
+                {jpegBuf, split},
+                {write.storage[0].data(), write.storage[0].size()},
+                {jpegBuf + split, jpegSize - split},
+            };
+            uint64_t sequence = job.sequence;
+            auto shutterTime = job.info.shutterTime;
+            auto submitted = std::make_shared<steady_clock::time_point>();
+            write.onDone = [this, jpegBuf, sequence, shutterTime, submitted, raw = job.raw, rawSlot,
+                            info = job.info, spoolPath = job.spoolPath](const WriteResult &result) {
+                jpegArena_.recycle(jpegBuf);
+                if (result.ok && onCommitted) {
+                    onCommitted(result, info);
+                }
+                // The DNG takes the name the JPEG got
+                if (rawSlot && result.ok) {
+                    writeDng(raw, rawSlot, info, result);
+                } else {
+                    rawArena_.recycle(rawSlot);
+                }
+                trace_.record(LatencyStage::WriteWait, sequence, *submitted, result.started);
+                trace_.record(LatencyStage::Write, sequence, result.started, result.finished);
+                countWrite(result);
+                if (result.ok) {
+                    std::cout << "Saved: " << result.path << " (" << result.bytes / 1024 << " KB)" << std::endl;
+                }
+                if (!spoolPath.empty()) {
+                    // Transcoded; the capture was signalled when it was spooled
+                    transcodeDone(spoolPath, result.ok);
+                    return;
+                }
+                if (result.ok) {
+                    trace_.record(LatencyStage::ShutterToDisk, sequence, shutterTime, result.finished);
+                }
+                if (onSaved) {
+                    onSaved(sequence, result);
+                }
+            };
+
+            commitSequencer_.waitTurn(job.sequence);
+            *submitted = steady_clock::now();
+            storageWriter_->submit(std::move(write));
+            jpegBuf = nullptr;
+            rawSlot = nullptr;
+        } else {
+            std::cerr << "JPEG encoding failed: " << encodeError << std::endl;
+            metrics_.add(Counter::EncodeFailures);
+            if (!job.spoolPath.empty()) {
+                transcodeDone(job.spoolPath, false);
+            }
+        }
+        commitSequencer_.finish(job.sequence);
+        jpegArena_.recycle(jpegBuf);
+        scaleArena_.recycle(scaled);
+        rawArena_.recycle(rawSlot);
+    }
+}
+
+// --- Deferred encoding ---
+void CapturePipeline::spoolJob(Job &job, uint8_t *rawSlot, steady_clock::time_point encodeStart) {
+    SpoolInfo spool;
+    spool.name = job.info.name;
+    spool.exposureTimeUs = job.info.exposureTimeUs;
+    spool.analogueGain = job.info.analogueGain;
+    spool.timestamp = job.info.timestamp;
+
+    uint8_t *slot = spoolArena_.acquire();
+    size_t size = packSpoolFile(*encodePool_, job.frame, spool, slot);
+    job.lease.reset();
+    trace_.record(LatencyStage::Encode, job.sequence, encodeStart, steady_clock::now());
+
+    WriteJob write;
+    write.stem = job.info.name;
+    write.extension = SPOOL_EXTENSION;
+    write.segments = {{slot, size}};
+    uint64_t sequence = job.sequence;
+    auto shutterTime = job.info.shutterTime;
+    auto submitted = std::make_shared<steady_clock::time_point>();
+    write.onDone = [this, slot, sequence, shutterTime, submitted, raw = job.raw, rawSlot,
+                    info = job.info](const WriteResult &result) {
+        spoolArena_.recycle(slot);
+        if (rawSlot && result.ok) {
+            writeDng(raw, rawSlot, info, result);
+        } else {
+            rawArena_.recycle(rawSlot);
+        }
+        trace_.record(LatencyStage::WriteWait, sequence, *submitted, result.started);
+        trace_.record(LatencyStage::Write, sequence, result.started, result.finished);
+        countWrite(result);
+        if (result.ok) {
+            std::cout << "Spooled: " << result.path << " (" << result.bytes / 1024 << " KB)" << std::endl;
+            trace_.record(LatencyStage::ShutterToDisk, sequence, shutterTime, result.finished);
+        }
+        if (onSaved) {
+            onSaved(sequence, result);
+        }
+    };
+
+    commitSequencer_.waitTurn(job.sequence);
+    *submitted = steady_clock::now();
+    spoolWriter_->submit(std::move(write));
+    commitSequencer_.finish(job.sequence);
+}
+
+size_t CapturePipeline::queueDepth() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+// Counted for JPEGs, spool files and DNGs alike, on their writer threads
+void CapturePipeline::countWrite(const WriteResult &result) {
+    if (result.ok) {
+        metrics_.add(Counter::FilesWritten);
+        metrics_.add(Counter::BytesWritten, result.bytes);
+    } else {
+        metrics_.add(Counter::WriteFailures);
+    }
+}
+
+// No captures in flight or queued, and none for a while
+bool CapturePipeline::idle() {
+    if (framesInFlight_.load() > 0 ||
+        steady_clock::now() - lastCapture_.load() < milliseconds(settings_.transcodeIdleMs)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.empty();
+}
+
+void CapturePipeline::transcoderThreadFunc() {
+    trace_.nameThread("transcoder");
+    // Lower only this thread; the JPEG encode runs on the encoder workers,
+    // but only while nothing else needs them
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), TRANSCODE_NICE);
+
+    std::unique_lock<std::mutex> lock(transcodeMutex_);
+    while (!transcodeCv_.wait_for(lock, TRANSCODE_POLL, [this] { return transcodeStopping_; })) {
+        lock.unlock();
+        if (idle()) {
+            transcodeNext();
+        }
+        lock.lock();
+    }
+}
+
+bool CapturePipeline::transcodeNext() {
+    // Oldest first. Names hold the capture time to the second, then the
+    // writer's _N suffix for captures within that second.
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(transcodeMutex_);
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(settings_.spoolDirectory, ec)) {
+            std::string name = entry.path().string();
+            if (entry.path().extension() == SPOOL_EXTENSION && !spoolPending_.count(name) &&
+                !spoolSkipped_.count(name) && (path.empty() || captureOrderLess(name, path))) {
+                path = name;
+            }
+        }
+    }
+    if (path.empty()) {
+        return false;
+    }
+    // The one frame slot is free once the last transcode is encoded
+    uint8_t *slot = transcodeArena_.tryAcquire();
+    if (!slot) {
+        return false;
+    }
+
+    // Unpacked on this thread alone, at its low priority
+    int width = 0, height = 0;
+    SpoolInfo spool;
+    bool ok = false;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        size_t size = static_cast<size_t>(st.st_size);
+        void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+            WorkerPool serial(0);
+            ok = readSpoolHeader(bytes, size, width, height, spool) &&
+                 yuv420Size(width, height) <= transcodeArena_.slotSize() &&
+                 unpackSpoolFile(serial, bytes, size, slot);
+            munmap(data, size);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!ok) {
+        std::cerr << "Cannot transcode " << path << ", leaving it" << std::endl;
+        transcodeArena_.recycle(slot);
+        std::lock_guard<std::mutex> lock(transcodeMutex_);
+        spoolSkipped_.insert(path);
+        return false;
+    }
+
+    Job job;
+    job.frame = packedYuv420(slot, width, height);
+    job.lease = std::shared_ptr<void>(slot, [this](void *s) { transcodeArena_.recycle(static_cast<uint8_t *>(s)); });
+    job.info.name = spool.name;
+    job.info.exposureTimeUs = spool.exposureTimeUs;
+    job.info.analogueGain = spool.analogueGain;
+    job.info.timestamp = spool.timestamp;
+    job.spoolPath = path;
+    {
+        std::lock_guard<std::mutex> lock(transcodeMutex_);
+        spoolPending_.insert(path);
+    }
+    std::cout << "Transcoding " << path << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job.sequence = nextSequence_++;
+        job.queuedTime = steady_clock::now();
+        queue_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+// A transcode's JPEG is committed, or it failed and the spool file is tried
+// again later
+void CapturePipeline::transcodeDone(const std::string &path, bool committed) {
+    if (committed) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+    std::lock_guard<std::mutex> lock(transcodeMutex_);
+    spoolPending_.erase(path);
+}
+
+// --- DNGs ---
+uint8_t *CapturePipeline::keepRaw(Job &job) {
+    if (!job.raw.data || job.rawSlot) {
+        return job.rawSlot;  // None, or already copied out when the job was parked
+    }
+    uint8_t *slot = rawArena_.tryAcquire();
+    if (!slot) {
+        std::cout << "DNG writer busy, skipping raw for " << job.info.name << std::endl;
+        metrics_.add(Counter::DngsSkipped);
+        job.raw.data = nullptr;
+        return nullptr;
+    }
+    memcpy(slot, job.raw.data, static_cast<size_t>(job.raw.layout.stride) * job.raw.layout.height);
+    job.raw.data = slot;
+    job.rawSlot = slot;
+    return slot;
+}
+
+// Called on the JPEG writer thread; the DNG is unpacked a band of rows at a
+// time into the raw writer's staging buffer as it goes out
+void CapturePipeline::writeDng(const RawFrame &raw, uint8_t *slot, const CaptureInfo &info, const WriteResult &jpeg) {
+    DngInfo dngInfo;
+    dngInfo.exposureTimeUs = info.exposureTimeUs;
+    dngInfo.analogueGain = info.analogueGain;
+    dngInfo.timestamp = info.timestamp;
+
+    std::string stem = jpeg.path.substr(jpeg.path.find_last_of('/') + 1);
+    stem = stem.substr(0, stem.find_last_of('.'));
+
+    WriteJob write;
+    write.stem = stem;
+    write.extension = ".dng";
+    write.storage.push_back(buildDngHeader(raw, dngInfo));
+    write.segments = {{write.storage[0].data(), write.storage[0].size()}};
+    write.streamSize = dngImageSize(raw.layout);
+    write.stream = [raw, row = 0](uint8_t *buffer, size_t capacity) mutable -> size_t {
+        size_t rowBytes = static_cast<size_t>(raw.layout.width) * 2;
+        int rows = std::min(raw.layout.height - row, static_cast<int>(capacity / rowBytes));
+        if (rows <= 0) {
+            return 0;
+        }
+        unpackRawRows(raw.data, raw.layout, row, row + rows, buffer);
+        row += rows;
+        return rows * rowBytes;
+    };
+    write.onDone = [this, slot, info](const WriteResult &result) {
+        rawArena_.recycle(slot);
+        countWrite(result);
+        if (result.ok && onCommitted) {
+            onCommitted(result, info);
+        }
+        if (result.ok) {
+            std::cout << "Saved: " << result.path << " (" << result.bytes / 1024 << " KB)" << std::endl;
+        }
+    };
+    rawWriter_->submit(std::move(write));
+}
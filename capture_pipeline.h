@@ -0,0 +1,238 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <deque>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <turbojpeg.h>
+
+#include "frame_arena.h"
+#include "frame_source.h"
+#include "frame_stacker.h"
+#include "latency_trace.h"
+#include "metrics.h"
+#include "storage_writer.h"
+#include "worker_pool.h"
+
+// --- Capture pipeline ---
+// Turns frames chosen for capture into files. Encoder workers encode straight
+// from the source's buffers, EXIF is spliced in, and the storage writer
+// commits files in capture order. A captured frame holds its source buffer
+// until it is encoded; the backpressure policy decides what happens when too
+// many are in flight.
+//
+// A captured frame's raw Bayer frame, when the source delivers one, is copied
+// out before the source buffer goes back and saved next to the JPEG as a DNG
+// by a writer thread of its own, so slow DNG writes never hold up JPEGs. A
+// DNG is skipped when too many are still waiting to be written.
+//
+// In stacking mode a capture is a run of consecutive frames instead. A
+// stacker thread aligns and adds each one as it arrives, returning its source
+// buffer straight away, and queues their average for encoding as one JPEG.
+
+enum class Backpressure { Block, DropOldest, ReduceResolution, Spill };
+
+const char *backpressureName(Backpressure policy);
+
+struct PipelineSettings {
+    std::string directory;            // Where files are committed
+    int encoderWorkers = 2;           // Captures encoded at once, each with its own compressor
+    int writeQueueDepth = 2;          // Encoded captures that may wait for the storage writer
+    int maxInFlight = 2;              // Captures allowed to hold source buffers
+    Backpressure backpressure = Backpressure::Block;
+    // Spill backpressure: queued frames are copied out of the source's
+    // buffers into this much memory, then into a spill file of up to
+    // spillFileBytes in the capture directory
+    size_t queueMemoryBytes = 256u << 20;
+    size_t spillFileBytes = size_t{2} << 30;
+    FsyncPolicy fsyncPolicy = FsyncPolicy::File;
+    unsigned int jpegStrips = 0;      // Strips encoded in parallel per frame (0 = one per core)
+    int jpegQuality = 90;
+    // EXIF preview embedded in each file, for fast review (0 = none)
+    int thumbnailWidth = 320;
+    int thumbnailHeight = 240;
+    int rawQueueDepth = 2;            // Raw frames that may wait for the DNG writer
+    // Frames averaged into each capture (0 or 1 = no stacking), at most
+    // FrameStacker::MAX_FRAMES. Stacks are added at full size, so start()
+    // refuses stacking under reduce-resolution backpressure.
+    int stackFrames = 0;
+    // Deferred encoding: where captures are spooled (empty = encode them
+    // straight away), and how long the pipeline must be idle before they
+    // are transcoded
+    std::string spoolDirectory;
+    int transcodeIdleMs = 3000;
+    // Keep each encoder worker on a core of its own, from the last core
+    // down, and lock the frame arenas in RAM, optionally on huge pages
+    bool pinEncoders = false;
+    bool lockMemory = false;
+    bool hugePages = false;
+};
+
+struct CaptureInfo {
+    std::string name;          // File name stem; the storage writer makes it unique
+    int32_t exposureTimeUs = 0;
+    float analogueGain = 0;
+    std::string timestamp;     // EXIF DateTime
+    // Shutter press, or frame arrival for later burst frames
+    std::chrono::steady_clock::time_point shutterTime;
+};
+
+class CapturePipeline {
+public:
+    CapturePipeline(PipelineSettings settings, LatencyTrace &trace, Metrics &metrics);
+    ~CapturePipeline();
+
+    // Allocate for the source's format and start the workers. A stopped
+    // pipeline can be started again for another format.
+    bool start(const FrameFormat &format);
+    // Encode and write everything already captured, then stop the workers
+    void stop();
+
+    // Whether a new frame may be captured while earlier ones still hold
+    // source buffers. Never lets captures take the source's last buffer.
+    // Sets reduced if the frame is to be encoded at half resolution. Under
+    // drop-oldest backpressure, makes room by dropping the oldest queued
+    // frame still holding a source buffer, never a stack or a transcode;
+    // under spill, by copying one out.
+    bool admit(bool &reduced);
+    // Queue a frame for encoding and return its capture sequence number
+    uint64_t submit(const SourceFrame &frame, bool reduced, CaptureInfo info);
+    // Queue frame `index` of a stack for stacking; the first one starts a new
+    // stack and its info names the capture. Returns the stack's sequence number.
+    uint64_t submitStacked(const SourceFrame &frame, int index, CaptureInfo info);
+
+    // Captures holding a source buffer; zero once the source may go away
+    int framesInFlight() const { return framesInFlight_.load(); }
+    // Captures waiting for an encoder
+    size_t queueDepth();
+    unsigned int jpegStrips() const { return jpegStrips_; }
+
+    // Called on the writer thread, in capture order, for every capture
+    // written (as a spool file, when deferred). Not called for transcodes.
+    std::function<void(uint64_t sequence, const WriteResult &result)> onSaved;
+    // Called on the writer threads for every JPEG and DNG committed to the
+    // directory, transcodes included; not for spool files
+    std::function<void(const WriteResult &result, const CaptureInfo &info)> onCommitted;
+
+private:
+    struct Job {
+        std::shared_ptr<void> lease;  // Keeps the source buffer until encoded
+        YuvFrame frame;
+        RawFrame raw;  // Null data without a raw frame, or once copied out
+        uint8_t *rawSlot = nullptr;  // The raw frame's copy, once made
+        bool holdsSource = false;    // frame points into a source buffer
+        bool reduced = false;
+        uint64_t sequence = 0;
+        CaptureInfo info;
+        std::chrono::steady_clock::time_point queuedTime;
+        std::string spoolPath;  // Transcoding this spool file, deleted once the JPEG is committed
+    };
+
+    // Encoder workers finish in any order, but files are written and
+    // signalled in capture order. A worker waits for its turn before
+    // committing; captures that never reach the commit (dropped or failed)
+    // are finished out of turn.
+    class CommitSequencer {
+    public:
+        void waitTurn(uint64_t sequence);
+        void finish(uint64_t sequence);
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        uint64_t next_ = 0;
+        std::set<uint64_t> finished_;
+    };
+
+    struct StackedFrame {
+        std::shared_ptr<void> lease;  // Keeps the source buffer until added
+        YuvFrame frame;
+        int index = 0;
+        uint64_t sequence = 0;
+        CaptureInfo info;             // Only for the first frame of a stack
+    };
+
+    void encoderThreadFunc(tjhandle tjInstance, int index);
+    void stackerThreadFunc();
+    void transcoderThreadFunc();
+    // Store a job as a spool file, in capture order
+    void spoolJob(Job &job, uint8_t *rawSlot, std::chrono::steady_clock::time_point encodeStart);
+    // Unpack the oldest spool file and queue it for encoding. False if there
+    // is none or it could not be read.
+    bool transcodeNext();
+    void transcodeDone(const std::string &path, bool committed);
+    bool idle();
+    // Average the stack so far into the stack arena and queue it for encoding
+    void finishStack(uint64_t sequence, CaptureInfo info);
+    // Copy a job's raw frame out of the source buffer, or drop it if every
+    // raw slot is taken. Returns the slot, or null.
+    uint8_t *keepRaw(Job &job);
+    bool parkOldest();
+    void countWrite(const WriteResult &result);
+    void writeDng(const RawFrame &raw, uint8_t *slot, const CaptureInfo &info, const WriteResult &jpeg);
+
+    PipelineSettings settings_;
+    LatencyTrace &trace_;
+    Metrics &metrics_;
+    FrameFormat format_;
+    std::atomic<int> framesInFlight_{0};
+
+    std::vector<std::thread> encoderThreads_;
+    std::vector<tjhandle> encoderHandles_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> queue_;
+    uint64_t nextSequence_ = 0;  // Guarded by mutex_
+    bool stopping_ = false;      // Guarded by mutex_
+    CommitSequencer commitSequencer_;
+
+    // Strip-parallel encoding: the encoder workers plus one pool thread per spare core
+    std::unique_ptr<WorkerPool> encodePool_;
+    unsigned int jpegStrips_ = 1;
+    // Preallocated JPEG output buffers (one per encoder worker plus the write queue)
+    FrameArena jpegArena_;
+    // Half-resolution frames for reduce-resolution backpressure
+    FrameArena scaleArena_;
+    std::unique_ptr<StorageWriter> storageWriter_;
+    // Raw frames waiting for the DNG writer, packed as the source delivered them
+    FrameArena rawArena_;
+    std::unique_ptr<StorageWriter> rawWriter_;
+    // Queued frames copied out of source buffers under spill backpressure
+    FrameArena parkArena_;
+    FrameArena spillArena_;
+    std::atomic<size_t> parkedBytes_{0};
+    std::atomic<size_t> spilledBytes_{0};
+
+    // Stacking: one accumulator, and one averaged frame waiting for the encoder
+    std::unique_ptr<FrameStacker> stacker_;
+    FrameArena stackArena_;
+    std::thread stackerThread_;
+    std::mutex stackMutex_;
+    std::condition_variable stackCv_;
+    std::queue<StackedFrame> stackQueue_;  // Guarded by stackMutex_
+    uint64_t stackSequence_ = 0;           // Guarded by stackMutex_
+    bool stackStopping_ = false;           // Guarded by stackMutex_
+
+    // Deferred encoding: packed frames waiting for the spool writer, and one
+    // unpacked frame waiting for the encoder
+    FrameArena spoolArena_;
+    std::unique_ptr<StorageWriter> spoolWriter_;
+    FrameArena transcodeArena_;
+    std::thread transcoderThread_;
+    std::mutex transcodeMutex_;
+    std::condition_variable transcodeCv_;
+    bool transcodeStopping_ = false;     // Guarded by transcodeMutex_
+    std::set<std::string> spoolPending_;  // Being transcoded; guarded by transcodeMutex_
+    std::set<std::string> spoolSkipped_;  // Unreadable; guarded by transcodeMutex_
+    std::atomic<std::chrono::steady_clock::time_point> lastCapture_{};
+};
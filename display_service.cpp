@@ -0,0 +1,201 @@
+#include "display_service.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "rgb565.h"
+#include "yuv_scale.h"
+
+using namespace std::chrono;
+
+namespace {
+
+constexpr int METER_RANGE = 3;  // Stops either side of the meter's centre
+
+}  // namespace
+
+DisplayService::DisplayService(DisplaySink &sink) : sink_(sink) {}
+
+DisplayService::~DisplayService() {
+    stop();
+}
+
+void DisplayService::start() {
+    stopping_ = false;
+    thread_ = std::thread(&DisplayService::threadFunc, this);
+}
+
+void DisplayService::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        pending_ = nullptr;
+    }
+    cv_.notify_all();
+    thread_.join();
+    blank();
+}
+
+void DisplayService::show(Loader load, milliseconds duration) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = std::move(load);
+        pendingDuration_ = duration;
+    }
+    cv_.notify_one();
+}
+
+void DisplayService::setViewfinder(bool enabled) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        viewfinder_ = enabled;
+        fresh_ = false;
+    }
+    cv_.notify_one();
+}
+
+void DisplayService::offerViewfinder(const YuvFrame &frame) {
+    offered_++;
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (!lock.owns_lock() || !viewfinder_) {
+        skipped_++;
+        return;
+    }
+    if (fresh_) {
+        skipped_++;  // The display never got to the previous one
+    }
+
+    // Packed copy, so the camera buffer goes back as soon as the caller is done
+    latest_.resize(yuv420Size(frame.width, frame.height));
+    latestFrame_ = packedYuv420(latest_.data(), frame.width, frame.height);
+    for (int p = 0; p < 3; p++) {
+        int rowBytes = p == 0 ? frame.width : frame.width / 2;
+        int rows = p == 0 ? frame.height : frame.height / 2;
+        uint8_t *dst = latest_.data() + (latestFrame_.planes[p] - latestFrame_.planes[0]);
+        for (int y = 0; y < rows; y++) {
+            memcpy(dst + static_cast<size_t>(y) * rowBytes,
+                   frame.planes[p] + static_cast<size_t>(y) * frame.strides[p], rowBytes);
+        }
+    }
+    fresh_ = true;
+    lock.unlock();
+    cv_.notify_one();
+}
+
+DisplayService::ViewfinderStats DisplayService::viewfinderStats() const {
+    ViewfinderStats stats;
+    stats.offered = offered_.load();
+    stats.drawn = drawn_.load();
+    stats.skipped = skipped_.load();
+    return stats;
+}
+
+void DisplayService::setExposureMeter(float ev, bool clipping) {
+    meterEv_.store(ev);
+    meterClipping_.store(clipping);
+    meter_.store(true);
+}
+
+void DisplayService::hideExposureMeter() {
+    meter_.store(false);
+}
+
+void DisplayService::threadFunc() {
+    bool reviewing = false;
+    steady_clock::time_point reviewEnds;
+
+    while (true) {
+        Loader load;
+        milliseconds duration{0};
+        bool drawViewfinder = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto ready = [&] { return stopping_ || pending_ || (!reviewing && viewfinder_ && fresh_); };
+            if (reviewing) {
+                cv_.wait_until(lock, reviewEnds, ready);
+            } else {
+                cv_.wait(lock, ready);
+            }
+            if (stopping_) {
+                break;
+            }
+
+            if (pending_) {
+                load = std::move(pending_);
+                pending_ = nullptr;
+                duration = pendingDuration_;
+            } else if (reviewing && steady_clock::now() >= reviewEnds) {
+                // The review has been up long enough
+                reviewing = false;
+                if (!viewfinder_) {
+                    lock.unlock();
+                    blank();
+                }
+                continue;
+            } else if (!reviewing && viewfinder_ && fresh_) {
+                std::swap(latest_, drawing_);
+                std::swap(latestFrame_, drawingFrame_);
+                fresh_ = false;
+                drawViewfinder = true;
+            } else {
+                continue;
+            }
+        }
+
+        if (drawViewfinder) {
+            presentViewfinder();
+            continue;
+        }
+
+        auto loadStart = steady_clock::now();
+        std::vector<unsigned char> rgb;
+        int width, height;
+        if (!load(rgb, width, height)) {
+            continue;  // Whatever is up stays
+        }
+        auto drawStart = steady_clock::now();
+        presentImage(rgb, width, height);
+        auto drawEnd = steady_clock::now();
+        std::cout << "Displayed " << width << "x" << height << " (load "
+                  << duration_cast<milliseconds>(drawStart - loadStart).count() << " ms, draw "
+                  << duration_cast<milliseconds>(drawEnd - drawStart).count() << " ms)" << std::endl;
+
+        reviewing = true;
+        reviewEnds = drawEnd + duration;
+    }
+}
+
+void DisplayService::presentImage(const std::vector<unsigned char> &rgb, int width, int height) {
+    renderRgb565(rgb.data(), width, height, sink_.frame(), sink_.width(), sink_.height(), sink_.swapBytes());
+    sink_.present();
+    setBacklight(true);
+}
+
+void DisplayService::presentViewfinder() {
+    renderYuv420Rgb565(drawingFrame_, sink_.frame(), sink_.width(), sink_.height(), sink_.swapBytes());
+    if (meter_.load()) {
+        drawExposureMeterRgb565(sink_.frame(), sink_.width(), sink_.height(), meterEv_.load(), METER_RANGE,
+                                meterClipping_.load(), sink_.swapBytes());
+    }
+    if (sink_.present()) {
+        drawn_++;
+    }
+    setBacklight(true);
+}
+
+void DisplayService::blank() {
+    setBacklight(false);
+    std::fill_n(sink_.frame(), static_cast<size_t>(sink_.width()) * sink_.height(), 0);
+    sink_.present();
+}
+
+void DisplayService::setBacklight(bool on) {
+    if (on != backlight_) {
+        sink_.setBacklight(on);
+        backlight_ = on;
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "display_sink.h"
+#include "yuv_frame.h"
+
+// --- Display service ---
+// Draws on a sink from its own thread, so callers only post what to show and
+// never wait on the panel. Two things can be shown:
+//
+// - A review image, through a single slot: a newer request replaces one not
+//   yet started. It stays up for its duration.
+// - The live viewfinder, whenever no review is up. The camera thread offers
+//   every frame; only the newest is kept, so the panel draws as fast as its
+//   link allows and stale frames are skipped, never queued. An offer does not
+//   wait: if the slot is busy, that frame is skipped.
+//
+// The viewfinder can carry an exposure meter along its bottom edge.
+//
+// With nothing to show the sink is blanked with its backlight off.
+
+class DisplayService {
+public:
+    // Produces a packed RGB888 image on the display thread
+    using Loader = std::function<bool(std::vector<unsigned char> &rgb, int &width, int &height)>;
+
+    struct ViewfinderStats {
+        uint64_t offered = 0;  // Frames offered by the camera
+        uint64_t drawn = 0;    // Frames put on screen
+        uint64_t skipped = 0;  // Replaced by a newer frame, or offered while the slot was busy
+    };
+
+    explicit DisplayService(DisplaySink &sink);
+    ~DisplayService();
+
+    void start();
+    // Blank the sink and stop the thread
+    void stop();
+    bool running() const { return thread_.joinable(); }
+
+    void show(Loader load, std::chrono::milliseconds duration);
+
+    void setViewfinder(bool enabled);
+    // Copy a viewfinder frame for drawing when the display is next free
+    void offerViewfinder(const YuvFrame &frame);
+    ViewfinderStats viewfinderStats() const;
+    // Meter reading drawn over the viewfinder from the next frame on
+    void setExposureMeter(float ev, bool clipping);
+    void hideExposureMeter();
+
+private:
+    void threadFunc();
+    void presentImage(const std::vector<unsigned char> &rgb, int width, int height);
+    void presentViewfinder();
+    void blank();
+    void setBacklight(bool on);
+
+    DisplaySink &sink_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    Loader pending_;
+    std::chrono::milliseconds pendingDuration_{0};
+    bool backlight_ = false;  // Only touched on the display thread
+
+    // Viewfinder slot: latest_ is filled by offers and swapped with drawing_
+    // for the display thread, both under mutex_
+    bool viewfinder_ = false;
+    bool fresh_ = false;  // latest_ holds a frame not drawn yet
+    std::vector<uint8_t> latest_;
+    std::vector<uint8_t> drawing_;
+    YuvFrame latestFrame_;
+    YuvFrame drawingFrame_;
+    std::atomic<uint64_t> offered_{0};
+    std::atomic<uint64_t> drawn_{0};
+    std::atomic<uint64_t> skipped_{0};
+    std::atomic<bool> meter_{false};
+    std::atomic<float> meterEv_{0.0f};
+    std::atomic<bool> meterClipping_{false};
+};
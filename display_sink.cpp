@@ -0,0 +1,85 @@
+#include "display_sink.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+// --- Memory sink ---
+MemorySink::MemorySink(int width, int height, std::chrono::microseconds transferTime)
+    : width_(width), height_(height), transferTime_(transferTime),
+      frame_(static_cast<size_t>(width) * height), shown_(frame_.size()) {}
+
+bool MemorySink::present() {
+    if (transferTime_.count() > 0) {
+        std::this_thread::sleep_for(transferTime_);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    shown_ = frame_;
+    presented_++;
+    return true;
+}
+
+void MemorySink::setBacklight(bool on) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    backlight_ = on;
+}
+
+std::string MemorySink::describe() const {
+    return "memory " + std::to_string(width_) + "x" + std::to_string(height_);
+}
+
+std::vector<uint16_t> MemorySink::shown() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return shown_;
+}
+
+uint64_t MemorySink::presented() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return presented_;
+}
+
+bool MemorySink::backlight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return backlight_;
+}
+
+// --- File sink ---
+FileSink::FileSink(std::string path, int width, int height)
+    : path_(std::move(path)), width_(width), height_(height),
+      frame_(static_cast<size_t>(width) * height), rgb_(frame_.size() * 3) {}
+
+std::string FileSink::describe() const {
+    return "file " + path_;
+}
+
+bool FileSink::present() {
+    // Expand RGB565 back to 8 bits per channel
+    for (size_t i = 0; i < frame_.size(); i++) {
+        uint16_t p = frame_[i];
+        uint8_t r = static_cast<uint8_t>(p >> 11);
+        uint8_t g = static_cast<uint8_t>((p >> 5) & 0x3f);
+        uint8_t b = static_cast<uint8_t>(p & 0x1f);
+        rgb_[i * 3] = static_cast<uint8_t>((r << 3) | (r >> 2));
+        rgb_[i * 3 + 1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+        rgb_[i * 3 + 2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+    }
+
+    std::string tempPath = path_ + ".tmp";
+    FILE *file = fopen(tempPath.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Failed to open " << tempPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width_, height_);
+    bool ok = fwrite(rgb_.data(), 1, rgb_.size(), file) == rgb_.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tempPath.c_str(), path_.c_str()) < 0) {
+        std::cerr << "Failed to write " << path_ << ": " << strerror(errno) << std::endl;
+        remove(tempPath.c_str());
+        return false;
+    }
+    presented_++;
+    return true;
+}
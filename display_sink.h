@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// --- Display sinks ---
+// Where the display service draws: the LCD HAT, or a stand-in for running
+// without one. A frame is rendered into the sink's own buffer and then
+// presented, so the LCD can take it without a copy.
+
+class DisplaySink {
+public:
+    virtual ~DisplaySink() = default;
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    // Pixels in frame() are stored high byte first
+    virtual bool swapBytes() const { return false; }
+
+    // width() x height() RGB565 pixels, row-major, to render the next frame into
+    virtual uint16_t *frame() = 0;
+    // Put frame() on screen. May take as long as the link to the panel does.
+    virtual bool present() = 0;
+    virtual void setBacklight(bool on) { (void)on; }
+
+    virtual std::string describe() const = 0;
+};
+
+// Keeps the last presented frame in memory. A transfer time makes present()
+// take as long as a real panel's link would.
+class MemorySink : public DisplaySink {
+public:
+    MemorySink(int width, int height, std::chrono::microseconds transferTime = std::chrono::microseconds(0));
+
+    int width() const override { return width_; }
+    int height() const override { return height_; }
+    uint16_t *frame() override { return frame_.data(); }
+    bool present() override;
+    void setBacklight(bool on) override;
+    std::string describe() const override;
+
+    std::vector<uint16_t> shown() const;
+    uint64_t presented() const;
+    bool backlight() const;
+
+private:
+    int width_;
+    int height_;
+    std::chrono::microseconds transferTime_;
+    std::vector<uint16_t> frame_;
+
+    mutable std::mutex mutex_;
+    std::vector<uint16_t> shown_;
+    uint64_t presented_ = 0;
+    bool backlight_ = false;
+};
+
+// Writes every presented frame to a binary PPM, replacing the file
+// atomically so a viewer never reads half a frame
+class FileSink : public DisplaySink {
+public:
+    FileSink(std::string path, int width, int height);
+
+    int width() const override { return width_; }
+    int height() const override { return height_; }
+    uint16_t *frame() override { return frame_.data(); }
+    bool present() override;
+    std::string describe() const override;
+
+    uint64_t presented() const { return presented_; }
+
+private:
+    std::string path_;
+    int width_;
+    int height_;
+    std::vector<uint16_t> frame_;
+    std::vector<uint8_t> rgb_;
+    uint64_t presented_ = 0;
+};
@@ -0,0 +1,206 @@
+#include "dng_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include "tiff_ifd.h"
+
+namespace {
+
+// IFD0 tags (TIFF, TIFF/EP and DNG)
+constexpr uint16_t TAG_NEW_SUBFILE_TYPE = 0x00FE;
+constexpr uint16_t TAG_IMAGE_WIDTH = 0x0100;
+constexpr uint16_t TAG_IMAGE_LENGTH = 0x0101;
+constexpr uint16_t TAG_BITS_PER_SAMPLE = 0x0102;
+constexpr uint16_t TAG_COMPRESSION = 0x0103;
+constexpr uint16_t TAG_PHOTOMETRIC = 0x0106;
+constexpr uint16_t TAG_MAKE = 0x010F;
+constexpr uint16_t TAG_MODEL = 0x0110;
+constexpr uint16_t TAG_STRIP_OFFSETS = 0x0111;
+constexpr uint16_t TAG_ORIENTATION = 0x0112;
+constexpr uint16_t TAG_SAMPLES_PER_PIXEL = 0x0115;
+constexpr uint16_t TAG_ROWS_PER_STRIP = 0x0116;
+constexpr uint16_t TAG_STRIP_BYTE_COUNTS = 0x0117;
+constexpr uint16_t TAG_PLANAR_CONFIGURATION = 0x011C;
+constexpr uint16_t TAG_SOFTWARE = 0x0131;
+constexpr uint16_t TAG_DATE_TIME = 0x0132;
+constexpr uint16_t TAG_CFA_REPEAT_PATTERN_DIM = 0x828D;
+constexpr uint16_t TAG_CFA_PATTERN = 0x828E;
+constexpr uint16_t TAG_EXPOSURE_TIME = 0x829A;
+constexpr uint16_t TAG_ISO_SPEED = 0x8827;
+constexpr uint16_t TAG_DATE_TIME_ORIGINAL = 0x9003;
+constexpr uint16_t TAG_DNG_VERSION = 0xC612;
+constexpr uint16_t TAG_DNG_BACKWARD_VERSION = 0xC613;
+constexpr uint16_t TAG_UNIQUE_CAMERA_MODEL = 0xC614;
+constexpr uint16_t TAG_BLACK_LEVEL_REPEAT_DIM = 0xC619;
+constexpr uint16_t TAG_BLACK_LEVEL = 0xC61A;
+constexpr uint16_t TAG_WHITE_LEVEL = 0xC61D;
+constexpr uint16_t TAG_COLOR_MATRIX_1 = 0xC621;
+constexpr uint16_t TAG_AS_SHOT_NEUTRAL = 0xC628;
+constexpr uint16_t TAG_CALIBRATION_ILLUMINANT_1 = 0xC65A;
+
+constexpr uint16_t PHOTOMETRIC_CFA = 32803;
+constexpr uint16_t ILLUMINANT_D65 = 21;
+constexpr int32_t MATRIX_DENOMINATOR = 10000;
+constexpr size_t TIFF_HEADER_SIZE = 8;
+
+using Matrix = std::array<double, 9>;
+
+Matrix multiply(const Matrix &a, const Matrix &b) {
+    Matrix m{};
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            for (int k = 0; k < 3; k++) {
+                m[r * 3 + c] += a[r * 3 + k] * b[k * 3 + c];
+            }
+        }
+    }
+    return m;
+}
+
+bool invert(const Matrix &a, Matrix &inverse) {
+    double det = a[0] * (a[4] * a[8] - a[5] * a[7]) - a[1] * (a[3] * a[8] - a[5] * a[6]) +
+                 a[2] * (a[3] * a[7] - a[4] * a[6]);
+    if (std::fabs(det) < 1e-9) {
+        return false;
+    }
+    inverse = {
+        (a[4] * a[8] - a[5] * a[7]) / det, (a[2] * a[7] - a[1] * a[8]) / det, (a[1] * a[5] - a[2] * a[4]) / det,
+        (a[5] * a[6] - a[3] * a[8]) / det, (a[0] * a[8] - a[2] * a[6]) / det, (a[2] * a[3] - a[0] * a[5]) / det,
+        (a[3] * a[7] - a[4] * a[6]) / det, (a[1] * a[6] - a[0] * a[7]) / det, (a[0] * a[4] - a[1] * a[3]) / det,
+    };
+    return true;
+}
+
+// CFA colour (0 = red, 1 = green, 2 = blue) and calibration channel (R, Gr,
+// Gb, B) at each position of the 2x2 pattern, row-major
+void cfaPattern(BayerOrder order, uint8_t colours[4], int channels[4]) {
+    static const uint8_t COLOURS[4][4] = {{0, 1, 1, 2}, {1, 0, 2, 1}, {1, 2, 0, 1}, {2, 1, 1, 0}};
+    static const int CHANNELS[4][4] = {{0, 1, 2, 3}, {1, 0, 3, 2}, {2, 3, 0, 1}, {3, 2, 1, 0}};
+    int index = static_cast<int>(order);
+    memcpy(colours, COLOURS[index], 4);
+    memcpy(channels, CHANNELS[index], sizeof(CHANNELS[index]));
+}
+
+}  // namespace
+
+size_t dngImageSize(const RawLayout &layout) {
+    return static_cast<size_t>(layout.width) * layout.height * 2;
+}
+
+std::vector<uint8_t> buildDngHeader(const RawFrame &raw, const DngInfo &info) {
+    const RawLayout &layout = raw.layout;
+    uint8_t colours[4];
+    int channels[4];
+    cfaPattern(layout.order, colours, channels);
+
+    TiffIfd ifd;
+    ifd.setLong(TAG_NEW_SUBFILE_TYPE, 0);  // Main image
+    ifd.setLong(TAG_IMAGE_WIDTH, static_cast<uint32_t>(layout.width));
+    ifd.setLong(TAG_IMAGE_LENGTH, static_cast<uint32_t>(layout.height));
+    ifd.setShort(TAG_BITS_PER_SAMPLE, 16);
+    ifd.setShort(TAG_COMPRESSION, 1);  // None
+    ifd.setShort(TAG_PHOTOMETRIC, PHOTOMETRIC_CFA);
+    ifd.setAscii(TAG_MAKE, "Raspberry Pi");
+    ifd.setAscii(TAG_MODEL, info.model);
+    ifd.setLong(TAG_STRIP_OFFSETS, 0);  // Patched once the layout is known
+    ifd.setShort(TAG_ORIENTATION, 1);
+    ifd.setShort(TAG_SAMPLES_PER_PIXEL, 1);
+    ifd.setLong(TAG_ROWS_PER_STRIP, static_cast<uint32_t>(layout.height));
+    ifd.setLong(TAG_STRIP_BYTE_COUNTS, static_cast<uint32_t>(dngImageSize(layout)));
+    ifd.setShort(TAG_PLANAR_CONFIGURATION, 1);
+    ifd.setAscii(TAG_SOFTWARE, "mpi");
+    ifd.setAscii(TAG_DATE_TIME, info.timestamp);
+    ifd.setShorts(TAG_CFA_REPEAT_PATTERN_DIM, {2, 2});
+    ifd.setBytes(TAG_CFA_PATTERN, TiffIfd::BYTE, {colours[0], colours[1], colours[2], colours[3]});
+    ifd.setRational(TAG_EXPOSURE_TIME, static_cast<uint32_t>(info.exposureTimeUs), 1000000);
+    ifd.setShort(TAG_ISO_SPEED, static_cast<uint16_t>(std::lround(info.analogueGain * 100)));
+    ifd.setAscii(TAG_DATE_TIME_ORIGINAL, info.timestamp);
+    ifd.setBytes(TAG_DNG_VERSION, TiffIfd::BYTE, {1, 4, 0, 0});
+    ifd.setBytes(TAG_DNG_BACKWARD_VERSION, TiffIfd::BYTE, {1, 1, 0, 0});
+    ifd.setAscii(TAG_UNIQUE_CAMERA_MODEL, "Raspberry Pi " + info.model);
+
+    // Levels in sample units; the source reports black at 16-bit scale
+    int shift = 16 - layout.bits;
+    std::vector<uint32_t> blackLevels;
+    for (int i = 0; i < 4; i++) {
+        blackLevels.push_back(static_cast<uint32_t>(std::max(0, raw.blackLevels[channels[i]] >> shift)));
+    }
+    ifd.setShorts(TAG_BLACK_LEVEL_REPEAT_DIM, {2, 2});
+    ifd.setLongs(TAG_BLACK_LEVEL, blackLevels);
+    ifd.setLong(TAG_WHITE_LEVEL, (1u << layout.bits) - 1);
+
+    // Camera RGB reaches sRGB through the white balance gains and then the
+    // colour matrix. DNG wants the inverse: XYZ to camera RGB.
+    double redGain = raw.colourGains[0] > 0 ? raw.colourGains[0] : 1.0;
+    double blueGain = raw.colourGains[1] > 0 ? raw.colourGains[1] : 1.0;
+    Matrix ccm = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+    bool hasMatrix = false;
+    for (int i = 0; i < 9; i++) {
+        hasMatrix = hasMatrix || raw.colourMatrix[i] != 0;
+    }
+    if (hasMatrix) {
+        for (int i = 0; i < 9; i++) {
+            ccm[i] = raw.colourMatrix[i];
+        }
+    }
+    const Matrix rgbToXyz = {0.4124564, 0.3575761, 0.1804375,
+                             0.2126729, 0.7151522, 0.0721750,
+                             0.0193339, 0.1191920, 0.9503041};
+    const Matrix gains = {redGain, 0, 0, 0, 1, 0, 0, 0, blueGain};
+    Matrix xyzToCamera;
+    if (invert(multiply(multiply(rgbToXyz, ccm), gains), xyzToCamera)) {
+        std::vector<std::pair<int32_t, int32_t>> matrix;
+        for (double v : xyzToCamera) {
+            matrix.emplace_back(static_cast<int32_t>(std::lround(v * MATRIX_DENOMINATOR)), MATRIX_DENOMINATOR);
+        }
+        ifd.setSRationals(TAG_COLOR_MATRIX_1, matrix);
+    }
+    ifd.setShort(TAG_CALIBRATION_ILLUMINANT_1, ILLUMINANT_D65);
+    ifd.setRationals(TAG_AS_SHOT_NEUTRAL, {
+        {static_cast<uint32_t>(std::lround(MATRIX_DENOMINATOR / redGain)), MATRIX_DENOMINATOR},
+        {MATRIX_DENOMINATOR, MATRIX_DENOMINATOR},
+        {static_cast<uint32_t>(std::lround(MATRIX_DENOMINATOR / blueGain)), MATRIX_DENOMINATOR},
+    });
+
+    // The image goes straight after the IFD
+    ifd.setLong(TAG_STRIP_OFFSETS, static_cast<uint32_t>(TIFF_HEADER_SIZE + ifd.size()));
+
+    std::vector<uint8_t> header;
+    header.reserve(TIFF_HEADER_SIZE + ifd.size());
+    writeTiffHeader(header, TIFF_HEADER_SIZE);
+    ifd.write(header, 0);
+    return header;
+}
+
+void unpackRawRows(const uint8_t *data, const RawLayout &layout, int rowBegin, int rowEnd, uint8_t *out) {
+    int width = layout.width;
+    for (int y = rowBegin; y < rowEnd; y++) {
+        const uint8_t *src = data + static_cast<size_t>(y) * layout.stride;
+        uint8_t *dst = out + static_cast<size_t>(y - rowBegin) * width * 2;
+
+        if (layout.packing == RawPacking::None) {
+            memcpy(dst, src, static_cast<size_t>(width) * 2);
+        } else if (layout.bits == 10) {
+            // Four samples' high 8 bits, then a byte of their low 2 bits
+            for (int x = 0; x + 4 <= width; x += 4, src += 5) {
+                for (int i = 0; i < 4; i++) {
+                    uint16_t sample = static_cast<uint16_t>((src[i] << 2) | ((src[4] >> (2 * i)) & 3));
+                    dst[(x + i) * 2] = static_cast<uint8_t>(sample);
+                    dst[(x + i) * 2 + 1] = static_cast<uint8_t>(sample >> 8);
+                }
+            }
+        } else {
+            // Two samples' high 8 bits, then a byte of their low 4 bits
+            for (int x = 0; x + 2 <= width; x += 2, src += 3) {
+                for (int i = 0; i < 2; i++) {
+                    uint16_t sample = static_cast<uint16_t>((src[i] << 4) | ((src[2] >> (4 * i)) & 15));
+                    dst[(x + i) * 2] = static_cast<uint8_t>(sample);
+                    dst[(x + i) * 2 + 1] = static_cast<uint8_t>(sample >> 8);
+                }
+            }
+        }
+    }
+}
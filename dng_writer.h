@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "raw_frame.h"
+
+// --- DNG serialization ---
+// Uncompressed 16-bit DNGs of raw Bayer frames, written as a small header
+// built in memory followed by the image, which is unpacked a band of rows at
+// a time while it is written. A DNG is never held in memory whole.
+struct DngInfo {
+    int32_t exposureTimeUs = 0;
+    float analogueGain = 1.0f;
+    std::string timestamp;  // "YYYY:MM:DD HH:MM:SS"
+    std::string model = "MPI Camera";
+};
+
+// TIFF header and IFD. The image follows straight after, dngImageSize() bytes.
+std::vector<uint8_t> buildDngHeader(const RawFrame &raw, const DngInfo &info);
+size_t dngImageSize(const RawLayout &layout);
+
+// Unpack rows [rowBegin, rowEnd) to little-endian 16-bit samples at `out`
+void unpackRawRows(const uint8_t *data, const RawLayout &layout, int rowBegin, int rowEnd, uint8_t *out);
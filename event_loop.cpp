@@ -0,0 +1,189 @@
+#include "event_loop.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr int MAX_EVENTS = 16;
+
+// Reset a counting descriptor (eventfd, timerfd) so it is not readable again
+void drain(int fd) {
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+}
+
+void closeWatched(EventLoop *loop, int &fd) {
+    if (fd < 0) {
+        return;
+    }
+    if (loop) {
+        loop->unwatch(fd);
+    }
+    close(fd);
+    fd = -1;
+}
+
+}  // namespace
+
+// --- Event loop ---
+EventLoop::~EventLoop() {
+    if (wakeFd_ >= 0) {
+        close(wakeFd_);
+    }
+    if (epollFd_ >= 0) {
+        close(epollFd_);
+    }
+}
+
+bool EventLoop::open() {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd_ < 0 || wakeFd_ < 0) {
+        std::cerr << "Failed to create event loop: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return watch(wakeFd_, [this] { drain(wakeFd_); });
+}
+
+bool EventLoop::watch(int fd, Handler handler) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+        std::cerr << "Failed to watch descriptor " << fd << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    handlers_[fd] = std::move(handler);
+    return true;
+}
+
+void EventLoop::unwatch(int fd) {
+    if (handlers_.erase(fd)) {
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+void EventLoop::run() {
+    epoll_event events[MAX_EVENTS];
+    while (!stopping_) {
+        int count = epoll_wait(epollFd_, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Event loop failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        for (int i = 0; i < count && !stopping_; i++) {
+            // A handler may unwatch descriptors, its own included
+            auto found = handlers_.find(events[i].data.fd);
+            if (found != handlers_.end()) {
+                Handler handler = found->second;
+                handler();
+            }
+        }
+    }
+}
+
+void EventLoop::stop() {
+    stopping_ = true;
+    uint64_t one = 1;
+    if (write(wakeFd_, &one, sizeof(one)) < 0) {
+        // Already pending; run() wakes up either way
+    }
+}
+
+// --- Notifier ---
+EventNotifier::~EventNotifier() {
+    closeWatched(loop_, fd_);
+}
+
+bool EventNotifier::open(EventLoop &loop, EventLoop::Handler handler) {
+    fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd_ < 0) {
+        std::cerr << "Failed to create eventfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+    loop_ = &loop;
+    return loop.watch(fd_, [this, handler = std::move(handler)] {
+        drain(fd_);
+        handler();
+    });
+}
+
+void EventNotifier::notify() {
+    uint64_t one = 1;
+    if (fd_ >= 0 && write(fd_, &one, sizeof(one)) < 0) {
+        // The counter is already pending
+    }
+}
+
+// --- Timer ---
+EventTimer::~EventTimer() {
+    closeWatched(loop_, fd_);
+}
+
+bool EventTimer::open(EventLoop &loop, EventLoop::Handler handler) {
+    // CLOCK_MONOTONIC, which steady_clock reads
+    fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd_ < 0) {
+        std::cerr << "Failed to create timerfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+    loop_ = &loop;
+    return loop.watch(fd_, [this, handler = std::move(handler)] {
+        drain(fd_);
+        handler();
+    });
+}
+
+void EventTimer::arm(std::chrono::steady_clock::duration delay) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count();
+    itimerspec spec{};
+    // An all-zero value would disarm instead
+    ns = ns > 0 ? ns : 1;
+    spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+    spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+    timerfd_settime(fd_, 0, &spec, nullptr);
+}
+
+void EventTimer::cancel() {
+    itimerspec spec{};
+    timerfd_settime(fd_, 0, &spec, nullptr);
+}
+
+// --- Signals ---
+EventSignals::~EventSignals() {
+    closeWatched(loop_, fd_);
+}
+
+bool EventSignals::open(EventLoop &loop, std::initializer_list<int> signals, Handler handler) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int signal : signals) {
+        sigaddset(&mask, signal);
+    }
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    fd_ = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (fd_ < 0) {
+        std::cerr << "Failed to create signalfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+    loop_ = &loop;
+    return loop.watch(fd_, [this, handler = std::move(handler)] {
+        signalfd_siginfo info;
+        while (read(fd_, &info, sizeof(info)) == static_cast<ssize_t>(sizeof(info))) {
+            handler(static_cast<int>(info.ssi_signo));
+        }
+    });
+}
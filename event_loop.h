@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <map>
+
+// --- Event loop ---
+// One thread waiting in epoll on every descriptor it watches: GPIO line
+// events, timers, signals and wakeups from other threads. Nothing else wakes
+// it, so an idle camera costs no CPU time, and an event is handled as soon as
+// it arrives. Handlers run on the loop's thread one at a time, so state they
+// share needs no locks, but a handler that blocks holds up all the others.
+class EventLoop {
+public:
+    using Handler = std::function<void()>;
+
+    EventLoop() = default;
+    ~EventLoop();
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    bool open();
+    // Call the handler whenever the descriptor is readable, until unwatched.
+    // The handler must read what is pending, or it is called again.
+    bool watch(int fd, Handler handler);
+    void unwatch(int fd);
+
+    // Dispatch events until stop()
+    void run();
+    // Make run() return; safe from any thread
+    void stop();
+
+private:
+    int epollFd_ = -1;
+    int wakeFd_ = -1;  // Written by stop()
+    std::atomic<bool> stopping_{false};
+    std::map<int, Handler> handlers_;
+};
+
+// An eventfd watched by a loop. notify() may be called from any thread; any
+// number of notifications before the loop gets to them run the handler once.
+class EventNotifier {
+public:
+    EventNotifier() = default;
+    ~EventNotifier();
+    EventNotifier(const EventNotifier &) = delete;
+    EventNotifier &operator=(const EventNotifier &) = delete;
+
+    bool open(EventLoop &loop, EventLoop::Handler handler);
+    void notify();
+
+private:
+    EventLoop *loop_ = nullptr;
+    int fd_ = -1;
+};
+
+// A one-shot timerfd watched by a loop, armed again as needed
+class EventTimer {
+public:
+    EventTimer() = default;
+    ~EventTimer();
+    EventTimer(const EventTimer &) = delete;
+    EventTimer &operator=(const EventTimer &) = delete;
+
+    bool open(EventLoop &loop, EventLoop::Handler handler);
+    // Run the handler once after the delay, replacing any earlier arm()
+    void arm(std::chrono::steady_clock::duration delay);
+    void cancel();
+
+private:
+    EventLoop *loop_ = nullptr;
+    int fd_ = -1;
+};
+
+// Signals delivered to a loop through a signalfd instead of a handler. The
+// signals are blocked in the calling thread, so open() must come before any
+// other thread is started, which then inherits the mask.
+class EventSignals {
+public:
+    using Handler = std::function<void(int signal)>;
+
+    EventSignals() = default;
+    ~EventSignals();
+    EventSignals(const EventSignals &) = delete;
+    EventSignals &operator=(const EventSignals &) = delete;
+
+    bool open(EventLoop &loop, std::initializer_list<int> signals, Handler handler);
+
+private:
+    EventLoop *loop_ = nullptr;
+    int fd_ = -1;
+};
@@ -0,0 +1,191 @@
+#include "exif_writer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "tiff_ifd.h"
+
+namespace {
+
+// IFD0 tags
+constexpr uint16_t TAG_MAKE = 0x010F;
+constexpr uint16_t TAG_MODEL = 0x0110;
+constexpr uint16_t TAG_X_RESOLUTION = 0x011A;
+constexpr uint16_t TAG_Y_RESOLUTION = 0x011B;
+constexpr uint16_t TAG_RESOLUTION_UNIT = 0x0128;
+constexpr uint16_t TAG_DATE_TIME = 0x0132;
+constexpr uint16_t TAG_YCBCR_POSITIONING = 0x0213;
+constexpr uint16_t TAG_EXIF_IFD = 0x8769;
+
+// IFD1 (thumbnail) tags
+constexpr uint16_t TAG_COMPRESSION = 0x0103;
+constexpr uint16_t TAG_JPEG_OFFSET = 0x0201;
+constexpr uint16_t TAG_JPEG_LENGTH = 0x0202;
+
+// Exif IFD tags
+constexpr uint16_t TAG_EXPOSURE_TIME = 0x829A;
+constexpr uint16_t TAG_ISO_SPEED = 0x8827;
+constexpr uint16_t TAG_EXIF_VERSION = 0x9000;
+constexpr uint16_t TAG_DATE_TIME_ORIGINAL = 0x9003;
+constexpr uint16_t TAG_DATE_TIME_DIGITIZED = 0x9004;
+constexpr uint16_t TAG_COMPONENTS_CONFIGURATION = 0x9101;
+constexpr uint16_t TAG_FLASHPIX_VERSION = 0xA000;
+constexpr uint16_t TAG_COLOR_SPACE = 0xA001;
+constexpr uint16_t TAG_PIXEL_X_DIMENSION = 0xA002;
+constexpr uint16_t TAG_PIXEL_Y_DIMENSION = 0xA003;
+
+constexpr size_t TIFF_HEADER_SIZE = 8;
+constexpr size_t MAX_SEGMENT_LENGTH = 65535;
+const char EXIF_IDENTIFIER[6] = {'E', 'x', 'i', 'f', 0, 0};
+
+uint16_t readU16(const uint8_t *p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t readU32(const uint8_t *p) {
+    return static_cast<uint32_t>(p[0] | (p[1] << 8) | (p[2] << 16)) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+std::vector<uint8_t> buildSegment(const ExifInfo &info, bool withThumbnail) {
+    TiffIfd ifd0;
+    ifd0.setAscii(TAG_MAKE, "Raspberry Pi");
+    ifd0.setAscii(TAG_MODEL, "MPI Camera");
+    ifd0.setRational(TAG_X_RESOLUTION, 72, 1);
+    ifd0.setRational(TAG_Y_RESOLUTION, 72, 1);
+    ifd0.setShort(TAG_RESOLUTION_UNIT, 2);  // Inches
+    ifd0.setAscii(TAG_DATE_TIME, info.timestamp);
+    ifd0.setShort(TAG_YCBCR_POSITIONING, 1);  // Centered
+    ifd0.setLong(TAG_EXIF_IFD, 0);            // Patched once the layout is known
+
+    TiffIfd exif;
+    exif.setRational(TAG_EXPOSURE_TIME, static_cast<uint32_t>(info.exposureTimeUs), 1000000);
+    exif.setShort(TAG_ISO_SPEED, static_cast<uint16_t>(std::lround(info.analogueGain * 100)));
+    exif.setBytes(TAG_EXIF_VERSION, TiffIfd::UNDEFINED, {'0', '2', '3', '0'});
+    exif.setAscii(TAG_DATE_TIME_ORIGINAL, info.timestamp);
+    exif.setAscii(TAG_DATE_TIME_DIGITIZED, info.timestamp);
+    exif.setBytes(TAG_COMPONENTS_CONFIGURATION, TiffIfd::UNDEFINED, {1, 2, 3, 0});  // Y Cb Cr
+    exif.setBytes(TAG_FLASHPIX_VERSION, TiffIfd::UNDEFINED, {'0', '1', '0', '0'});
+    exif.setShort(TAG_COLOR_SPACE, 1);  // sRGB
+    exif.setLong(TAG_PIXEL_X_DIMENSION, static_cast<uint32_t>(info.width));
+    exif.setLong(TAG_PIXEL_Y_DIMENSION, static_cast<uint32_t>(info.height));
+
+    uint32_t ifd0Offset = TIFF_HEADER_SIZE;
+    uint32_t exifOffset = static_cast<uint32_t>(ifd0Offset + ifd0.size());
+    ifd0.setLong(TAG_EXIF_IFD, exifOffset);
+
+    // IFD1 describes the thumbnail, whose bytes follow it
+    TiffIfd ifd1;
+    uint32_t ifd1Offset = static_cast<uint32_t>(exifOffset + exif.size());
+    if (withThumbnail) {
+        ifd1.setShort(TAG_COMPRESSION, 6);  // JPEG
+        ifd1.setRational(TAG_X_RESOLUTION, 72, 1);
+        ifd1.setRational(TAG_Y_RESOLUTION, 72, 1);
+        ifd1.setShort(TAG_RESOLUTION_UNIT, 2);
+        ifd1.setLong(TAG_JPEG_OFFSET, 0);
+        ifd1.setLong(TAG_JPEG_LENGTH, static_cast<uint32_t>(info.thumbnail.size()));
+        ifd1.setLong(TAG_JPEG_OFFSET, static_cast<uint32_t>(ifd1Offset + ifd1.size()));
+    }
+
+    std::vector<uint8_t> tiff;
+    writeTiffHeader(tiff, ifd0Offset);
+    ifd0.write(tiff, withThumbnail ? ifd1Offset : 0);
+    exif.write(tiff, 0);
+    if (withThumbnail) {
+        ifd1.write(tiff, 0);
+        tiff.insert(tiff.end(), info.thumbnail.begin(), info.thumbnail.end());
+    }
+
+    size_t length = 2 + sizeof(EXIF_IDENTIFIER) + tiff.size();
+    if (length > MAX_SEGMENT_LENGTH) {
+        return {};
+    }
+
+    std::vector<uint8_t> segment = {
+        0xFF, 0xE1,
+        static_cast<uint8_t>(length >> 8),
+        static_cast<uint8_t>(length & 0xFF),
+    };
+    segment.insert(segment.end(), EXIF_IDENTIFIER, EXIF_IDENTIFIER + sizeof(EXIF_IDENTIFIER));
+    segment.insert(segment.end(), tiff.begin(), tiff.end());
+    return segment;
+}
+
+}  // namespace
+
+std::vector<uint8_t> buildExifApp1(const ExifInfo &info) {
+    if (!info.thumbnail.empty()) {
+        std::vector<uint8_t> segment = buildSegment(info, true);
+        if (!segment.empty()) {
+            return segment;
+        }
+    }
+    return buildSegment(info, false);
+}
+
+size_t exifInsertOffset(const uint8_t *jpeg, size_t size) {
+    size_t pos = 2;  // After SOI
+    if (size >= pos + 4 && jpeg[pos] == 0xFF && jpeg[pos + 1] == 0xE0) {
+        size_t length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+        if (pos + 2 + length <= size) {
+            pos += 2 + length;
+        }
+    }
+    return pos;
+}
+
+bool findExifThumbnail(const uint8_t *jpeg, size_t size, size_t &offset, size_t &length) {
+    // Walk the segments before the image data looking for the Exif APP1
+    size_t pos = 2;
+    while (pos + 4 <= size && jpeg[pos] == 0xFF) {
+        uint8_t marker = jpeg[pos + 1];
+        size_t segmentLength = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+        if (marker == 0xDA || segmentLength < 2) {
+            return false;  // Start of scan: no EXIF block
+        }
+        size_t body = pos + 4;
+        size_t end = pos + 2 + segmentLength;
+        if (marker == 0xE1 && end <= size && segmentLength >= 2 + sizeof(EXIF_IDENTIFIER) + TIFF_HEADER_SIZE &&
+            std::equal(EXIF_IDENTIFIER, EXIF_IDENTIFIER + sizeof(EXIF_IDENTIFIER), jpeg + body)) {
+            const uint8_t *tiff = jpeg + body + sizeof(EXIF_IDENTIFIER);
+            size_t tiffSize = end - (body + sizeof(EXIF_IDENTIFIER));
+            if (tiff[0] != 'I' || tiff[1] != 'I') {
+                return false;  // Only our own little-endian blocks
+            }
+
+            // IFD0, then its next-IFD link to IFD1
+            uint32_t ifd0 = readU32(tiff + 4);
+            if (ifd0 + 2 > tiffSize) {
+                return false;
+            }
+            uint16_t count = readU16(tiff + ifd0);
+            size_t link = ifd0 + 2 + static_cast<size_t>(count) * 12;
+            if (link + 4 > tiffSize) {
+                return false;
+            }
+            uint32_t ifd1 = readU32(tiff + link);
+            if (ifd1 == 0 || ifd1 + 2 > tiffSize) {
+                return false;
+            }
+
+            uint32_t thumbOffset = 0;
+            uint32_t thumbLength = 0;
+            count = readU16(tiff + ifd1);
+            for (uint16_t i = 0; i < count && ifd1 + 2 + (i + 1) * 12u <= tiffSize; i++) {
+                const uint8_t *entry = tiff + ifd1 + 2 + i * 12;
+                if (readU16(entry) == TAG_JPEG_OFFSET) {
+                    thumbOffset = readU32(entry + 8);
+                } else if (readU16(entry) == TAG_JPEG_LENGTH) {
+                    thumbLength = readU32(entry + 8);
+                }
+            }
+            if (thumbLength == 0 || static_cast<size_t>(thumbOffset) + thumbLength > tiffSize) {
+                return false;
+            }
+            offset = static_cast<size_t>(tiff - jpeg) + thumbOffset;
+            length = thumbLength;
+            return true;
+        }
+        pos = end;
+    }
+    return false;
+}
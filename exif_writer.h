@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// --- EXIF APP1 serialization ---
+// The EXIF block is built in memory and spliced into the encoded JPEG before
+// it is written, so a capture is written to storage exactly once.
+struct ExifInfo {
+    int width = 0;
+    int height = 0;
+    int32_t exposureTimeUs = 0;
+    float analogueGain = 1.0f;
+    std::string timestamp;  // "YYYY:MM:DD HH:MM:SS"
+    std::vector<uint8_t> thumbnail;  // Optional small JPEG, stored in IFD1
+};
+
+// Complete APP1 segment, marker and length included. The thumbnail is left
+// out if it would push the block past the 64 KB segment limit; empty if the
+// block is too big even without it.
+std::vector<uint8_t> buildExifApp1(const ExifInfo &info);
+
+// Offset at which APP1 goes into an encoded JPEG: after SOI and a leading
+// JFIF APP0 segment, where EXIF readers expect it
+size_t exifInsertOffset(const uint8_t *jpeg, size_t size);
+
+// Locate the IFD1 thumbnail of a JPEG's EXIF block, for review without
+// decoding the full image. `jpeg` only needs to cover the APP1 segment.
+bool findExifThumbnail(const uint8_t *jpeg, size_t size, size_t &offset, size_t &length);
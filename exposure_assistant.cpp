@@ -0,0 +1,81 @@
+#include "exposure_assistant.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr double GAMMA = 2.2;           // Luma codes are roughly gamma encoded
+constexpr double MID_GREY = 0.18;       // Linear level the mean is aimed at
+constexpr float CLIP_LIMIT = 0.02f;     // Clipped share that starts to pull back
+constexpr double MAX_EV = 8;
+constexpr double SMOOTHING = 0.25;      // Weight of each new frame
+constexpr double TIE_STOPS = 1.0 / 6;   // Presets this close count as equal
+constexpr double HYSTERESIS_STOPS = 1.0 / 3;
+
+}  // namespace
+
+ExposureAssistant::ExposureAssistant(std::vector<int32_t> exposuresUs, std::vector<float> gains)
+    : exposuresUs_(std::move(exposuresUs)), gains_(std::move(gains)) {
+    std::sort(exposuresUs_.begin(), exposuresUs_.end());
+    std::sort(gains_.begin(), gains_.end());
+}
+
+ExposureSuggestion ExposureAssistant::update(const LumaStats &stats, int32_t exposureTimeUs, float analogueGain) {
+    ExposureSuggestion suggestion;
+    if (stats.samples == 0 || exposureTimeUs <= 0 || analogueGain <= 0 || exposuresUs_.empty() || gains_.empty()) {
+        return suggestion;
+    }
+
+    // Stops to bring the mean to mid grey
+    double level = std::pow(std::max(stats.mean, 0.5f) / 255.0, GAMMA);
+    double ev = std::log2(MID_GREY / level);
+
+    // Never past the point where the brightest 1% reach the clip level, and
+    // back off a stop for every doubling of the clipped share over the limit
+    double bright = std::max(lumaPercentile(stats, 0.99f), 1.0f);
+    ev = std::min(ev, GAMMA * std::log2(LumaStats::CLIP_LEVEL / bright));
+    suggestion.clipping = stats.clipped > CLIP_LIMIT;
+    if (suggestion.clipping) {
+        ev = std::min(ev, -std::log2(stats.clipped / CLIP_LIMIT) - HYSTERESIS_STOPS);
+    }
+    ev = std::clamp(ev, -MAX_EV, MAX_EV);
+
+    // Smooth the exposure aimed for, not the correction, which changes as
+    // soon as new settings reach the sensor
+    double current = std::log2(static_cast<double>(exposureTimeUs) * analogueGain);
+    double target = current + ev;
+    target_ = primed_ ? target_ + SMOOTHING * (target - target_) : target;
+    primed_ = true;
+
+    // Nearest preset; among near ties the lowest gain, then the shortest exposure
+    auto distance = [&](int pair) {
+        int e = pair / static_cast<int>(gains_.size());
+        int g = pair % static_cast<int>(gains_.size());
+        return std::fabs(std::log2(static_cast<double>(exposuresUs_[e]) * gains_[g]) - target_);
+    };
+    int pairs = static_cast<int>(exposuresUs_.size() * gains_.size());
+    double best = MAX_EV * 4;
+    for (int pair = 0; pair < pairs; pair++) {
+        best = std::min(best, distance(pair));
+    }
+    int chosen = -1;
+    for (size_t g = 0; g < gains_.size() && chosen < 0; g++) {
+        for (size_t e = 0; e < exposuresUs_.size(); e++) {
+            int pair = static_cast<int>(e * gains_.size() + g);
+            if (distance(pair) <= best + TIE_STOPS) {
+                chosen = pair;
+                break;
+            }
+        }
+    }
+    if (current_ < 0 || distance(current_) > best + HYSTERESIS_STOPS) {
+        current_ = chosen;
+    }
+
+    suggestion.valid = true;
+    suggestion.ev = static_cast<float>(target_ - current);
+    suggestion.exposureTimeUs = exposuresUs_[current_ / gains_.size()];
+    suggestion.analogueGain = gains_[current_ % gains_.size()];
+    return suggestion;
+}
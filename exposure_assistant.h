@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "luma_stats.h"
+
+// --- Exposure assistant ---
+// Suggests a shutter/gain pair from the luma statistics of streamed frames,
+// while exposure stays manual. Aims the mean at mid grey, pulls back when
+// highlights clip, and picks the nearest of the camera's presets, preferring
+// low gain, then short exposure. Suggestions are smoothed over frames and
+// only move to another preset when it is clearly better, so they do not
+// flicker between neighbours.
+struct ExposureSuggestion {
+    bool valid = false;
+    float ev = 0;                // Stops to add to the current exposure (+ is brighter)
+    bool clipping = false;       // Highlights clip at the current settings
+    int32_t exposureTimeUs = 0;  // Nearest preset to the target
+    float analogueGain = 0;
+};
+
+class ExposureAssistant {
+public:
+    ExposureAssistant(std::vector<int32_t> exposuresUs, std::vector<float> gains);
+
+    // Stats of a frame and the exposure and gain it was taken with
+    ExposureSuggestion update(const LumaStats &stats, int32_t exposureTimeUs, float analogueGain);
+
+private:
+    std::vector<int32_t> exposuresUs_;
+    std::vector<float> gains_;
+    bool primed_ = false;
+    double target_ = 0;  // Smoothed log2(exposure us x gain) to aim for
+    int current_ = -1;   // Preset pair suggested last, exposure index * gains + gain index
+};
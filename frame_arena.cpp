@@ -0,0 +1,151 @@
+#include "frame_arena.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+FrameArena::~FrameArena() {
+    free();
+}
+
+bool FrameArena::allocate(size_t slotSize, size_t slotCount) {
+    if (base_ && fd_ < 0 && slotSize == slotSize_ && slotCount == slots_.size()) {
+        return true;
+    }
+    free();
+    return map(slotSize, slotCount, -1);
+}
+
+bool FrameArena::allocateFile(const std::string &directory, size_t slotSize, size_t slotCount) {
+    free();
+    std::string path = directory + "/.spill-XXXXXX";
+    int fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "Failed to create spill file in " << directory << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    unlink(path.c_str());
+    if (!map(slotSize, slotCount, fd)) {
+        close(fd);
+        return false;
+    }
+    return true;
+}
+
+bool FrameArena::map(size_t slotSize, size_t slotCount, int fd) {
+    // Page-align slots so each one starts on its own page
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t alignedSize = (slotSize + pageSize - 1) / pageSize * pageSize;
+    size_t total = alignedSize * slotCount;
+
+    // The file is sparse until slots are written
+    if (fd >= 0 && ftruncate(fd, static_cast<off_t>(total)) < 0) {
+        std::cerr << "Failed to size spill file: " << strerror(errno) << std::endl;
+        return false;
+    }
+    void *addr = mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                      fd >= 0 ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS, fd, 0);
+    if (addr == MAP_FAILED) {
+        std::cerr << "Arena allocation of " << total / (1024 * 1024)
+                  << " MB failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Huge pages first, so locking faults them in as huge pages
+    bool locked = false;
+    if (fd < 0 && hugePages_) {
+        madvise(addr, total, MADV_HUGEPAGE);
+    }
+    if (fd < 0 && lockRequested_) {
+        locked = mlock(addr, total) == 0;
+        if (!locked) {
+            std::cerr << "Could not lock " << total / (1024 * 1024) << " MB arena in memory: "
+                      << strerror(errno) << std::endl;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    fd_ = fd;
+    locked_ = locked;
+    base_ = static_cast<uint8_t *>(addr);
+    mappedSize_ = total;
+    slotSize_ = slotSize;
+    alignedSize_ = alignedSize;
+    for (size_t i = 0; i < slotCount; i++) {
+        slots_.push_back(base_ + i * alignedSize);
+    }
+    freeSlots_ = slots_;
+    return true;
+}
+
+void FrameArena::free() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (base_) {
+        munmap(base_, mappedSize_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    fd_ = -1;
+    locked_ = false;
+    base_ = nullptr;
+    mappedSize_ = 0;
+    slotSize_ = 0;
+    slots_.clear();
+    freeSlots_.clear();
+}
+
+void FrameArena::setMemoryPolicy(bool locked, bool hugePages) {
+    lockRequested_ = locked;
+    hugePages_ = hugePages;
+}
+
+uint8_t *FrameArena::acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (slots_.empty()) {
+        return nullptr;
+    }
+    cv_.wait(lock, [this] { return !freeSlots_.empty(); });
+    uint8_t *slot = freeSlots_.back();
+    freeSlots_.pop_back();
+    return slot;
+}
+
+uint8_t *FrameArena::tryAcquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (freeSlots_.empty()) {
+        return nullptr;
+    }
+    uint8_t *slot = freeSlots_.back();
+    freeSlots_.pop_back();
+    return slot;
+}
+
+void FrameArena::recycle(uint8_t *slot) {
+    if (!slot) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (std::find(slots_.begin(), slots_.end(), slot) == slots_.end()) {
+            return;  // Slot from a previous allocation
+        }
+        if (fd_ >= 0) {
+            // Drop the slot's blocks and cached pages; it reads back as zeros
+            fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, slot - base_,
+                      static_cast<off_t>(alignedSize_));
+        }
+        freeSlots_.push_back(slot);
+    }
+    cv_.notify_one();
+}
+
+void FrameArena::writeBack(uint8_t *slot) {
+    if (fd_ >= 0 && slot) {
+        sync_file_range(fd_, slot - base_, static_cast<off_t>(alignedSize_), SYNC_FILE_RANGE_WRITE);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// --- Frame arena ---
+// A fixed set of equally sized buffers allocated once up front and reused for
+// the whole run. Pages are faulted in on first use and then stay resident, so
+// steady-state captures never allocate or touch fresh memory, while unused
+// worst-case headroom costs no RAM. acquire() blocks while every slot is in
+// use; tryAcquire() returns null instead.
+//
+// A file-backed arena maps an unlinked file instead, for frames that should
+// not count against RAM: written slots are flushed to storage in the
+// background and can then be evicted, and recycled slots give their blocks
+// back to the filesystem.
+//
+// An anonymous arena can instead be locked into RAM up front, so slots never
+// fault or swap, and backed by transparent huge pages, for fewer TLB misses
+// while whole frames are read and written.
+class FrameArena {
+public:
+    FrameArena() = default;
+    ~FrameArena();
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    // (Re)allocate the arena. A no-op if it already has this shape.
+    bool allocate(size_t slotSize, size_t slotCount);
+    // (Re)allocate backed by a file in `directory`, which is removed again
+    // straight away and so never outlives the arena
+    bool allocateFile(const std::string &directory, size_t slotSize, size_t slotCount);
+    void free();
+    // Lock anonymous arenas in RAM, and ask for huge pages, from the next
+    // allocation on. Without the privilege to lock (CAP_IPC_LOCK or
+    // RLIMIT_MEMLOCK) the arena is left unlocked.
+    void setMemoryPolicy(bool locked, bool hugePages);
+    // Whether the current allocation is locked in RAM
+    bool locked() const { return locked_; }
+
+    uint8_t *acquire();
+    uint8_t *tryAcquire();
+    void recycle(uint8_t *slot);
+    // Start writing a filled slot of a file-backed arena to storage
+    void writeBack(uint8_t *slot);
+
+    size_t slotSize() const { return slotSize_; }
+    size_t slotCount() const { return slots_.size(); }
+
+private:
+    bool map(size_t slotSize, size_t slotCount, int fd);
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int fd_ = -1;  // Backing file, or -1 for anonymous memory
+    uint8_t *base_ = nullptr;
+    size_t mappedSize_ = 0;
+    size_t slotSize_ = 0;
+    size_t alignedSize_ = 0;
+    bool lockRequested_ = false;
+    bool hugePages_ = false;
+    bool locked_ = false;
+    std::vector<uint8_t *> slots_;
+    std::vector<uint8_t *> freeSlots_;
+};
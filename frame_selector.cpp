@@ -0,0 +1,114 @@
+#include "frame_selector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace std::chrono;
+
+namespace {
+
+// Frames after the press to wait for the settings to show up in metadata
+constexpr int SETTLE_FRAMES = 6;
+// Exposure and gain the sensor reports are quantized (to line times and gain
+// codes), so they only have to be close to what was asked for
+constexpr double SETTINGS_TOLERANCE = 0.05;
+constexpr int32_t EXPOSURE_SLACK_US = 100;
+
+steady_clock::time_point exposureStart(const SourceFrame &frame) {
+    if (frame.exposureStart != steady_clock::time_point()) {
+        return frame.exposureStart;
+    }
+    return frame.arrival - microseconds(frame.exposureTimeUs);
+}
+
+steady_clock::time_point exposureEnd(const SourceFrame &frame) {
+    return exposureStart(frame) + microseconds(frame.exposureTimeUs);
+}
+
+// How far the press lies outside the frame's exposure window (0 inside it)
+steady_clock::duration distance(const SourceFrame &frame, steady_clock::time_point at) {
+    if (at < exposureStart(frame)) {
+        return exposureStart(frame) - at;
+    }
+    if (at > exposureEnd(frame)) {
+        return at - exposureEnd(frame);
+    }
+    return steady_clock::duration::zero();
+}
+
+}  // namespace
+
+FrameSelector::FrameSelector(size_t depth) : depth_(depth) {}
+
+void FrameSelector::push(const SourceFrame &frame) {
+    if (depth_ == 0) {
+        return;
+    }
+    ring_.push_back(frame);
+    while (ring_.size() > depth_) {
+        ring_.pop_front();
+    }
+}
+
+void FrameSelector::clear() {
+    ring_.clear();
+}
+
+bool FrameSelector::matches(const SourceFrame &frame, const Press &press) const {
+    if (frame.exposureTimeUs > 0 && press.exposureTimeUs > 0) {
+        int32_t slack = std::max(EXPOSURE_SLACK_US, static_cast<int32_t>(press.exposureTimeUs * SETTINGS_TOLERANCE));
+        if (std::abs(frame.exposureTimeUs - press.exposureTimeUs) > slack) {
+            return false;
+        }
+    }
+    if (frame.analogueGain > 0 && press.analogueGain > 0 &&
+        std::fabs(frame.analogueGain - press.analogueGain) > press.analogueGain * SETTINGS_TOLERANCE) {
+        return false;
+    }
+    return true;
+}
+
+std::vector<SourceFrame> FrameSelector::select(const Press &press, const SourceFrame &current) {
+    if (press.at != press_) {
+        press_ = press.at;
+        framesSincePress_ = 0;
+    }
+    bool afterPress = exposureStart(current) >= press.at;
+    if (afterPress) {
+        framesSincePress_++;
+    }
+    bool givingUp = framesSincePress_ > SETTLE_FRAMES;
+
+    if (depth_ == 0) {
+        if (afterPress && (matches(current, press) || givingUp)) {
+            if (givingUp) {
+                std::cerr << "Settings not confirmed by the sensor, capturing anyway" << std::endl;
+            }
+            return {current};
+        }
+        return {};
+    }
+
+    // A frame still being exposed at the press has not arrived yet
+    if (!afterPress) {
+        return {};
+    }
+
+    size_t best = ring_.size();
+    for (size_t i = 0; i < ring_.size(); i++) {
+        if (!matches(ring_[i], press) && !givingUp) {
+            continue;
+        }
+        if (best == ring_.size() || distance(ring_[i], press.at) < distance(ring_[best], press.at)) {
+            best = i;
+        }
+    }
+    if (best == ring_.size()) {
+        return {};  // Settings not in effect yet; a later frame will be closest
+    }
+    if (givingUp && !matches(ring_[best], press)) {
+        std::cerr << "Settings not confirmed by the sensor, capturing anyway" << std::endl;
+    }
+    return std::vector<SourceFrame>(ring_.begin() + static_cast<std::ptrdiff_t>(best), ring_.end());
+}
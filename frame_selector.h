@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "frame_source.h"
+
+// --- Frame selection ---
+// Picks the frame a shutter press captures, from what the sensor reports
+// about each frame rather than a fixed number of frames to skip.
+//
+// A frame counts for a press when its metadata shows it was exposed with the
+// exposure and gain in force at the press (controls take a few frames to
+// reach the sensor). Frames without metadata always count.
+//
+// - Depth 0: the first frame whose exposure starts at or after the press.
+// - Depth N (zero shutter lag): the last N frames stay leased in a ring, and
+//   the frame whose exposure window holds the press, or lies closest to it,
+//   is taken, even if it was exposed before the press was read.
+//
+// If no frame matches the settings within a few frames of the press, the
+// closest frame is taken anyway, so a sensor that clamps a setting cannot
+// hold up the shutter forever.
+class FrameSelector {
+public:
+    struct Press {
+        std::chrono::steady_clock::time_point at;
+        int32_t exposureTimeUs = 0;
+        float analogueGain = 0.0f;
+    };
+
+    explicit FrameSelector(size_t depth);
+
+    size_t depth() const { return depth_; }
+
+    // Keep a frame in the ring, dropping the oldest (no-op at depth 0)
+    void push(const SourceFrame &frame);
+    // Frames for a press, oldest first: the chosen one and every newer frame
+    // in the ring, for a burst. Empty while the right frame may still be
+    // coming. `current` is the frame that just arrived, already pushed.
+    std::vector<SourceFrame> select(const Press &press, const SourceFrame &current);
+    // Release the ring's frames
+    void clear();
+
+private:
+    bool matches(const SourceFrame &frame, const Press &press) const;
+
+    size_t depth_;
+    std::deque<SourceFrame> ring_;
+    std::chrono::steady_clock::time_point press_;  // Press the count below is for
+    int framesSincePress_ = 0;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "raw_frame.h"
+#include "yuv_frame.h"
+
+// --- Frame sources ---
+// Where YUV420 frames come from: the camera, or a stand-in that lets the
+// pipeline run on any Linux box. A source streams into a fixed ring of
+// buffers and hands every frame to a handler on its own thread. Copying the
+// frame's lease keeps its buffer out of the ring; the buffer is recycled once
+// the last copy is dropped, so a handler that keeps nothing recycles it on
+// return.
+//
+// A source can also deliver a small viewfinder image with every frame, in the
+// same buffer slot and under the same lease as the full one, and the raw
+// Bayer frame the full one was processed from.
+
+struct FrameFormat {
+    int width = 0;
+    int height = 0;
+    int stride = 0;                // Luma row stride in bytes (0 = source's choice)
+    unsigned int bufferCount = 0;  // Buffers in the ring
+    int viewfinderWidth = 0;       // Viewfinder size (0 = no viewfinder)
+    int viewfinderHeight = 0;
+    bool raw = false;              // Also deliver raw Bayer frames
+    int sensorWidth = 0;           // Sensor mode to scale from (0 = source's choice)
+    int sensorHeight = 0;
+    int sensorBitDepth = 0;
+    double frameRate = 0;          // Streaming rate (0 = source's choice)
+    RawLayout rawLayout{};         // What configure() delivers (width 0 = none)
+};
+
+struct SourceFrame {
+    YuvFrame image;
+    YuvFrame viewfinder;  // Null planes without a viewfinder
+    RawFrame raw;         // Null data without a raw frame
+    std::shared_ptr<void> lease;
+    uint64_t index = 0;                              // Frames delivered before this one
+    std::chrono::steady_clock::time_point arrival;  // When the source handed it over
+
+    // What the sensor reports about the frame, zero where it reports nothing
+    std::chrono::steady_clock::time_point exposureStart;  // First row starts exposing
+    int32_t exposureTimeUs = 0;
+    float analogueGain = 0.0f;
+};
+
+class FrameSource {
+public:
+    using FrameHandler = std::function<void(const SourceFrame &frame)>;
+    using ErrorHandler = std::function<void(const std::string &error)>;
+
+    virtual ~FrameSource() = default;
+
+    // Set up for the requested format. On success the format holds what the
+    // source will actually deliver. A stopped source can be configured again
+    // once every lease it handed out has been released.
+    virtual bool configure(FrameFormat &format) = 0;
+    virtual bool start(FrameHandler onFrame, ErrorHandler onError) = 0;
+    // Stop delivering frames. Leased buffers stay valid until released.
+    virtual void stop() = 0;
+
+    // Exposure and gain for frames from now on (stand-ins ignore them)
+    virtual void setControls(int32_t exposureTimeUs, float analogueGain) {
+        (void)exposureTimeUs;
+        (void)analogueGain;
+    }
+
+    virtual std::string describe() const = 0;
+};
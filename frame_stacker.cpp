@@ -0,0 +1,292 @@
+#include "frame_stacker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "yuv_scale.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr int PROJECTION_STEP = 4;  // Column sums take every fourth row
+constexpr int COARSE_BIN = 8;       // Projection samples per bin in the coarse search
+constexpr int MAX_SHIFT = 256;      // Pixels, in either direction
+constexpr int ALIGN_ROUNDS = 3;     // Most row/column refinements per frame
+
+uint32_t sumRow(const uint8_t *row, int count) {
+    uint32_t sum = 0;
+    int i = 0;
+#if defined(__ARM_NEON)
+    uint32x4_t acc = vdupq_n_u32(0);
+    for (; i + 16 <= count; i += 16) {
+        acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(row + i)));
+    }
+    sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i)), zero));
+    }
+    sum = static_cast<uint32_t>(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#endif
+    for (; i < count; i++) {
+        sum += row[i];
+    }
+    return sum;
+}
+
+// sums[i] += row[i]
+void addRow(uint16_t *sums, const uint8_t *row, int count) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t v = vld1q_u8(row + i);
+        vst1q_u16(sums + i, vaddw_u8(vld1q_u16(sums + i), vget_low_u8(v)));
+        vst1q_u16(sums + i + 8, vaddw_u8(vld1q_u16(sums + i + 8), vget_high_u8(v)));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        __m128i *s = reinterpret_cast<__m128i *>(sums + i);
+        _mm_storeu_si128(s, _mm_add_epi16(_mm_loadu_si128(s), _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128(s + 1, _mm_add_epi16(_mm_loadu_si128(s + 1), _mm_unpackhi_epi8(v, zero)));
+    }
+#endif
+    for (; i < count; i++) {
+        sums[i] += row[i];
+    }
+}
+
+// Add a source row moved left by dx (right if negative), repeating its end
+// pixels where the shift uncovers the edge
+void addShiftedRow(uint16_t *sums, const uint8_t *row, int width, int dx) {
+    int begin = std::clamp(-dx, 0, width);
+    int end = std::clamp(width - dx, begin, width);
+    for (int x = 0; x < begin; x++) {
+        sums[x] += row[0];
+    }
+    addRow(sums + begin, row + begin + dx, end - begin);
+    for (int x = end; x < width; x++) {
+        sums[x] += row[width - 1];
+    }
+}
+
+// out[i] = (sums[i] + frames / 2) / frames, rounded, for 2..MAX_FRAMES frames
+void averageRow(const uint16_t *sums, uint8_t *out, int count, int frames) {
+    uint16_t half = static_cast<uint16_t>(frames / 2);
+    uint16_t reciprocal = static_cast<uint16_t>((65536 + frames - 1) / frames);
+    int i = 0;
+#if defined(__ARM_NEON)
+    const uint16x8_t halfV = vdupq_n_u16(half);
+    const uint16x4_t reciprocalV = vdup_n_u16(reciprocal);
+    for (; i + 16 <= count; i += 16) {
+        uint16x8_t lo = vaddq_u16(vld1q_u16(sums + i), halfV);
+        uint16x8_t hi = vaddq_u16(vld1q_u16(sums + i + 8), halfV);
+        uint16x8_t qlo = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(lo), reciprocalV), 16),
+                                      vshrn_n_u32(vmull_u16(vget_high_u16(lo), reciprocalV), 16));
+        uint16x8_t qhi = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(hi), reciprocalV), 16),
+                                      vshrn_n_u32(vmull_u16(vget_high_u16(hi), reciprocalV), 16));
+        vst1q_u8(out + i, vcombine_u8(vqmovn_u16(qlo), vqmovn_u16(qhi)));
+    }
+#elif defined(__SSE2__)
+    const __m128i halfV = _mm_set1_epi16(static_cast<short>(half));
+    const __m128i reciprocalV = _mm_set1_epi16(static_cast<short>(reciprocal));
+    for (; i + 16 <= count; i += 16) {
+        __m128i lo = _mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(sums + i)), halfV);
+        __m128i hi = _mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(sums + i + 8)), halfV);
+        __m128i q = _mm_packus_epi16(_mm_mulhi_epu16(lo, reciprocalV), _mm_mulhi_epu16(hi, reciprocalV));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), q);
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = static_cast<uint8_t>(((sums[i] + half) * static_cast<uint32_t>(reciprocal)) >> 16);
+    }
+}
+
+// Mean absolute difference of cur[i + shift] against ref[i] over the overlap
+double projectionError(const uint32_t *ref, const uint32_t *cur, int count, int shift) {
+    int begin = std::max(0, -shift);
+    int end = std::min(count, count - shift);
+    if (end - begin < count / 2) {
+        return std::numeric_limits<double>::max();
+    }
+    uint64_t total = 0;
+    for (int i = begin; i < end; i++) {
+        int64_t d = static_cast<int64_t>(cur[i + shift]) - ref[i];
+        total += static_cast<uint64_t>(d < 0 ? -d : d);
+    }
+    return static_cast<double>(total) / (end - begin);
+}
+
+// Shift of `cur` against `ref` that matches them best: first over bins of
+// COARSE_BIN samples across the whole range, then sample by sample around it
+int matchProjections(const std::vector<uint32_t> &ref, const std::vector<uint32_t> &cur) {
+    int count = static_cast<int>(ref.size());
+    int bins = count / COARSE_BIN;
+    std::vector<uint32_t> refBins(bins), curBins(bins);
+    for (int b = 0; b < bins; b++) {
+        for (int i = 0; i < COARSE_BIN; i++) {
+            refBins[b] += ref[b * COARSE_BIN + i];
+            curBins[b] += cur[b * COARSE_BIN + i];
+        }
+    }
+
+    auto search = [](const uint32_t *r, const uint32_t *c, int n, int from, int to) {
+        int best = 0;
+        double bestError = std::numeric_limits<double>::max();
+        for (int shift = from; shift <= to; shift++) {
+            double error = projectionError(r, c, n, shift);
+            // Prefer the smaller shift on a tie
+            if (error < bestError || (error == bestError && std::abs(shift) < std::abs(best))) {
+                best = shift;
+                bestError = error;
+            }
+        }
+        return best;
+    };
+
+    int range = std::min(MAX_SHIFT, count / 4);
+    int coarse = bins > 0 ? search(refBins.data(), curBins.data(), bins, -range / COARSE_BIN, range / COARSE_BIN)
+                          : 0;
+    int centre = coarse * COARSE_BIN;
+    return search(ref.data(), cur.data(), count, std::max(centre - COARSE_BIN, -range),
+                  std::min(centre + COARSE_BIN, range));
+}
+
+}  // namespace
+
+FrameStacker::FrameStacker(WorkerPool &pool) : pool_(pool) {}
+
+void FrameStacker::allocate(int width, int height) {
+    width_ = width & ~1;
+    height_ = height & ~1;
+    sums_.assign(yuv420Size(width_, height_), 0);
+    bandColumns_.assign(pool_.concurrency(), std::vector<uint32_t>(width_));
+    marginX_ = std::min(MAX_SHIFT, width_ / 4);
+    marginY_ = std::min(MAX_SHIFT, height_ / 4);
+    frames_ = 0;
+}
+
+void FrameStacker::begin() {
+    frames_ = 0;
+}
+
+void FrameStacker::projectColumns(const YuvFrame &frame, int y0, int y1, std::vector<uint32_t> &out) {
+    out.assign(width_, 0);
+    int bands = static_cast<int>(bandColumns_.size());
+    int samples = (y1 - y0 + PROJECTION_STEP - 1) / PROJECTION_STEP;
+    int bandSamples = (samples + bands - 1) / bands;
+    pool_.parallelFor(bands, [&](size_t b) {
+        std::vector<uint32_t> &columns = bandColumns_[b];
+        std::fill(columns.begin(), columns.end(), 0);
+        int first = static_cast<int>(b) * bandSamples;
+        int last = std::min(first + bandSamples, samples);
+        for (int i = first; i < last; i++) {
+            const uint8_t *row = frame.planes[0] + static_cast<size_t>(y0 + i * PROJECTION_STEP) * frame.strides[0];
+            for (int x = 0; x < width_; x++) {
+                columns[x] += row[x];
+            }
+        }
+    });
+    for (const auto &columns : bandColumns_) {
+        for (int x = 0; x < width_; x++) {
+            out[x] += columns[x];
+        }
+    }
+}
+
+void FrameStacker::projectRows(const YuvFrame &frame, int x0, int x1, std::vector<uint32_t> &out) {
+    out.assign(height_, 0);
+    int bands = static_cast<int>(pool_.concurrency());
+    int bandRows = (height_ + bands - 1) / bands;
+    pool_.parallelFor(bands, [&](size_t b) {
+        int first = static_cast<int>(b) * bandRows;
+        int last = std::min(first + bandRows, height_);
+        for (int y = first; y < last; y++) {
+            out[y] = sumRow(frame.planes[0] + static_cast<size_t>(y) * frame.strides[0] + x0, x1 - x0);
+        }
+    });
+}
+
+void FrameStacker::accumulate(const YuvFrame &frame, int dx, int dy) {
+    uint16_t *planes[3] = {sums_.data(), sums_.data() + static_cast<size_t>(width_) * height_, nullptr};
+    planes[2] = planes[1] + static_cast<size_t>(width_ / 2) * (height_ / 2);
+
+    // Bands of even luma rows, each with its chroma rows
+    int bands = static_cast<int>(pool_.concurrency());
+    int bandRows = ((height_ + bands - 1) / bands + 1) & ~1;
+    pool_.parallelFor(bands, [&](size_t b) {
+        int y0 = static_cast<int>(b) * bandRows;
+        int y1 = std::min(y0 + bandRows, height_);
+        for (int p = 0; p < 3; p++) {
+            int scale = p == 0 ? 1 : 2;
+            int width = width_ / scale;
+            int height = height_ / scale;
+            for (int y = y0 / scale; y < y1 / scale; y++) {
+                int source = std::clamp(y + dy / scale, 0, height - 1);
+                addShiftedRow(planes[p] + static_cast<size_t>(y) * width,
+                              frame.planes[p] + static_cast<size_t>(source) * frame.strides[p], width, dx / scale);
+            }
+        }
+    });
+}
+
+void FrameStacker::add(const YuvFrame &frame, int &dx, int &dy) {
+    dx = 0;
+    dy = 0;
+    if (frames_ >= MAX_FRAMES || frame.width < width_ || frame.height < height_) {
+        return;
+    }
+
+    if (frames_ == 0) {
+        std::fill(sums_.begin(), sums_.end(), 0);
+        projectColumns(frame, marginY_, height_ - marginY_, reference_.columns);
+        projectRows(frame, marginX_, width_ - marginX_, reference_.rows);
+    } else {
+        // Rows over the columns the last round matched, then columns over
+        // the rows just matched, until the two agree
+        int x = 0, y = 0;
+        for (int round = 0; round < ALIGN_ROUNDS; round++) {
+            projectRows(frame, marginX_ + x, width_ - marginX_ + x, current_.rows);
+            y = matchProjections(reference_.rows, current_.rows);
+            projectColumns(frame, marginY_ + y, height_ - marginY_ + y, current_.columns);
+            int matched = matchProjections(reference_.columns, current_.columns);
+            if (matched == x) {
+                break;
+            }
+            x = matched;
+        }
+        // Nearest even shift, so chroma moves by whole samples
+        dx = (x + (x > 0)) & ~1;
+        dy = (y + (y > 0)) & ~1;
+    }
+    accumulate(frame, dx, dy);
+    frames_++;
+}
+
+YuvFrame FrameStacker::finish(uint8_t *buffer) {
+    YuvFrame out = packedYuv420(buffer, width_, height_);
+    int frames = std::max(frames_, 1);
+    size_t total = sums_.size();
+    size_t chunk = (total / pool_.concurrency() + 15) & ~static_cast<size_t>(15);
+    pool_.parallelFor(pool_.concurrency(), [&](size_t i) {
+        size_t begin = std::min(i * chunk, total);
+        size_t end = std::min(begin + chunk, total);
+        if (frames == 1) {
+            for (size_t j = begin; j < end; j++) {
+                buffer[j] = static_cast<uint8_t>(sums_[j]);
+            }
+        } else {
+            averageRow(sums_.data() + begin, buffer + begin, static_cast<int>(end - begin), frames);
+        }
+    });
+    return out;
+}
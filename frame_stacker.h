@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "worker_pool.h"
+#include "yuv_frame.h"
+
+// --- Frame stacking ---
+// Averages a run of consecutive frames into one, to cut noise in low light.
+// Each frame is aligned to the first by a global translation and added into
+// one 16-bit accumulator as it arrives, so memory stays at the accumulator
+// and one output frame however many frames are stacked, and time grows
+// linearly with their number.
+//
+// The translation comes from the frames' luma projections (column sums over
+// every fourth row, and row sums), matched coarse to fine. Projections span
+// the middle of the frame, and each axis is matched with the other's shift
+// applied to its window, in turn until they agree, so a large shift along one
+// axis doesn't skew the other. The result is rounded to even pixels so chroma
+// moves with luma. Edges uncovered by the shift repeat the nearest pixel.
+// Adding and averaging use NEON or SSE2 when available, and every pass is
+// split into row bands over the worker pool.
+class FrameStacker {
+public:
+    // 16-bit sums of up to 16 frames divide exactly by a 16-bit reciprocal
+    static constexpr int MAX_FRAMES = 16;
+
+    explicit FrameStacker(WorkerPool &pool);
+
+    // Size the accumulator for frames of this (even) size
+    void allocate(int width, int height);
+    // Start a new stack, dropping any partial one
+    void begin();
+    // Align a frame to the first of the stack and add it. Sets the shift
+    // applied, in pixels; the first frame is the reference and gets none.
+    // Frames past MAX_FRAMES are ignored.
+    void add(const YuvFrame &frame, int &dx, int &dy);
+    int frames() const { return frames_; }
+
+    // Average of the frames added so far, into a packedYuv420() frame in
+    // `buffer` of yuv420Size(width, height) bytes
+    YuvFrame finish(uint8_t *buffer);
+
+private:
+    struct Projections {
+        std::vector<uint32_t> columns;
+        std::vector<uint32_t> rows;
+    };
+
+    // Column sums over rows [y0, y1), row sums over columns [x0, x1)
+    void projectColumns(const YuvFrame &frame, int y0, int y1, std::vector<uint32_t> &out);
+    void projectRows(const YuvFrame &frame, int x0, int x1, std::vector<uint32_t> &out);
+    void accumulate(const YuvFrame &frame, int dx, int dy);
+
+    WorkerPool &pool_;
+    int width_ = 0;
+    int height_ = 0;
+    int frames_ = 0;
+    int marginX_ = 0;  // Projection windows leave this much room to shift into
+    int marginY_ = 0;
+    std::vector<uint16_t> sums_;  // Y, U and V planes, packed
+    Projections reference_;
+    Projections current_;
+    std::vector<std::vector<uint32_t>> bandColumns_;  // Per-band partial column sums
+};
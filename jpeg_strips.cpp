@@ -0,0 +1,213 @@
+#include "jpeg_strips.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr int MCU_SIZE = 16;                 // 4:2:0 MCUs cover 16x16 luma pixels
+constexpr int MAX_RESTART_INTERVAL = 65535;  // DRI stores the interval in 16 bits
+
+// Each pool thread owns one compressor for its whole lifetime
+struct ThreadCompressor {
+    tjhandle handle = tjInitCompress();
+    ~ThreadCompressor() {
+        if (handle) {
+            tjDestroy(handle);
+        }
+    }
+};
+
+tjhandle threadCompressor() {
+    thread_local ThreadCompressor compressor;
+    return compressor.handle;
+}
+
+int divRoundUp(int a, int b) {
+    return (a + b - 1) / b;
+}
+
+struct StripLayout {
+    int strips;
+    int stripRows;  // MCU rows per strip; the last strip may be shorter
+    int mcusPerRow;
+};
+
+StripLayout layoutStrips(int width, int height, int strips) {
+    StripLayout layout;
+    int mcuRows = divRoundUp(height, MCU_SIZE);
+    layout.mcusPerRow = divRoundUp(width, MCU_SIZE);
+    layout.stripRows = divRoundUp(mcuRows, std::max(1, std::min(strips, mcuRows)));
+    layout.strips = divRoundUp(mcuRows, layout.stripRows);
+    return layout;
+}
+
+struct StripResult {
+    unsigned char *data = nullptr;
+    unsigned long size = 0;
+    unsigned long headerSize = 0;    // Bytes up to the end of the SOS segment
+    unsigned long sosPos = 0;
+    unsigned long sofHeightPos = 0;
+    bool ok = false;
+    std::string error;
+};
+
+// Walk the marker segments up to SOS. Fails on anything that would stop the
+// strips from being joined: a missing frame header, existing restart markers
+// or a truncated stream.
+bool parseHeader(StripResult &strip) {
+    const unsigned char *p = strip.data;
+    unsigned long pos = 2;  // Skip SOI
+    bool haveSof = false;
+
+    while (pos + 4 <= strip.size) {
+        if (p[pos] != 0xFF) {
+            return false;
+        }
+        unsigned char marker = p[pos + 1];
+        unsigned long length = (p[pos + 2] << 8) | p[pos + 3];
+
+        if (marker == 0xC0 || marker == 0xC1) {
+            strip.sofHeightPos = pos + 5;
+            haveSof = true;
+        } else if (marker == 0xDD) {
+            return false;
+        } else if (marker == 0xDA) {
+            strip.sosPos = pos;
+            strip.headerSize = pos + 2 + length;
+            return haveSof && strip.headerSize + 2 <= strip.size &&
+                   p[strip.size - 2] == 0xFF && p[strip.size - 1] == 0xD9;
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// Every strip must carry the same tables; only the frame height may differ
+bool headersMatch(const StripResult &a, const StripResult &b) {
+    if (a.headerSize != b.headerSize || a.sofHeightPos != b.sofHeightPos) {
+        return false;
+    }
+    return std::memcmp(a.data, b.data, a.sofHeightPos) == 0 &&
+           std::memcmp(a.data + a.sofHeightPos + 2, b.data + b.sofHeightPos + 2,
+                       a.headerSize - a.sofHeightPos - 2) == 0;
+}
+
+bool compressSingle(tjhandle handle, const YuvFrame &frame, int quality, int flags,
+                    unsigned char *out, unsigned long &outSize, std::string &error) {
+    const unsigned char *planes[3] = {frame.planes[0], frame.planes[1], frame.planes[2]};
+    outSize = tjBufSize(frame.width, frame.height, TJSAMP_420);
+    if (tjCompressFromYUVPlanes(handle, planes, frame.width, frame.strides, frame.height,
+                                TJSAMP_420, &out, &outSize, quality, flags | TJFLAG_NOREALLOC) < 0) {
+        error = tjGetErrorStr2(handle);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+int jpegStripCount(int width, int height, unsigned int concurrency) {
+    StripLayout layout = layoutStrips(width, height, static_cast<int>(concurrency));
+    if (layout.stripRows * layout.mcusPerRow > MAX_RESTART_INTERVAL) {
+        // Shorten strips until the restart interval fits in DRI
+        int maxRows = MAX_RESTART_INTERVAL / layout.mcusPerRow;
+        if (maxRows < 1) {
+            return 1;
+        }
+        return divRoundUp(divRoundUp(height, MCU_SIZE), maxRows);
+    }
+    return layout.strips;
+}
+
+unsigned long jpegStripBufferSize(int width, int height, int strips) {
+    StripLayout layout = layoutStrips(width, height, strips);
+    unsigned long stripBound = tjBufSize(width, layout.stripRows * MCU_SIZE, TJSAMP_420);
+    return std::max(stripBound * layout.strips, tjBufSize(width, height, TJSAMP_420));
+}
+
+bool compressStripsToJpeg(WorkerPool &pool, tjhandle handle, const YuvFrame &frame, int strips,
+                          int quality, int flags, unsigned char *out, unsigned long &outSize,
+                          std::string &error) {
+    StripLayout layout = layoutStrips(frame.width, frame.height, strips);
+    int restartInterval = layout.stripRows * layout.mcusPerRow;
+    if (layout.strips <= 1 || restartInterval > MAX_RESTART_INTERVAL) {
+        return compressSingle(handle, frame, quality, flags, out, outSize, error);
+    }
+
+    // Each strip compresses into its own worst-case region of the output
+    unsigned long region = tjBufSize(frame.width, layout.stripRows * MCU_SIZE, TJSAMP_420);
+    std::vector<StripResult> results(layout.strips);
+
+    pool.parallelFor(layout.strips, [&](size_t i) {
+        int row = static_cast<int>(i) * layout.stripRows * MCU_SIZE;
+        int rows = std::min(layout.stripRows * MCU_SIZE, frame.height - row);
+
+        const unsigned char *planes[3] = {
+            frame.planes[0] + static_cast<size_t>(row) * frame.strides[0],
+            frame.planes[1] + static_cast<size_t>(row / 2) * frame.strides[1],
+            frame.planes[2] + static_cast<size_t>(row / 2) * frame.strides[2],
+        };
+
+        StripResult &strip = results[i];
+        tjhandle compressor = threadCompressor();
+        strip.data = out + i * region;
+        strip.size = region;
+        if (!compressor) {
+            strip.error = "failed to initialize turbojpeg";
+            return;
+        }
+        if (tjCompressFromYUVPlanes(compressor, planes, frame.width, frame.strides, rows, TJSAMP_420,
+                                    &strip.data, &strip.size, quality, flags | TJFLAG_NOREALLOC) < 0) {
+            strip.error = tjGetErrorStr2(compressor);
+            return;
+        }
+        strip.ok = parseHeader(strip);
+    });
+
+    for (const auto &strip : results) {
+        if (!strip.error.empty()) {
+            error = strip.error;
+            return false;
+        }
+        if (!strip.ok || !headersMatch(results[0], strip)) {
+            // Tables differ between strips (e.g. TJ_OPTIMIZE is set), so the
+            // segments cannot share one header
+            return compressSingle(handle, frame, quality, flags, out, outSize, error);
+        }
+    }
+
+    // Header: patch in the full height and insert DRI in front of SOS
+    StripResult &first = results[0];
+    unsigned long firstEnd = first.size - 2;  // Drop EOI
+    std::memmove(out + first.sosPos + 6, out + first.sosPos, firstEnd - first.sosPos);
+    const unsigned char dri[6] = {
+        0xFF, 0xDD, 0x00, 0x04,
+        static_cast<unsigned char>(restartInterval >> 8),
+        static_cast<unsigned char>(restartInterval & 0xFF),
+    };
+    std::memcpy(out + first.sosPos, dri, sizeof(dri));
+    out[first.sofHeightPos] = static_cast<unsigned char>(frame.height >> 8);
+    out[first.sofHeightPos + 1] = static_cast<unsigned char>(frame.height & 0xFF);
+
+    // Compact the remaining entropy segments behind it, each after an RSTn
+    unsigned long pos = firstEnd + sizeof(dri);
+    for (int i = 1; i < layout.strips; i++) {
+        const StripResult &strip = results[i];
+        unsigned long segment = strip.size - strip.headerSize - 2;
+        const unsigned char *src = strip.data + strip.headerSize;
+        if (out + pos + 2 > src) {
+            return compressSingle(handle, frame, quality, flags, out, outSize, error);
+        }
+        out[pos++] = 0xFF;
+        out[pos++] = static_cast<unsigned char>(0xD0 + ((i - 1) & 7));
+        std::memmove(out + pos, src, segment);
+        pos += segment;
+    }
+    out[pos++] = 0xFF;
+    out[pos++] = 0xD9;
+
+    outSize = pos;
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <turbojpeg.h>
+
+#include "worker_pool.h"
+#include "yuv_frame.h"
+
+// --- Strip-parallel JPEG encoding ---
+// The frame is cut into horizontal strips on MCU-row boundaries and every
+// strip is compressed as its own JPEG on the worker pool. The strips are then
+// joined into one baseline JPEG: the first strip's header (with the full
+// height patched in and a DRI marker added) followed by each strip's
+// entropy-coded segment, separated by RSTn markers. Restart markers reset the
+// DC predictors exactly as a fresh encoder does, so the result decodes to the
+// same pixels as a single-pass encode with the same tables.
+
+// Number of strips used for a frame on a pool of the given concurrency
+int jpegStripCount(int width, int height, unsigned int concurrency);
+
+// Worst-case output size of compressStripsToJpeg(), to size output buffers
+unsigned long jpegStripBufferSize(int width, int height, int strips);
+
+// Compress a YUV420 frame into `out` (at least jpegStripBufferSize() bytes).
+// `handle` is the caller's compressor; pool workers use their own. Falls back
+// to a single-strip encode when strips cannot be joined safely.
+bool compressStripsToJpeg(WorkerPool &pool, tjhandle handle, const YuvFrame &frame, int strips,
+                          int quality, int flags, unsigned char *out, unsigned long &outSize,
+                          std::string &error);
@@ -0,0 +1,162 @@
+#include "latency_trace.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+long currentThreadId() {
+    return syscall(SYS_gettid);
+}
+
+}  // namespace
+
+const char *latencyStageName(LatencyStage stage) {
+    switch (stage) {
+        case LatencyStage::PressToFrame: return "press_to_frame";
+        case LatencyStage::Handoff: return "handoff";
+        case LatencyStage::Stack: return "stack";
+        case LatencyStage::QueueWait: return "queue_wait";
+        case LatencyStage::Encode: return "encode";
+        case LatencyStage::Thumbnail: return "thumbnail";
+        case LatencyStage::Exif: return "exif";
+        case LatencyStage::WriteWait: return "write_wait";
+        case LatencyStage::Write: return "write";
+        case LatencyStage::LedAck: return "led_ack";
+        case LatencyStage::ShutterToDisk: return "shutter_to_disk";
+        case LatencyStage::Count: break;
+    }
+    return "unknown";
+}
+
+// --- Histogram ---
+// Values below 2^SUB_BUCKET_BITS get a bucket each; above that every power of
+// two is split into 2^SUB_BUCKET_BITS equal buckets.
+int LatencyHistogram::bucketFor(uint64_t micros) {
+    constexpr uint64_t linear = 1u << SUB_BUCKET_BITS;
+    if (micros < linear) {
+        return static_cast<int>(micros);
+    }
+    int msb = 63 - __builtin_clzll(micros);
+    int sub = static_cast<int>((micros >> (msb - SUB_BUCKET_BITS)) & (linear - 1));
+    return ((msb - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + sub;
+}
+
+uint64_t LatencyHistogram::bucketValue(int bucket) {
+    constexpr int linear = 1 << SUB_BUCKET_BITS;
+    if (bucket < linear) {
+        return static_cast<uint64_t>(bucket);
+    }
+    int shift = (bucket >> SUB_BUCKET_BITS) - 1;
+    uint64_t lower = static_cast<uint64_t>(linear + (bucket & (linear - 1))) << shift;
+    return lower + ((1ull << shift) >> 1);  // Middle of the bucket
+}
+
+void LatencyHistogram::record(uint64_t micros) {
+    buckets_[bucketFor(micros)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    uint64_t prev = max_.load(std::memory_order_relaxed);
+    while (micros > prev && !max_.compare_exchange_weak(prev, micros, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(p * total + 0.999999);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return std::min(bucketValue(i), max());
+        }
+    }
+    return max();
+}
+
+// --- Trace ---
+LatencyTrace::~LatencyTrace() {
+    closeTraceFile();
+}
+
+bool LatencyTrace::openTraceFile(const std::string &path) {
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    traceFile_ = fopen(path.c_str(), "w");
+    if (!traceFile_) {
+        return false;
+    }
+    fputs("[\n", traceFile_);
+    firstEvent_ = true;
+    tracing_ = true;
+    return true;
+}
+
+void LatencyTrace::closeTraceFile() {
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    tracing_ = false;
+    if (traceFile_) {
+        fputs("\n]\n", traceFile_);
+        fclose(traceFile_);
+        traceFile_ = nullptr;
+    }
+}
+
+uint64_t LatencyTrace::traceMicros(Clock::time_point t) const {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(t - epoch_).count());
+}
+
+void LatencyTrace::writeEvent(const std::string &event) {
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    if (!traceFile_) {
+        return;
+    }
+    if (!firstEvent_) {
+        fputs(",\n", traceFile_);
+    }
+    fputs(event.c_str(), traceFile_);
+    firstEvent_ = false;
+}
+
+void LatencyTrace::nameThread(const std::string &name) {
+    writeEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(currentThreadId()) +
+               ",\"args\":{\"name\":\"" + name + "\"}}");
+}
+
+void LatencyTrace::record(LatencyStage stage, uint64_t capture, Clock::time_point begin, Clock::time_point end) {
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count();
+    histograms_[static_cast<int>(stage)].record(static_cast<uint64_t>(std::max<int64_t>(micros, 0)));
+
+    if (tracing_) {
+        writeEvent(std::string("{\"name\":\"") + latencyStageName(stage) + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" +
+                   std::to_string(currentThreadId()) + ",\"ts\":" + std::to_string(traceMicros(begin)) +
+                   ",\"dur\":" + std::to_string(std::max<int64_t>(micros, 0)) +
+                   ",\"args\":{\"capture\":" + std::to_string(capture) + "}}");
+    }
+}
+
+void LatencyTrace::mark(const char *name, Clock::time_point at) {
+    if (tracing_) {
+        writeEvent(std::string("{\"name\":\"") + name + "\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":" +
+                   std::to_string(currentThreadId()) + ",\"ts\":" + std::to_string(traceMicros(at)) + "}");
+    }
+}
+
+void LatencyTrace::report(std::ostream &out) const {
+    // Leave the caller's stream formatting as it was
+    std::ios state(nullptr);
+    state.copyfmt(out);
+    out << "Latency (ms)         count      p50      p99      max" << std::endl;
+    for (int i = 0; i < static_cast<int>(LatencyStage::Count); i++) {
+        const LatencyHistogram &h = histograms_[i];
+        out << std::left << std::setw(18) << latencyStageName(static_cast<LatencyStage>(i)) << std::right
+            << std::setw(8) << h.count() << std::fixed << std::setprecision(1)
+            << std::setw(9) << h.percentile(0.50) / 1000.0
+            << std::setw(9) << h.percentile(0.99) / 1000.0
+            << std::setw(9) << h.max() / 1000.0 << std::endl;
+    }
+    out.copyfmt(state);
+}
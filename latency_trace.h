@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// --- Shutter latency tracing ---
+// Every capture records how long it spent in each pipeline stage. Durations
+// go into lock-free log-linear histograms (about 6% resolution) that can be
+// reported at any time, and optionally into a Chrome trace-event JSON file
+// that loads into chrome://tracing or Perfetto as a per-thread timeline.
+
+enum class LatencyStage {
+    PressToFrame,   // Shutter press until the captured frame arrives
+    Handoff,        // Frame arrival until the job is queued for encoding
+    Stack,          // Aligning and adding one frame of a stack
+    QueueWait,      // Queued until an encoder worker picks the job up
+    Encode,         // JPEG encode, or spool packing (including any downscale)
+    Thumbnail,      // Sampling and encoding the EXIF preview
+    Exif,           // Building the EXIF APP1 segment
+    WriteWait,      // Handed to the storage writer until it starts writing
+    Write,          // Temp file write, fsync and rename
+    LedAck,         // File committed to the LED lit
+    ShutterToDisk,  // Press (or burst frame arrival) until the file is committed
+    Count,
+};
+
+class LatencyHistogram {
+public:
+    void record(uint64_t micros);
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    uint64_t percentile(double p) const;
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr int BUCKETS = (64 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+    static int bucketFor(uint64_t micros);
+    static uint64_t bucketValue(int bucket);
+
+    std::atomic<uint64_t> buckets_[BUCKETS] = {};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+class LatencyTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ~LatencyTrace();
+
+    // Also write every event to a trace-event JSON file
+    bool openTraceFile(const std::string &path);
+    void closeTraceFile();
+
+    // Label the calling thread's row in the trace
+    void nameThread(const std::string &name);
+
+    // A finished stage of one capture
+    void record(LatencyStage stage, uint64_t capture, Clock::time_point begin, Clock::time_point end);
+
+    // A point in time worth seeing on the timeline (trace file only)
+    void mark(const char *name, Clock::time_point at);
+
+    // p50/p99/max per stage
+    void report(std::ostream &out) const;
+    const LatencyHistogram &histogram(LatencyStage stage) const { return histograms_[static_cast<int>(stage)]; }
+
+private:
+    uint64_t traceMicros(Clock::time_point t) const;
+    void writeEvent(const std::string &event);
+
+    LatencyHistogram histograms_[static_cast<int>(LatencyStage::Count)];
+    Clock::time_point epoch_ = Clock::now();
+
+    std::mutex fileMutex_;
+    FILE *traceFile_ = nullptr;
+    std::atomic<bool> tracing_{false};  // traceFile_ is open; checked without the lock
+    bool firstEvent_ = true;
+};
+
+const char *latencyStageName(LatencyStage stage);
@@ -0,0 +1,186 @@
+#include "lcd_sink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+// LCD HAT library (C headers)
+extern "C" {
+#include "DEV_Config.h"
+#include "LCD_1in3.h"
+#include "GUI_Paint.h"
+}
+
+using namespace std::chrono;
+
+namespace {
+
+// Longest a frame waits for the shutter to let go of the shared pin
+constexpr milliseconds SHARED_PIN_WAIT{1000};
+// Rows per SPI burst. A shutter edge during a burst reaches the pin once it
+// is out: 8 of 240 rows, under a millisecond at ~25 ms a frame.
+constexpr int BAND_ROWS = 8;
+
+// ST7789 commands, sent as the HAT library sends them: the command byte with
+// the data/command pin low, its parameters with it high
+constexpr UBYTE CASET = 0x2A;  // Column window
+constexpr UBYTE RASET = 0x2B;  // Row window
+constexpr UBYTE RAMWR = 0x2C;  // Pixels follow
+
+void sendCommand(UBYTE command, UBYTE *data, uint32_t size) {
+    DEV_Digital_Write(LCD_DC, 0);
+    DEV_SPI_WriteByte(command);
+    DEV_Digital_Write(LCD_DC, 1);
+    if (size > 0) {
+        DEV_SPI_Write_nByte(data, size);
+    }
+}
+
+}  // namespace
+
+LcdSink::~LcdSink() {
+    close();
+}
+
+bool LcdSink::open() {
+    auto initStart = steady_clock::now();
+    if (DEV_ModuleInit() != 0) {
+        std::cerr << "Failed to init LCD module" << std::endl;
+        return false;
+    }
+    LCD_1IN3_Init(HORIZONTAL);
+    LCD_SetBacklight(0);
+    LCD_1IN3_Clear(BLACK);
+    DEV_Digital_Write(LCD_DC, sharedPinHigh_ ? 1 : 0);
+
+    frame_.assign(LCD_1IN3_WIDTH * LCD_1IN3_HEIGHT, BLACK);
+    directLayout_ = probeLayout();
+    if (!directLayout_) {
+        scratch_.resize(frame_.size());
+        std::cout << "LCD image layout not recognized, drawing pixel by pixel" << std::endl;
+    }
+
+    open_ = true;
+    std::cout << "LCD ready in " << duration_cast<milliseconds>(steady_clock::now() - initStart).count()
+              << " ms" << std::endl;
+    return true;
+}
+
+void LcdSink::close() {
+    if (!open_) {
+        return;
+    }
+    std::lock_guard<PiMutex> lock(busMutex_);
+    LCD_SetBacklight(0);
+    DEV_ModuleExit();
+    open_ = false;
+}
+
+int LcdSink::width() const {
+    return LCD_1IN3_WIDTH;
+}
+
+int LcdSink::height() const {
+    return LCD_1IN3_HEIGHT;
+}
+
+std::string LcdSink::describe() const {
+    return "1.3\" LCD HAT";
+}
+
+uint16_t *LcdSink::frame() {
+    return directLayout_ ? frame_.data() : scratch_.data();
+}
+
+// Find out how the paint library stores pixels by setting one. Frames are
+// rendered straight into its image when it is plain row-major RGB565.
+bool LcdSink::probeLayout() {
+    Paint_NewImage(frame_.data(), LCD_1IN3_WIDTH, LCD_1IN3_HEIGHT, 0, BLACK, 16);
+    Paint_Clear(BLACK);
+    Paint_SetPixel(1, 0, 0x1234);
+    bool direct = true;
+    if (frame_[1] == 0x1234) {
+        swapBytes_ = false;
+    } else if (frame_[1] == 0x3412) {
+        swapBytes_ = true;
+    } else {
+        direct = false;
+    }
+    Paint_Clear(BLACK);
+    return direct;
+}
+
+bool LcdSink::present() {
+    if (!directLayout_) {
+        for (int y = 0; y < LCD_1IN3_HEIGHT; y++) {
+            for (int x = 0; x < LCD_1IN3_WIDTH; x++) {
+                Paint_SetPixel(x, y, scratch_[y * LCD_1IN3_WIDTH + x]);
+            }
+        }
+    }
+
+    for (int row = 0; row < LCD_1IN3_HEIGHT; row += BAND_ROWS) {
+        std::unique_lock<PiMutex> bus = acquireBus();
+        if (!bus.owns_lock()) {
+            return false;  // Shutter still held; try the next frame
+        }
+        sendBand(row, std::min(BAND_ROWS, LCD_1IN3_HEIGHT - row));
+
+        // Apply a shutter edge that came in during the band. The bus is let
+        // go under the pin lock, so a later edge finds it free.
+        std::lock_guard<PiMutex> pin(pinMutex_);
+        DEV_Digital_Write(LCD_DC, sharedPinHigh_ ? 1 : 0);
+        bus.unlock();
+    }
+    return true;
+}
+
+// Take the bus with the shared pin high, waiting while the shutter holds it
+// low. Returns an empty lock on timeout.
+std::unique_lock<PiMutex> LcdSink::acquireBus() {
+    auto deadline = steady_clock::now() + SHARED_PIN_WAIT;
+    while (true) {
+        {
+            std::unique_lock<PiMutex> pin(pinMutex_);
+            if (!pinCv_.wait_until(pin, deadline, [this] { return sharedPinHigh_; })) {
+                return {};
+            }
+        }
+        std::unique_lock<PiMutex> bus(busMutex_);
+        std::lock_guard<PiMutex> pin(pinMutex_);
+        if (sharedPinHigh_) {
+            return bus;
+        }
+    }
+}
+
+// Each band sets its own window, so a frame can resume after the shutter
+void LcdSink::sendBand(int row, int rows) {
+    UBYTE columns[] = {0, 0, (LCD_1IN3_WIDTH - 1) >> 8, (LCD_1IN3_WIDTH - 1) & 0xff};
+    UBYTE window[] = {static_cast<UBYTE>(row >> 8), static_cast<UBYTE>(row & 0xff),
+                      static_cast<UBYTE>((row + rows - 1) >> 8), static_cast<UBYTE>((row + rows - 1) & 0xff)};
+    sendCommand(CASET, columns, sizeof(columns));
+    sendCommand(RASET, window, sizeof(window));
+    sendCommand(RAMWR, nullptr, 0);
+    DEV_SPI_Write_nByte(reinterpret_cast<UBYTE *>(&frame_[static_cast<size_t>(row) * LCD_1IN3_WIDTH]),
+                        static_cast<uint32_t>(rows * LCD_1IN3_WIDTH * 2));
+}
+
+void LcdSink::setBacklight(bool on) {
+    std::lock_guard<PiMutex> lock(busMutex_);
+    LCD_SetBacklight(on ? 1023 : 0);
+}
+
+void LcdSink::setSharedPin(bool high) {
+    {
+        std::lock_guard<PiMutex> pin(pinMutex_);
+        sharedPinHigh_ = high;
+        // Between bands the pin is written now; during one, by the band's
+        // sender once it is out
+        if (busMutex_.try_lock()) {
+            DEV_Digital_Write(LCD_DC, high ? 1 : 0);
+            busMutex_.unlock();
+        }
+    }
+    pinCv_.notify_all();
+}
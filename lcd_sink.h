@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "display_sink.h"
+#include "thread_policy.h"
+
+// --- LCD HAT sink ---
+// The 1.3" LCD HAT, initialized once and kept open for the life of the app.
+//
+// The HAT's data/command pin doubles as the camera's shutter output. While
+// the panel is open it owns that pin. Frames go out a band of rows at a
+// time, and the pin may only change between bands: setSharedPin() never
+// waits, but writes the pin at once between bands, or has the band in
+// progress write it as soon as it is out. A frame waits, between bands,
+// while the shutter holds the pin low.
+
+class LcdSink : public DisplaySink {
+public:
+    ~LcdSink() override;
+
+    // Initialize the panel, blank with the backlight off
+    bool open();
+    void close();
+    bool isOpen() const { return open_; }
+
+    int width() const override;
+    int height() const override;
+    bool swapBytes() const override { return directLayout_ && swapBytes_; }
+    uint16_t *frame() override;
+    bool present() override;
+    void setBacklight(bool on) override;
+    std::string describe() const override;
+
+    void setSharedPin(bool high);
+
+private:
+    bool probeLayout();
+    std::unique_lock<PiMutex> acquireBus();
+    void sendBand(int row, int rows);
+
+    bool open_ = false;
+    std::vector<uint16_t> frame_;
+    std::vector<uint16_t> scratch_;
+    bool directLayout_ = false;  // frame_ is row-major and can be rendered into
+    bool swapBytes_ = false;     // Pixels are stored high byte first
+
+    // Held for each band sent to the panel, and other panel commands. Both
+    // locks inherit priority, as the shutter is driven from real-time
+    // threads.
+    PiMutex busMutex_;
+    // Held briefly for the shared pin's state and writes to it; taken after
+    // busMutex_, or with a try_lock on it
+    PiMutex pinMutex_;
+    std::condition_variable_any pinCv_;
+    bool sharedPinHigh_ = true;  // Guarded by pinMutex_
+};
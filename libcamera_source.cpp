@@ -0,0 +1,468 @@
+#include "libcamera_source.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <time.h>
+
+using namespace libcamera;
+
+namespace {
+
+// SensorTimestamp counts CLOCK_BOOTTIME nanoseconds; steady_clock is
+// CLOCK_MONOTONIC, which stops during suspend
+std::chrono::steady_clock::time_point fromBoottime(int64_t nanoseconds) {
+    timespec boot;
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    auto steadyNow = std::chrono::steady_clock::now();
+    int64_t bootNow = static_cast<int64_t>(boot.tv_sec) * 1000000000 + boot.tv_nsec;
+    return steadyNow - std::chrono::nanoseconds(bootNow - nanoseconds);
+}
+
+}  // namespace
+
+LibcameraSource::LibcameraSource(int32_t exposureTimeUs, float analogueGain)
+    : exposureTimeUs_(exposureTimeUs), analogueGain_(analogueGain) {}
+
+LibcameraSource::~LibcameraSource() {
+    stop();
+    release();
+}
+
+std::string LibcameraSource::describe() const {
+    return camera_ ? "libcamera " + camera_->id() : "libcamera";
+}
+
+void LibcameraSource::setControls(int32_t exposureTimeUs, float analogueGain) {
+    exposureTimeUs_.store(exposureTimeUs);
+    analogueGain_.store(analogueGain);
+}
+
+// Start the camera manager and acquire the first camera, once
+bool LibcameraSource::open() {
+    if (camera_) {
+        return true;
+    }
+    cameraManager_ = std::make_unique<CameraManager>();
+    if (cameraManager_->start()) {
+        std::cerr << "Failed to start camera manager" << std::endl;
+        cameraManager_.reset();
+        return false;
+    }
+
+    if (cameraManager_->cameras().empty()) {
+        std::cerr << "No cameras found" << std::endl;
+        return false;
+    }
+
+    camera_ = cameraManager_->cameras()[0];
+    if (camera_->acquire()) {
+        std::cerr << "Failed to acquire camera" << std::endl;
+        camera_.reset();
+        return false;
+    }
+    return true;
+}
+
+bool LibcameraSource::configure(FrameFormat &format) {
+    if (streaming_) {
+        std::cerr << "Cannot configure the camera while it is streaming" << std::endl;
+        return false;
+    }
+    if (!open()) {
+        return false;
+    }
+    // Buffers of the last configuration go before the camera is reconfigured
+    freeBuffers();
+
+    // Configure camera: the still stream, and a small viewfinder stream and
+    // the raw stream next to it when asked for
+    bool withViewfinder = format.viewfinderWidth > 0;
+    std::vector<StreamRole> roles = {StreamRole::StillCapture};
+    if (withViewfinder) {
+        roles.push_back(StreamRole::Viewfinder);
+    }
+    int rawIndex = -1;
+    if (format.raw) {
+        rawIndex = static_cast<int>(roles.size());
+        roles.push_back(StreamRole::Raw);
+    }
+    config_ = camera_->generateConfiguration(roles);
+    if (!config_ || config_->size() != roles.size()) {
+        std::cerr << "Failed to generate configuration" << std::endl;
+        return false;
+    }
+
+    StreamConfiguration &streamConfig = config_->at(0);
+    streamConfig.size.width = format.width;
+    streamConfig.size.height = format.height;
+    streamConfig.bufferCount = format.bufferCount;
+
+    // The sensor mode the stills are scaled from, e.g. a binned one that
+    // reads out faster
+    if (format.sensorWidth > 0 && format.sensorHeight > 0) {
+        SensorConfiguration sensorConfig;
+        sensorConfig.bitDepth = format.sensorBitDepth;
+        sensorConfig.outputSize = Size(format.sensorWidth, format.sensorHeight);
+        config_->sensorConfig = sensorConfig;
+    }
+
+    if (withViewfinder) {
+        StreamConfiguration &viewfinderConfig = config_->at(1);
+        viewfinderConfig.size.width = format.viewfinderWidth;
+        viewfinderConfig.size.height = format.viewfinderHeight;
+        viewfinderConfig.pixelFormat = formats::YUV420;
+        viewfinderConfig.colorSpace = ColorSpace::Sycc;  // Full range, like the stills
+        viewfinderConfig.bufferCount = format.bufferCount;
+    }
+
+    if (rawIndex >= 0) {
+        // The sensor mode asked for, or the one matching the still.
+        // Compressed raw (Pi 5) cannot go into a DNG, so ask for the same
+        // order unpacked to 16 bits.
+        StreamConfiguration &rawConfig = config_->at(rawIndex);
+        rawConfig.size = config_->sensorConfig ? config_->sensorConfig->outputSize : streamConfig.size;
+        rawConfig.bufferCount = format.bufferCount;
+        std::string name = rawConfig.pixelFormat.toString();
+        if (name.find("PISP_COMP") != std::string::npos) {
+            rawConfig.pixelFormat = PixelFormat::fromString("S" + name.substr(0, 4) + "16");
+        }
+    }
+
+    if (config_->validate() == CameraConfiguration::Invalid) {
+        std::cerr << "Invalid camera configuration" << std::endl;
+        return false;
+    }
+
+    // The encoder takes planar YUV420 straight from the buffers, and so does
+    // the viewfinder
+    for (unsigned int i = 0; i < config_->size(); i++) {
+        if (static_cast<int>(i) != rawIndex && config_->at(i).pixelFormat.toString() != "YUV420") {
+            std::cerr << "Unsupported format for fast encoding: " << config_->at(i).pixelFormat.toString() << std::endl;
+            return false;
+        }
+    }
+
+    if (camera_->configure(config_.get())) {
+        std::cerr << "Failed to configure camera" << std::endl;
+        return false;
+    }
+
+    // Allocate buffers, with the allocator kept across configurations
+    if (!allocator_) {
+        allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+    }
+    stillStream_ = streamConfig.stream();
+    viewfinderStream_ = withViewfinder ? config_->at(1).stream() : nullptr;
+    rawStream_ = nullptr;
+    RawLayout rawLayout;
+    if (rawIndex >= 0) {
+        const StreamConfiguration &rawConfig = config_->at(rawIndex);
+        if (parseRawFormat(rawConfig.pixelFormat.toString(), rawLayout)) {
+            rawLayout.width = static_cast<int>(rawConfig.size.width);
+            rawLayout.height = static_cast<int>(rawConfig.size.height);
+            rawLayout.stride = static_cast<int>(rawConfig.stride);
+            rawStream_ = rawConfig.stream();
+        } else {
+            std::cerr << "Unsupported raw format " << rawConfig.pixelFormat.toString()
+                      << ", capturing without DNGs" << std::endl;
+        }
+    }
+
+    for (Stream *stream : {stillStream_, viewfinderStream_, rawStream_}) {
+        if (stream && allocator_->allocate(stream) < 0) {
+            std::cerr << "Failed to allocate buffers" << std::endl;
+            return false;
+        }
+    }
+
+    // Map buffers once and create requests, each with a buffer of every stream
+    size_t requestCount = allocator_->buffers(stillStream_).size();
+    for (Stream *stream : {viewfinderStream_, rawStream_}) {
+        if (stream) {
+            requestCount = std::min(requestCount, allocator_->buffers(stream).size());
+        }
+    }
+    for (size_t i = 0; i < requestCount; i++) {
+        std::unique_ptr<Request> request = camera_->createRequest();
+        if (!request) {
+            std::cerr << "Failed to create request" << std::endl;
+            return false;
+        }
+        for (Stream *stream : {stillStream_, viewfinderStream_, rawStream_}) {
+            if (!stream) {
+                continue;
+            }
+            FrameBuffer *buffer = allocator_->buffers(stream)[i].get();
+            if (!mapBuffer(buffer)) {
+                std::cerr << "Failed to map buffer" << std::endl;
+                return false;
+            }
+            if (request->addBuffer(stream, buffer)) {
+                std::cerr << "Failed to add buffer to request" << std::endl;
+                return false;
+            }
+        }
+        requests_.push_back(std::move(request));
+    }
+
+    format.width = streamConfig.size.width;
+    format.height = streamConfig.size.height;
+    format.stride = streamConfig.stride;
+    format.bufferCount = static_cast<unsigned int>(requests_.size());
+    if (withViewfinder) {
+        const StreamConfiguration &viewfinderConfig = config_->at(1);
+        format.viewfinderWidth = viewfinderConfig.size.width;
+        format.viewfinderHeight = viewfinderConfig.size.height;
+        viewfinderStride_ = viewfinderConfig.stride;
+    }
+    format.rawLayout = rawStream_ ? rawLayout : RawLayout();
+    if (config_->sensorConfig) {
+        format.sensorWidth = config_->sensorConfig->outputSize.width;
+        format.sensorHeight = config_->sensorConfig->outputSize.height;
+        format.sensorBitDepth = config_->sensorConfig->bitDepth;
+    }
+
+    // A frame rate sets the shortest frame duration. Longer exposures still
+    // stretch frames, up to the longest the camera allows.
+    frameDurationLimits_ = {};
+    if (format.frameRate > 0) {
+        int64_t shortest = static_cast<int64_t>(1e6 / format.frameRate + 0.5);
+        int64_t longest = shortest;
+        auto limits = camera_->controls().find(&controls::FrameDurationLimits);
+        if (limits != camera_->controls().end()) {
+            longest = std::max(shortest, limits->second.max().get<int64_t>());
+        }
+        frameDurationLimits_ = {shortest, longest};
+    }
+    format_ = format;
+    return true;
+}
+
+bool LibcameraSource::start(FrameHandler onFrame, ErrorHandler onError) {
+    onFrame_ = std::move(onFrame);
+    onError_ = std::move(onError);
+
+    // Connect signal and start camera
+    camera_->requestCompleted.connect(this, &LibcameraSource::requestComplete);
+
+    // Set up initial controls
+    ControlList startControls;
+    startControls.set(controls::AeEnable, false);
+    startControls.set(controls::ExposureTime, exposureTimeUs_.load());
+    startControls.set(controls::AnalogueGain, analogueGain_.load());
+    if (frameDurationLimits_[0] > 0) {
+        startControls.set(controls::FrameDurationLimits, Span<const int64_t, 2>(frameDurationLimits_));
+    }
+
+    if (camera_->start(&startControls)) {
+        std::cerr << "Failed to start camera" << std::endl;
+        camera_->requestCompleted.disconnect(this);
+        return false;
+    }
+    streaming_ = true;
+
+    // Queue all requests with controls
+    for (auto &request : requests_) {
+        request->controls().set(controls::AeEnable, false);
+        request->controls().set(controls::ExposureTime, exposureTimeUs_.load());
+        request->controls().set(controls::AnalogueGain, analogueGain_.load());
+        camera_->queueRequest(request.get());
+    }
+    return true;
+}
+
+void LibcameraSource::stop() {
+    {
+        // Not held across camera_->stop(), which waits on the camera thread
+        // that may itself be releasing a frame
+        std::lock_guard<std::mutex> lock(requeueMutex_);
+        if (!streaming_.exchange(false)) {
+            return;
+        }
+    }
+    camera_->stop();
+    camera_->requestCompleted.disconnect(this);
+}
+
+// Drop the streams' requests, mappings and buffers, keeping the camera and
+// the allocator
+void LibcameraSource::freeBuffers() {
+    requests_.clear();
+    unmapBuffers();
+    if (allocator_) {
+        for (Stream *stream : {stillStream_, viewfinderStream_, rawStream_}) {
+            if (stream) {
+                allocator_->free(stream);
+            }
+        }
+    }
+    stillStream_ = nullptr;
+    viewfinderStream_ = nullptr;
+    rawStream_ = nullptr;
+}
+
+void LibcameraSource::release() {
+    freeBuffers();
+    allocator_.reset();
+    if (camera_) {
+        camera_->release();
+        camera_.reset();
+    }
+    if (cameraManager_) {
+        cameraManager_->stop();
+        cameraManager_.reset();
+    }
+    config_.reset();
+}
+
+// Re-queue a request with the current exposure and gain once nobody holds it
+void LibcameraSource::requeue(Request *request) {
+    std::lock_guard<std::mutex> lock(requeueMutex_);
+    if (!streaming_) {
+        return;
+    }
+    request->reuse(Request::ReuseBuffers);
+    request->controls().set(controls::ExposureTime, exposureTimeUs_.load());
+    request->controls().set(controls::AnalogueGain, analogueGain_.load());
+    if (camera_->queueRequest(request) < 0) {
+        onError_("Failed to re-queue request");
+    }
+}
+
+void LibcameraSource::requestComplete(Request *request) {
+    if (request->status() == Request::RequestCancelled) {
+        return;
+    }
+
+    if (request->status() != Request::RequestComplete) {
+        onError_("Camera error detected");
+        return;
+    }
+
+    SourceFrame frame;
+    frame.arrival = std::chrono::steady_clock::now();
+    frame.index = delivered_++;
+    frame.lease = std::shared_ptr<void>(request, [this](void *r) {
+        requeue(static_cast<Request *>(r));
+    });
+
+    if (!imageView(request->findBuffer(stillStream_), format_.width, format_.height, format_.stride, frame.image)) {
+        std::cerr << "No planes in buffer" << std::endl;
+        return;  // Dropping the lease re-queues the request
+    }
+    if (viewfinderStream_ &&
+        !imageView(request->findBuffer(viewfinderStream_), format_.viewfinderWidth,
+                   format_.viewfinderHeight, viewfinderStride_, frame.viewfinder)) {
+        frame.viewfinder = YuvFrame();  // Deliver the still frame without it
+    }
+    if (rawStream_) {
+        auto mapped = mappedBuffers_.find(request->findBuffer(rawStream_));
+        if (mapped != mappedBuffers_.end() && !mapped->second.planes.empty()) {
+            frame.raw.data = mapped->second.planes[0];
+            frame.raw.layout = format_.rawLayout;
+        }
+    }
+
+    // What the frame was really taken with; new controls reach the sensor a
+    // few frames after they are queued
+    const ControlList &metadata = request->metadata();
+    if (auto timestamp = metadata.get(controls::SensorTimestamp)) {
+        frame.exposureStart = fromBoottime(*timestamp);
+    }
+    if (auto exposure = metadata.get(controls::ExposureTime)) {
+        frame.exposureTimeUs = *exposure;
+    }
+    if (auto gain = metadata.get(controls::AnalogueGain)) {
+        frame.analogueGain = *gain;
+    }
+    if (frame.raw.data) {
+        if (auto levels = metadata.get(controls::SensorBlackLevels)) {
+            std::copy(levels->begin(), levels->end(), frame.raw.blackLevels);
+        }
+        if (auto gains = metadata.get(controls::ColourGains)) {
+            std::copy(gains->begin(), gains->end(), frame.raw.colourGains);
+        }
+        if (auto matrix = metadata.get(controls::ColourCorrectionMatrix)) {
+            std::copy(matrix->begin(), matrix->end(), frame.raw.colourMatrix);
+        }
+    }
+
+    onFrame_(frame);
+}
+
+// Point a frame view at the planes of a mapped buffer
+bool LibcameraSource::imageView(const FrameBuffer *buffer, int width, int height, int yStride, YuvFrame &image) const {
+    auto mapped = mappedBuffers_.find(buffer);
+    if (mapped == mappedBuffers_.end() || mapped->second.planes.empty()) {
+        return false;
+    }
+    const std::vector<uint8_t *> &planes = mapped->second.planes;
+
+    image.width = width;
+    image.height = height;
+    image.strides[0] = yStride;
+    image.strides[1] = yStride / 2;
+    image.strides[2] = yStride / 2;
+    image.planes[0] = planes[0];
+    if (planes.size() >= 3) {
+        image.planes[1] = planes[1];
+        image.planes[2] = planes[2];
+    } else {
+        // Single plane - calculate offsets
+        image.planes[1] = planes[0] + yStride * height;
+        image.planes[2] = image.planes[1] + (yStride / 2) * (height / 2);
+    }
+    return true;
+}
+
+// --- Buffer mapping ---
+// Map every plane of a buffer. Planes that share a dmabuf share one mapping.
+bool LibcameraSource::mapBuffer(const FrameBuffer *buffer) {
+    MappedBuffer mapped;
+    std::map<int, uint8_t *> fdBases;
+
+    for (const auto &plane : buffer->planes()) {
+        int fd = plane.fd.get();
+        if (fdBases.count(fd)) {
+            continue;
+        }
+
+        // Cover every plane that lives in this fd
+        size_t length = 0;
+        for (const auto &other : buffer->planes()) {
+            if (other.fd.get() == fd) {
+                length = std::max<size_t>(length, other.offset + other.length);
+            }
+        }
+
+        void *addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            std::cerr << "mmap failed: " << strerror(errno) << std::endl;
+            for (auto &m : mapped.mappings) {
+                munmap(m.first, m.second);
+            }
+            return false;
+        }
+        mapped.mappings.emplace_back(addr, length);
+        fdBases[fd] = static_cast<uint8_t *>(addr);
+    }
+
+    for (const auto &plane : buffer->planes()) {
+        mapped.planes.push_back(fdBases[plane.fd.get()] + plane.offset);
+    }
+
+    mappedBuffers_[buffer] = std::move(mapped);
+    return true;
+}
+
+void LibcameraSource::unmapBuffers() {
+    for (auto &entry : mappedBuffers_) {
+        for (auto &m : entry.second.mappings) {
+            munmap(m.first, m.second);
+        }
+    }
+    mappedBuffers_.clear();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "frame_source.h"
+
+// --- libcamera source ---
+// Streams the first camera's still-capture stream, plus a viewfinder stream
+// and the raw sensor stream when the format asks for them. Every buffer is
+// mapped once up front. A request goes back to the camera, with the current
+// exposure and gain, when its lease is released.
+//
+// The camera stays acquired, with its manager running, from the first
+// configure() until the source is destroyed, so configuring a stopped source
+// again, for another size or sensor mode, only swaps the streams and buffers.
+class LibcameraSource : public FrameSource {
+public:
+    LibcameraSource(int32_t exposureTimeUs, float analogueGain);
+    ~LibcameraSource() override;
+
+    bool configure(FrameFormat &format) override;
+    bool start(FrameHandler onFrame, ErrorHandler onError) override;
+    void stop() override;
+    void setControls(int32_t exposureTimeUs, float analogueGain) override;
+    std::string describe() const override;
+
+private:
+    // Persistent mmaps of one camera buffer
+    struct MappedBuffer {
+        std::vector<std::pair<void *, size_t>> mappings;  // One per distinct dmabuf fd
+        std::vector<uint8_t *> planes;                    // Start of each plane
+    };
+
+    bool open();
+    void freeBuffers();
+    bool mapBuffer(const libcamera::FrameBuffer *buffer);
+    bool imageView(const libcamera::FrameBuffer *buffer, int width, int height, int yStride, YuvFrame &image) const;
+    void unmapBuffers();
+    void release();
+    void requestComplete(libcamera::Request *request);
+    void requeue(libcamera::Request *request);
+
+    std::unique_ptr<libcamera::CameraManager> cameraManager_;
+    std::shared_ptr<libcamera::Camera> camera_;
+    std::unique_ptr<libcamera::CameraConfiguration> config_;
+    std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
+    libcamera::Stream *stillStream_ = nullptr;
+    libcamera::Stream *viewfinderStream_ = nullptr;  // Null without a viewfinder
+    int viewfinderStride_ = 0;
+    libcamera::Stream *rawStream_ = nullptr;  // Null without raw frames
+    std::vector<std::unique_ptr<libcamera::Request>> requests_;
+    std::map<const libcamera::FrameBuffer *, MappedBuffer> mappedBuffers_;
+    FrameFormat format_;
+    std::array<int64_t, 2> frameDurationLimits_{};  // Microseconds, zero for the camera's own
+
+    FrameHandler onFrame_;
+    ErrorHandler onError_;
+    // Held by requeue() across its check and queueRequest, and by stop()
+    // while it clears streaming_, so no request is queued once stop() starts
+    std::mutex requeueMutex_;
+    std::atomic<bool> streaming_{false};
+    std::atomic<int32_t> exposureTimeUs_;
+    std::atomic<float> analogueGain_;
+    uint64_t delivered_ = 0;  // Only touched on the camera thread
+};
@@ -0,0 +1,128 @@
+#include "luma_stats.h"
+
+#include <algorithm>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+struct RowTotals {
+    uint64_t sum = 0;
+    uint32_t clipped = 0;
+    uint32_t shadows = 0;
+};
+
+// Sum, clipped and crushed counts of a row. The per-lane 8-bit counters are
+// folded into the totals every 255 vectors, before they can wrap.
+void scanRow(const uint8_t *row, int count, RowTotals &totals) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    const uint8x16_t high = vdupq_n_u8(LumaStats::CLIP_LEVEL);
+    const uint8x16_t low = vdupq_n_u8(LumaStats::SHADOW_LEVEL);
+    while (i + 16 <= count) {
+        uint32x4_t sum = vdupq_n_u32(0);
+        uint8x16_t clipped = vdupq_n_u8(0);
+        uint8x16_t shadows = vdupq_n_u8(0);
+        for (int n = 0; n < 255 && i + 16 <= count; n++, i += 16) {
+            uint8x16_t v = vld1q_u8(row + i);
+            sum = vpadalq_u16(sum, vpaddlq_u8(v));
+            clipped = vsubq_u8(clipped, vcgeq_u8(v, high));
+            shadows = vsubq_u8(shadows, vcleq_u8(v, low));
+        }
+        uint64x2_t s = vpaddlq_u32(sum);
+        uint64x2_t c = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(clipped)));
+        uint64x2_t d = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(shadows)));
+        totals.sum += vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+        totals.clipped += static_cast<uint32_t>(vgetq_lane_u64(c, 0) + vgetq_lane_u64(c, 1));
+        totals.shadows += static_cast<uint32_t>(vgetq_lane_u64(d, 0) + vgetq_lane_u64(d, 1));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i high = _mm_set1_epi8(static_cast<char>(LumaStats::CLIP_LEVEL));
+    const __m128i low = _mm_set1_epi8(static_cast<char>(LumaStats::SHADOW_LEVEL));
+    while (i + 16 <= count) {
+        __m128i sum = zero;
+        __m128i clipped = zero;
+        __m128i shadows = zero;
+        for (int n = 0; n < 255 && i + 16 <= count; n++, i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+            // Unsigned compares: max(v, high) == v is v >= high
+            clipped = _mm_sub_epi8(clipped, _mm_cmpeq_epi8(_mm_max_epu8(v, high), v));
+            shadows = _mm_sub_epi8(shadows, _mm_cmpeq_epi8(_mm_min_epu8(v, low), v));
+        }
+        __m128i c = _mm_sad_epu8(clipped, zero);
+        __m128i d = _mm_sad_epu8(shadows, zero);
+        totals.sum += static_cast<uint64_t>(_mm_cvtsi128_si32(sum)) +
+                      static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+        totals.clipped += static_cast<uint32_t>(_mm_cvtsi128_si32(c) + _mm_cvtsi128_si32(_mm_srli_si128(c, 8)));
+        totals.shadows += static_cast<uint32_t>(_mm_cvtsi128_si32(d) + _mm_cvtsi128_si32(_mm_srli_si128(d, 8)));
+    }
+#endif
+    for (; i < count; i++) {
+        totals.sum += row[i];
+        totals.clipped += row[i] >= LumaStats::CLIP_LEVEL;
+        totals.shadows += row[i] <= LumaStats::SHADOW_LEVEL;
+    }
+}
+
+}  // namespace
+
+void measureLuma(const YuvFrame &frame, uint32_t maxSamples, LumaStats &stats) {
+    stats = LumaStats();
+    if (!frame.planes[0] || frame.width <= 0 || frame.height <= 0) {
+        return;
+    }
+
+    // Evenly spaced whole rows, so every scan is a contiguous run
+    int rows = std::clamp(static_cast<int>(maxSamples / static_cast<uint32_t>(frame.width)), 1, frame.height);
+    RowTotals totals;
+    // Four interleaved histograms, so runs of equal values do not serialize
+    // on one counter
+    uint32_t histograms[4][LumaStats::BINS] = {};
+    for (int r = 0; r < rows; r++) {
+        int y = static_cast<int>((static_cast<int64_t>(r) * 2 + 1) * frame.height / (2 * rows));
+        const uint8_t *row = frame.planes[0] + static_cast<size_t>(y) * frame.strides[0];
+        scanRow(row, frame.width, totals);
+
+        int x = 0;
+        for (; x + 4 <= frame.width; x += 4) {
+            histograms[0][row[x] >> 2]++;
+            histograms[1][row[x + 1] >> 2]++;
+            histograms[2][row[x + 2] >> 2]++;
+            histograms[3][row[x + 3] >> 2]++;
+        }
+        for (; x < frame.width; x++) {
+            histograms[0][row[x] >> 2]++;
+        }
+    }
+
+    for (int b = 0; b < LumaStats::BINS; b++) {
+        stats.histogram[b] = histograms[0][b] + histograms[1][b] + histograms[2][b] + histograms[3][b];
+    }
+    stats.samples = static_cast<uint32_t>(rows) * static_cast<uint32_t>(frame.width);
+    stats.mean = static_cast<float>(static_cast<double>(totals.sum) / stats.samples);
+    stats.clipped = static_cast<float>(totals.clipped) / stats.samples;
+    stats.shadows = static_cast<float>(totals.shadows) / stats.samples;
+}
+
+float lumaPercentile(const LumaStats &stats, float fraction) {
+    if (stats.samples == 0) {
+        return 0;
+    }
+    double target = static_cast<double>(fraction) * stats.samples;
+    double below = 0;
+    for (int b = 0; b < LumaStats::BINS; b++) {
+        double next = below + stats.histogram[b];
+        if (next >= target && stats.histogram[b] > 0) {
+            // Interpolate within the bin
+            return (b + static_cast<float>((target - below) / stats.histogram[b])) * (256.0f / LumaStats::BINS);
+        }
+        below = next;
+    }
+    return 255;
+}
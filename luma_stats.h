@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+#include "yuv_frame.h"
+
+// --- Luma statistics ---
+// Exposure statistics from the Y plane of a streamed frame: a histogram and
+// the share of clipped and crushed pixels. Whole rows spread evenly over the
+// frame are scanned, as many as fit the sample budget, so a full-size frame
+// costs about as much as a viewfinder one. Counting and summing use NEON or
+// SSE2 when available, with a scalar fallback.
+
+struct LumaStats {
+    static constexpr int BINS = 64;  // Four luma codes per bin
+    static constexpr int CLIP_LEVEL = 250;   // At or above: clipped
+    static constexpr int SHADOW_LEVEL = 8;   // At or below: crushed
+
+    uint32_t histogram[BINS] = {};
+    uint32_t samples = 0;
+    float mean = 0;     // 0-255
+    float clipped = 0;  // Fraction of samples
+    float shadows = 0;
+};
+
+// Scan at most about maxSamples pixels of the frame's Y plane
+void measureLuma(const YuvFrame &frame, uint32_t maxSamples, LumaStats &stats);
+
+// Luma below which `fraction` of the samples lie, from the histogram
+float lumaPercentile(const LumaStats &stats, float fraction);
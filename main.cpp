@@ -1,7 +1,6 @@
 #include <iostream>
 #include <filesystem>
 #include <chrono>
-#include <thread>
 #include <atomic>
 #include <csignal>
 #include <cstdlib>
@@ -12,27 +11,33 @@
 #include <iomanip>
 #include <sstream>
 #include <ctime>
-#include <queue>
+#include <climits>
 #include <mutex>
-#include <condition_variable>
-#include <sys/mman.h>
+#include <memory>
 #include <fcntl.h>
 #include <unistd.h>
 
-#include <libcamera/libcamera.h>
 #include <gpiod.h>
 #include <turbojpeg.h>
-#include <exiv2/exiv2.hpp>
+#include "capture_pipeline.h"
+#include "exif_writer.h"
+#include "exposure_assistant.h"
+#include "frame_selector.h"
+#include "display_service.h"
+#include "event_loop.h"
+#include "latency_trace.h"
+#include "lcd_sink.h"
+#include "libcamera_source.h"
+#include "metrics.h"
+#include "tapes_catalog.h"
+#include "thread_policy.h"
 
 // LCD HAT library (C headers)
 extern "C" {
-#include "DEV_Config.h"
 #include "LCD_1in3.h"
-#include "GUI_Paint.h"
 }
 
 namespace fs = std::filesystem;
-using namespace libcamera;
 using namespace std::chrono;
 
 // --- Configuration ---
@@ -46,59 +51,198 @@ constexpr int EXPOSURE_PIN_250 = 19;  // 1/250 sec
 constexpr int EXPOSURE_PIN_60 = 5;    // 1/60 sec
 constexpr int EXPOSURE_PIN_15 = 6;     // 1/15 sec
 constexpr int EXPOSURE_PIN_2 = 26;    // 1/2 sec
+// Exposure times the pins above select, in the same order
+constexpr int32_t EXPOSURE_PRESETS[] = {1000000 / 250, 1000000 / 60, 1000000 / 15, 1000000 / 2};
 
-// Show recent photo pin
+// Show recent photo pin, and how long the photo stays up
 constexpr int SHOW_PHOTO_PIN = 16;
+constexpr milliseconds REVIEW_DURATION{2000};
+// Live viewfinder on the LCD, from a small second stream next to the still
+// stream. Same 4:3 shape as the stills. Override with MPI_VIEWFINDER=on|off.
+constexpr bool VIEWFINDER = true;
+constexpr int VIEWFINDER_WIDTH = 320;
+constexpr int VIEWFINDER_HEIGHT = 240;
 // Gain cycle pin
 constexpr int GAIN_PIN = 20;
-// constexpr int WIDTH = 2312;
-// constexpr int HEIGHT = 1736;
-// constexpr int WIDTH = 3600;
-// constexpr int HEIGHT = 2400;
-constexpr int WIDTH = 4624;
-constexpr int HEIGHT = 3472;
+// Capture profiles: the still size, the sensor mode it is scaled from, and
+// the rate the camera streams at, which it caps at what the mode can do.
+// Binned modes read out faster, for quicker bursts. Hold the show-photo
+// button and press the gain button to switch to the next profile.
+// Override the one used at startup with MPI_PROFILE=<name>.
+struct CaptureProfile {
+    const char *name;
+    int width, height;
+    int sensorWidth, sensorHeight, sensorBitDepth;
+    double frameRate;
+};
+constexpr CaptureProfile PROFILES[] = {
+    {"full", 4624, 3472, 4624, 3472, 10, 10},
+    {"3x2", 3600, 2400, 4624, 3472, 10, 10},
+    {"binned", 2312, 1736, 2312, 1736, 10, 30},
+};
 constexpr int JPEG_QUALITY = 90;
+// Camera buffers in the capture ring. A captured buffer stays with the encoder
+// until its JPEG is done, so the sensor keeps streaming into the others.
+constexpr unsigned int BUFFER_COUNT = 4;
+// Encoder workers, each encoding a different capture with its own
+// turbojpeg handle. Override with MPI_ENCODER_WORKERS.
+constexpr int ENCODER_WORKERS = 2;
+// Encoded captures that may wait for the storage writer before encoders stall
+constexpr int WRITE_QUEUE_DEPTH = 2;
+// When written files are flushed to the card before being renamed into place.
+// Override with MPI_FSYNC=none|file|dir.
+constexpr FsyncPolicy FSYNC_POLICY = FsyncPolicy::File;
+// Horizontal strips encoded in parallel per frame (0 = one per core)
+constexpr unsigned int JPEG_STRIPS = 0;
+// Burst shooting: a press captures BURST_COUNT frames back to back, or with
+// BURST_HOLD keeps capturing while the shutter is held.
+// Override with MPI_BURST=<count>|hold.
+constexpr int BURST_COUNT = 1;
+constexpr bool BURST_HOLD = false;
+// Captured frames allowed to hold camera buffers at once, and what happens to
+// a new frame at that limit: wait for the encoder, drop the oldest queued
+// frame, take it at half resolution, or copy the oldest queued frame out of
+// its buffer, into QUEUE_MEMORY_MB of memory and then a spill file of up to
+// SPILL_FILE_MB next to the captures.
+// Override with MPI_MAX_IN_FLIGHT, MPI_BACKPRESSURE=block|drop-oldest|reduce-resolution|spill,
+// MPI_QUEUE_MEMORY_MB and MPI_SPILL_FILE_MB.
+constexpr int MAX_IN_FLIGHT = BUFFER_COUNT - 2;
+constexpr Backpressure BACKPRESSURE = Backpressure::Block;
+constexpr int QUEUE_MEMORY_MB = 256;
+constexpr int SPILL_FILE_MB = 2048;
+// Zero shutter lag: keep this many recent frames (in extra camera buffers)
+// and capture the one being exposed at the press. 0 captures the first frame
+// exposed after the press, which is the one to use with a flash.
+// Override with MPI_ZSL=<frames>|off.
+constexpr int ZSL_DEPTH = 0;
+// Also save the sensor's raw frame of each capture as a DNG next to the JPEG,
+// and how many may wait to be written before DNGs are skipped.
+// Override with MPI_RAW=on|off.
+constexpr bool RAW_CAPTURE = false;
+constexpr int RAW_QUEUE_DEPTH = 2;
+// Exposure assistant: luma statistics from every streamed frame (the
+// viewfinder stream when there is one) and a suggested preset, shown as a
+// meter on the viewfinder and logged when it changes. Samples bound the cost
+// on full-size frames. Override with MPI_METER=on|off.
+constexpr bool EXPOSURE_METER = true;
+constexpr uint32_t METER_SAMPLES = 1 << 18;
+// Low-light stacking: a press captures this many consecutive frames, aligns
+// them and saves their average as one less noisy JPEG. Replaces bursts and
+// raw capture while on. Override with MPI_STACK=<frames>|off.
+constexpr int STACK_FRAMES = 0;
+// Deferred encoding: store captures losslessly in SPOOL_DIR, which is much
+// faster than JPEG encoding, and turn them into JPEGs once no capture has been
+// taken for TRANSCODE_IDLE_MS. Override with MPI_DEFER=on|off.
+constexpr bool DEFER_ENCODING = false;
+constexpr int TRANSCODE_IDLE_MS = 3000;
+// Camera watchdog: no frame for this long, or a camera error, closes and
+// reopens the camera without restarting the app, up to
+// CAMERA_RECOVERY_ATTEMPTS times in a row before it exits for systemd to
+// restart it. The camera is closed once captures give its buffers back,
+// checked every CAMERA_RELEASE_POLL for up to CAMERA_RELEASE_TIMEOUT.
+constexpr seconds CAMERA_WATCHDOG_TIMEOUT{5};
+constexpr int CAMERA_RECOVERY_ATTEMPTS = 3;
+constexpr seconds CAMERA_RELEASE_TIMEOUT{10};
+constexpr milliseconds CAMERA_RELEASE_POLL{10};
+// Capture-path threading: SCHED_FIFO for the event loop, which reads the
+// buttons, and for the camera's completion thread, which hands frames to the
+// pipeline; encoder workers on cores of their own; the arenas holding whole
+// frames locked in RAM, optionally on huge pages. Each falls back to the
+// default, with a warning, without the privileges for it (LimitRTPRIO= and
+// LimitMEMLOCK= in mpi.service).
+// Override with MPI_REALTIME=on|off, MPI_PIN_ENCODERS=on|off and
+// MPI_LOCK_MEMORY=huge|on|off.
+constexpr bool REALTIME = true;
+constexpr int EVENT_LOOP_PRIORITY = 20;
+constexpr int CAMERA_THREAD_PRIORITY = 10;
+constexpr bool PIN_ENCODERS = true;
+constexpr bool LOCK_MEMORY = true;
+constexpr bool HUGE_PAGES = false;
+// Runtime metrics: counters, gauges and stage latencies, served as text to
+// every client of METRICS_SOCKET and written to METRICS_FILE every
+// METRICS_INTERVAL. Override the paths with MPI_METRICS_SOCKET and
+// MPI_METRICS_FILE, or set either to off.
+const std::string METRICS_SOCKET = std::string(getenv("HOME")) + "/.mpi_metrics.sock";
+const std::string METRICS_FILE = std::string(getenv("HOME")) + "/.mpi_metrics";
+constexpr seconds METRICS_INTERVAL{10};
 const std::string TAPES_DIR = std::string(getenv("HOME")) + "/tapes";
+const std::string SPOOL_DIR = TAPES_DIR + "/.spool";
 const std::string SHUTTER_CACHE_FILE = std::string(getenv("HOME")) + "/.mpi_shutter_speed";
 
-// --- Capture job for async encoding ---
-struct CaptureJob {
-    std::vector<uint8_t> yuvData;
-    int width;
-    int height;
-    int yStride;
-    int uvStride;
-    std::string path;
-    size_t numPlanes;
-    size_t plane0Offset;
-    size_t plane1Offset;
-    size_t plane2Offset;
-    // EXIF metadata
-    int32_t exposureTimeUs;
-    float analogueGain;
-    std::string timestamp;
-};
-
 // --- Global state ---
-static std::shared_ptr<Camera> camera;
-static std::unique_ptr<CameraManager> cameraManager;
-static std::unique_ptr<CameraConfiguration> config;
-static FrameBufferAllocator *allocator = nullptr;
-static std::vector<std::unique_ptr<Request>> requests;
-static std::atomic<bool> running{true};
+// Camera frames, and the pipeline that turns captured ones into files
+static std::unique_ptr<FrameSource> frameSource;
+static std::unique_ptr<CapturePipeline> pipeline;
+static PipelineSettings pipelineSettings;
 static std::atomic<time_point<steady_clock>> lastPressed{steady_clock::now() - seconds(2)};
-static std::atomic<int> captureCountdown{0};  // Frames to skip before capturing
+static std::atomic<time_point<steady_clock>> shutterPressed{steady_clock::now()};  // Last accepted shutter press
+static std::atomic<bool> capturePending{false};  // Press waiting for its frame
+static std::atomic<int> burstFramesLeft{0};   // Frames still to capture in the current burst
+static int burstCount = BURST_COUNT;
+static bool burstHold = BURST_HOLD;
+static int zslDepth = ZSL_DEPTH;
+static size_t currentProfile = 0;  // Index into PROFILES, only changed on the event loop
+static std::unique_ptr<FrameSelector> frameSelector;  // Only used on the camera thread
 static std::atomic<int32_t> currentExposureTime{static_cast<int32_t>(1e6 / 60)};  // Default 1/60 sec
 static std::atomic<int> currentGainIndex{1};  // Index into gains array (0=2.0, 1=4.0, 2=8.0)
 static constexpr float GAIN_VALUES[] = {2.0f, 4.0f, 8.0f};
 static std::atomic<time_point<steady_clock>> lastFrameTime{steady_clock::now()};  // Watchdog timer
-
-// --- Encoder thread state ---
-static std::thread encoderThread;
-static std::mutex captureMutex;
-static std::condition_variable captureCV;
-static std::queue<CaptureJob> captureQueue;
-static tjhandle tjInstance = nullptr;
+static std::atomic<bool> cameraFailed{false};  // Set by camera errors, handled on the event loop
+static FrameFormat cameraFormat;  // What the camera delivers and the pipeline is sized for
+static bool viewfinderEnabled = VIEWFINDER;
+static bool rawEnabled = RAW_CAPTURE;
+static bool meterEnabled = EXPOSURE_METER;
+static bool realtimeEnabled = REALTIME;
+static std::unique_ptr<ExposureAssistant> exposureAssistant;  // Only used on the camera thread
+
+// --- Events ---
+// The main thread runs the event loop: buttons, signals, the camera watchdog
+// and the LED, and notifications from the camera and writer threads
+static EventLoop eventLoop;
+static EventNotifier cameraEvents;  // Camera thread: first frame, errors
+static EventNotifier savedEvents;   // Writer thread: captures committed
+static EventTimer watchdogTimer;
+static EventTimer releaseTimer;  // Camera recovery: waiting for captures to give buffers back
+static EventTimer ledTimer;
+static EventSignals eventSignals;
+
+// --- Catalog ---
+// Every JPEG and DNG committed to TAPES_DIR, for review and export
+static TapesCatalog tapesCatalog;
+static bool catalogOpen = false;
+
+// --- Display ---
+// The LCD stays open for the life of the app; the display thread draws the
+// viewfinder and reviews on it
+static LcdSink lcdSink;
+static DisplayService display(lcdSink);
+
+// --- Latency tracing ---
+// Per-stage histograms, reported on SIGUSR1 and at shutdown. Set
+// MPI_TRACE_FILE to also write a trace for chrome://tracing or Perfetto.
+static LatencyTrace latencyTrace;
+
+// --- Metrics ---
+// Counted where things happen, on whichever thread; the socket and the
+// snapshot file are served from the event loop
+static Metrics metrics(latencyTrace);
+static MetricsServer metricsServer(metrics);
+static EventTimer metricsTimer;
+static std::string metricsFile;
+
+// --- Startup timing ---
+// Each startup phase is timed, and all of them are reported together once
+// the first frame is in, to show where cold-start time goes
+static const time_point<steady_clock> startupBegin = steady_clock::now();
+static time_point<steady_clock> startupMark = startupBegin;
+static std::string startupPhases;
+
+static void startupPhase(const char *name) {
+    auto now = steady_clock::now();
+    startupPhases += std::string(startupPhases.empty() ? "" : ", ") + name + " " +
+                     std::to_string(duration_cast<milliseconds>(now - startupMark).count()) + " ms";
+    startupMark = now;
+}
 
 // --- Helper functions ---
 std::string getTimestamp() {
@@ -121,6 +265,11 @@ std::string getExifTimestamp() {
     return oss.str();
 }
 
+std::string getEnvString(const char *name, const std::string &fallback) {
+    const char *value = getenv(name);
+    return value ? value : fallback;
+}
+
 void runCommand(const std::string &cmd) {
     std::system(cmd.c_str());
 }
@@ -144,28 +293,240 @@ int32_t loadShutterSpeed() {
     return val;
 }
 
+void loadCaptureSettings() {
+    std::string profile = getEnvString("MPI_PROFILE", PROFILES[0].name);
+    for (size_t i = 0; i < std::size(PROFILES); i++) {
+        if (profile == PROFILES[i].name) {
+            currentProfile = i;
+        }
+    }
+    std::string burst = getEnvString("MPI_BURST", BURST_HOLD ? "hold" : std::to_string(BURST_COUNT));
+    burstHold = burst == "hold";
+    burstCount = burstHold ? 1 : std::max(1, atoi(burst.c_str()));
+    pipelineSettings.directory = TAPES_DIR;
+    pipelineSettings.writeQueueDepth = WRITE_QUEUE_DEPTH;
+    pipelineSettings.jpegStrips = JPEG_STRIPS;
+    pipelineSettings.jpegQuality = JPEG_QUALITY;
+    pipelineSettings.maxInFlight = std::max(1, atoi(getEnvString("MPI_MAX_IN_FLIGHT", std::to_string(MAX_IN_FLIGHT)).c_str()));
+    pipelineSettings.encoderWorkers = std::max(1, atoi(getEnvString("MPI_ENCODER_WORKERS", std::to_string(ENCODER_WORKERS)).c_str()));
+
+    pipelineSettings.fsyncPolicy = FSYNC_POLICY;
+    std::string fsyncSetting = getEnvString("MPI_FSYNC", "");
+    if (fsyncSetting == "none") {
+        pipelineSettings.fsyncPolicy = FsyncPolicy::None;
+    } else if (fsyncSetting == "file") {
+        pipelineSettings.fsyncPolicy = FsyncPolicy::File;
+    } else if (fsyncSetting == "dir") {
+        pipelineSettings.fsyncPolicy = FsyncPolicy::FileAndDir;
+    }
+
+    std::string zsl = getEnvString("MPI_ZSL", std::to_string(ZSL_DEPTH));
+    zslDepth = zsl == "off" ? 0 : std::max(0, atoi(zsl.c_str()));
+
+    std::string viewfinder = getEnvString("MPI_VIEWFINDER", VIEWFINDER ? "on" : "off");
+    viewfinderEnabled = viewfinder != "off";
+
+    std::string raw = getEnvString("MPI_RAW", RAW_CAPTURE ? "on" : "off");
+    rawEnabled = raw != "off";
+    pipelineSettings.rawQueueDepth = RAW_QUEUE_DEPTH;
+
+    std::string stack = getEnvString("MPI_STACK", std::to_string(STACK_FRAMES));
+    int stackFrames = stack == "off" ? 0 : std::clamp(atoi(stack.c_str()), 0, FrameStacker::MAX_FRAMES);
+    pipelineSettings.stackFrames = stackFrames > 1 ? stackFrames : 0;
+    if (pipelineSettings.stackFrames > 0) {
+        burstHold = false;
+        burstCount = pipelineSettings.stackFrames;
+        rawEnabled = false;
+    }
+
+    std::string defer = getEnvString("MPI_DEFER", DEFER_ENCODING ? "on" : "off");
+    pipelineSettings.spoolDirectory = defer != "off" ? SPOOL_DIR : "";
+    pipelineSettings.transcodeIdleMs = TRANSCODE_IDLE_MS;
+
+    std::string meter = getEnvString("MPI_METER", EXPOSURE_METER ? "on" : "off");
+    meterEnabled = meter != "off";
+
+    realtimeEnabled = getEnvString("MPI_REALTIME", REALTIME ? "on" : "off") != "off";
+    pipelineSettings.pinEncoders = getEnvString("MPI_PIN_ENCODERS", PIN_ENCODERS ? "on" : "off") != "off";
+    std::string lockMemory = getEnvString("MPI_LOCK_MEMORY", LOCK_MEMORY ? (HUGE_PAGES ? "huge" : "on") : "off");
+    pipelineSettings.lockMemory = lockMemory != "off";
+    pipelineSettings.hugePages = lockMemory == "huge";
+    std::cout << "Threads: " << (realtimeEnabled ? "real-time event loop and camera thread" : "normal priorities")
+              << ", encoders " << (pipelineSettings.pinEncoders ? "pinned to cores" : "unpinned")
+              << ", frame arenas " << (!pipelineSettings.lockMemory ? "unlocked"
+                                       : pipelineSettings.hugePages ? "locked on huge pages" : "locked")
+              << std::endl;
+
+    pipelineSettings.backpressure = BACKPRESSURE;
+    std::string policy = getEnvString("MPI_BACKPRESSURE", backpressureName(BACKPRESSURE));
+    for (Backpressure p : {Backpressure::Block, Backpressure::DropOldest, Backpressure::ReduceResolution,
+                           Backpressure::Spill}) {
+        if (policy == backpressureName(p)) {
+            pipelineSettings.backpressure = p;
+        }
+    }
+    pipelineSettings.queueMemoryBytes = static_cast<size_t>(std::max(0, atoi(
+        getEnvString("MPI_QUEUE_MEMORY_MB", std::to_string(QUEUE_MEMORY_MB)).c_str()))) << 20;
+    pipelineSettings.spillFileBytes = static_cast<size_t>(std::max(0, atoi(
+        getEnvString("MPI_SPILL_FILE_MB", std::to_string(SPILL_FILE_MB)).c_str()))) << 20;
+    if (pipelineSettings.stackFrames > 0 && pipelineSettings.backpressure == Backpressure::ReduceResolution) {
+        // Every frame of a stack is aligned and added at full size
+        std::cout << "Stacking needs full-size frames, using block backpressure instead of reduce-resolution"
+                  << std::endl;
+        pipelineSettings.backpressure = Backpressure::Block;
+    }
+
+    std::cout << "Burst: " << (pipelineSettings.stackFrames > 0 ? "stack of " + std::to_string(burstCount) + " frames"
+                               : burstHold ? "while held" : std::to_string(burstCount) + " frame(s)")
+              << ", max in flight " << pipelineSettings.maxInFlight
+              << ", backpressure " << backpressureName(pipelineSettings.backpressure)
+              << ", " << pipelineSettings.encoderWorkers << " encoder worker(s)"
+              << (pipelineSettings.spoolDirectory.empty() ? "" : ", deferred encoding")
+              << ", " << (zslDepth > 0 ? "zero shutter lag over " + std::to_string(zslDepth) + " frames"
+                                       : std::string("next frame after press")) << std::endl;
+}
+
+// Exposure and gain for the frames the camera captures from now on
+void applyCameraControls() {
+    if (frameSource) {
+        frameSource->setControls(currentExposureTime.load(), GAIN_VALUES[currentGainIndex.load()]);
+    }
+}
+
+// --- GPIO outputs ---
+// Output pins are requested once through libgpiod, so a toggle is a single
+// ioctl rather than a forked raspi-gpio. Cheap enough for the camera thread,
+// which drives the flash. With the LCD up, the screen and shutter pins belong
+// to the display instead.
+static std::mutex outputMutex;
+static struct gpiod_chip *outputChip = nullptr;
+static struct gpiod_line *ledLine = nullptr;
+static struct gpiod_line *shutterLine = nullptr;
+static struct gpiod_line *screenLine = nullptr;
+
+// Try different chip names (gpiochip4 for Pi 5, gpiochip0 for Pi 4 and earlier)
+struct gpiod_chip *openGpioChip() {
+    const char *chipNames[] = {"gpiochip4", "gpiochip0", "pinctrl-bcm2835", nullptr};
+    for (int i = 0; chipNames[i] != nullptr; i++) {
+        struct gpiod_chip *chip = gpiod_chip_open_by_name(chipNames[i]);
+        if (chip) {
+            std::cout << "Opened GPIO chip: " << chipNames[i] << std::endl;
+            return chip;
+        }
+    }
+    std::cerr << "Failed to open any GPIO chip" << std::endl;
+    return nullptr;
+}
+
+static void requestOutput(struct gpiod_line *&line, int pin, bool high) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    struct gpiod_line *requested = outputChip ? gpiod_chip_get_line(outputChip, pin) : nullptr;
+    if (!requested || gpiod_line_request_output(requested, "picam-output", high ? 1 : 0) < 0) {
+        std::cerr << "Failed to request GPIO output " << pin << " (error: " << strerror(errno) << ")" << std::endl;
+        requested = nullptr;
+    }
+    line = requested;
+}
+
+static void releaseOutput(struct gpiod_line *&line) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    if (line) {
+        gpiod_line_release(line);
+        line = nullptr;
+    }
+}
+
+static void setOutput(struct gpiod_line *const &line, bool high) {
+    std::lock_guard<std::mutex> lock(outputMutex);
+    if (line) {
+        gpiod_line_set_value(line, high ? 1 : 0);
+    }
+}
+
+void releaseOutputLines() {
+    setOutput(ledLine, false);
+    releaseOutput(ledLine);
+    releaseOutput(shutterLine);
+    releaseOutput(screenLine);
+    if (outputChip) {
+        gpiod_chip_close(outputChip);
+        outputChip = nullptr;
+    }
+}
+
 void setLedPin(bool high) {
-    runCommand("raspi-gpio set " + std::to_string(LED_PIN) + (high ? " dh" : " dl"));
+    setOutput(ledLine, high);
+}
+
+// --- LED blinks ---
+// Blink patterns run off a timer on the event loop rather than sleeping, so
+// nothing waits for them. A new pattern replaces one in progress.
+constexpr milliseconds LED_ON_TIME{30};
+constexpr milliseconds LED_OFF_TIME{300};
+static int ledBlinksLeft = 0;  // Only touched on the event loop
+static bool ledLit = false;
+
+static void blinkLed(int count) {
+    ledBlinksLeft = count;
+    ledLit = true;
+    setLedPin(true);
+    ledTimer.arm(LED_ON_TIME);
+}
+
+static void ledTimerExpired() {
+    ledLit = !ledLit;
+    setLedPin(ledLit);
+    if (ledLit) {
+        ledTimer.arm(LED_ON_TIME);
+    } else if (--ledBlinksLeft > 0) {
+        ledTimer.arm(LED_OFF_TIME);
+    }
 }
 
 void setShutterPin(bool high) {
-    runCommand("raspi-gpio set " + std::to_string(SHUTTER_PIN) + (high ? " dh" : " dl"));
+    if (lcdSink.isOpen()) {
+        lcdSink.setSharedPin(high);
+    } else {
+        setOutput(shutterLine, high);
+    }
 }
 
 
 void turnOffScreen() {
-    runCommand("raspi-gpio set 24 op");
-    runCommand("raspi-gpio set 24 dl");
-    runCommand("raspi-gpio set " + std::to_string(SHUTTER_PIN) + " op dh");
-    runCommand("raspi-gpio set " + std::to_string(LED_PIN) + " op");
-    runCommand("raspi-gpio set " + std::to_string(BUTTON_PIN) + " ip pu");
-    runCommand("raspi-gpio set " + std::to_string(SHOW_PHOTO_PIN) + " ip pu");
-    runCommand("raspi-gpio set " + std::to_string(EXPOSURE_PIN_250) + " ip pu");
-    runCommand("raspi-gpio set " + std::to_string(EXPOSURE_PIN_60) + " ip pu");
-    runCommand("raspi-gpio set " + std::to_string(EXPOSURE_PIN_15) + " ip pu");
-    runCommand("raspi-gpio set " + std::to_string(EXPOSURE_PIN_2) + " ip pu");
-    runCommand("raspi-gpio set " + std::to_string(GAIN_PIN) + " ip pu");
-    setLedPin(false);
+    // Claim the outputs: screen off, shutter idle high, LED off. The LCD
+    // library takes the backlight (pin 24) and the HAT's data/command pin,
+    // which is the shutter pin, and keeps them while it runs. Without the
+    // HAT they are plain outputs.
+    outputChip = openGpioChip();
+    requestOutput(ledLine, LED_PIN, false);
+    if (lcdSink.open()) {
+        display.start();
+    } else {
+        requestOutput(screenLine, SCREEN_PIN, false);
+        requestOutput(shutterLine, SHUTTER_PIN, true);
+    }
+
+    // Pull-ups on the inputs, for kernels too old for libgpiod bias flags.
+    // One call for the lot: each fork costs startup time.
+    std::string inputs;
+    for (int pin : {BUTTON_PIN, SHOW_PHOTO_PIN, EXPOSURE_PIN_250, EXPOSURE_PIN_60, EXPOSURE_PIN_15,
+                    EXPOSURE_PIN_2, GAIN_PIN}) {
+        inputs += (inputs.empty() ? "" : ",") + std::to_string(pin);
+    }
+    runCommand("raspi-gpio set " + inputs + " ip pu");
+}
+
+// Blank and close the LCD, reporting how the viewfinder kept up
+void stopDisplay() {
+    if (display.running()) {
+        display.stop();
+        DisplayService::ViewfinderStats stats = display.viewfinderStats();
+        if (stats.offered > 0) {
+            std::cout << "Viewfinder: " << stats.drawn << " of " << stats.offered << " frames drawn, "
+                      << stats.skipped << " skipped" << std::endl;
+        }
+    }
+    lcdSink.close();
 }
 
 
@@ -176,22 +537,22 @@ void setExposureTime(int buttonPin) {
 
     switch (buttonPin) {
         case EXPOSURE_PIN_250:
-            exposureTime = static_cast<int32_t>(1e6 / 250);
+            exposureTime = EXPOSURE_PRESETS[0];
             speedName = "1/250";
             nBlinks = 4;
             break;
         case EXPOSURE_PIN_60:
-            exposureTime = static_cast<int32_t>(1e6 / 60);
+            exposureTime = EXPOSURE_PRESETS[1];
             speedName = "1/60";
             nBlinks = 3;
             break;
         case EXPOSURE_PIN_15:
-            exposureTime = static_cast<int32_t>(1e6 / 15);
+            exposureTime = EXPOSURE_PRESETS[2];
             speedName = "1/15";
             nBlinks = 2;
             break;
         case EXPOSURE_PIN_2:
-            exposureTime = static_cast<int32_t>(1e6 / 2);
+            exposureTime = EXPOSURE_PRESETS[3];
             speedName = "1/2";
             nBlinks = 1;
             break;
@@ -200,13 +561,9 @@ void setExposureTime(int buttonPin) {
 
     }
 
-    for (int x = 0; x < nBlinks; x++) {
-        setLedPin(true);
-        std::this_thread::sleep_for(milliseconds(30));
-        setLedPin(false);
-        std::this_thread::sleep_for(milliseconds(300));
-    }
+    blinkLed(nBlinks);
     currentExposureTime.store(exposureTime);
+    applyCameraControls();
     saveShutterSpeed(exposureTime);
     std::cout << "Exposure set to " << speedName << " sec (" << exposureTime << " us)" << std::endl;
 }
@@ -215,23 +572,97 @@ void cycleAnalogueGain() {
     // Cycle to next gain value
     int newIndex = (currentGainIndex.load() + 1) % 3;
     currentGainIndex.store(newIndex);
+    applyCameraControls();
 
     float gain = GAIN_VALUES[newIndex];
     int nBlinks = newIndex + 1;  // 1 blink for 2.0, 2 for 4.0, 3 for 8.0
+    blinkLed(nBlinks);
 
-    for (int x = 0; x < nBlinks; x++) {
-        setLedPin(true);
-        std::this_thread::sleep_for(milliseconds(30));
-        setLedPin(false);
-        std::this_thread::sleep_for(milliseconds(300));
+    std::cout << "Gain set to " << gain << std::endl;
+}
+
+// --- Review decoding ---
+// Decode `jpeg` to RGB at the smallest turbojpeg scale (down to 1/8) that
+// keeps the short side at least minSize
+static bool decodeScaled(const unsigned char *jpeg, size_t size, int minSize,
+                         std::vector<unsigned char> &rgb, int &width, int &height) {
+    tjhandle tjDecompressor = tjInitDecompress();
+    if (!tjDecompressor) {
+        std::cerr << "Failed to init turbojpeg decompressor" << std::endl;
+        return false;
     }
 
-    std::cout << "Gain set to " << gain << std::endl;
+    int jpegSubsamp, jpegColorspace;
+    if (tjDecompressHeader3(tjDecompressor, jpeg, size, &width, &height, &jpegSubsamp, &jpegColorspace) < 0) {
+        std::cerr << "Failed to read JPEG header: " << tjGetErrorStr2(tjDecompressor) << std::endl;
+        tjDestroy(tjDecompressor);
+        return false;
+    }
+
+    // The DCT does the downscaling, so a 1/8 decode costs a fraction of a full one
+    int numFactors = 0;
+    tjscalingfactor *factors = tjGetScalingFactors(&numFactors);
+    int scaledWidth = width;
+    int scaledHeight = height;
+    for (int i = 0; factors && i < numFactors; i++) {
+        if (factors[i].num * 8 < factors[i].denom) {
+            continue;  // Below 1/8
+        }
+        int w = TJSCALED(width, factors[i]);
+        int h = TJSCALED(height, factors[i]);
+        if (std::min(w, h) >= minSize && w < scaledWidth) {
+            scaledWidth = w;
+            scaledHeight = h;
+        }
+    }
+
+    rgb.resize(static_cast<size_t>(scaledWidth) * scaledHeight * 3);
+    if (tjDecompress2(tjDecompressor, jpeg, size, rgb.data(), scaledWidth, 0, scaledHeight,
+                      TJPF_RGB, TJFLAG_FASTDCT) < 0) {
+        std::cerr << "Failed to decompress JPEG: " << tjGetErrorStr2(tjDecompressor) << std::endl;
+        tjDestroy(tjDecompressor);
+        return false;
+    }
+    tjDestroy(tjDecompressor);
+    width = scaledWidth;
+    height = scaledHeight;
+    return true;
 }
 
-void showMostRecentPhoto() {
-    // Find the most recent .jpg file in TAPES_DIR
-    std::string mostRecent;
+// Decode a capture for the LCD: from its EXIF preview when it has one, which
+// only reads the first few KB of the file
+static bool decodeForReview(const std::string &path, int minSize,
+                            std::vector<unsigned char> &rgb, int &width, int &height) {
+    FILE* jpegFile = fopen(path.c_str(), "rb");
+    if (!jpegFile) {
+        std::cerr << "Failed to open JPEG file" << std::endl;
+        return false;
+    }
+
+    // The EXIF block, preview included, sits in the first 64 KB segment
+    std::vector<unsigned char> jpegBuf(128 * 1024);
+    jpegBuf.resize(fread(jpegBuf.data(), 1, jpegBuf.size(), jpegFile));
+
+    size_t thumbOffset, thumbLength;
+    if (findExifThumbnail(jpegBuf.data(), jpegBuf.size(), thumbOffset, thumbLength) &&
+        decodeScaled(jpegBuf.data() + thumbOffset, thumbLength, minSize, rgb, width, height)) {
+        fclose(jpegFile);
+        return true;
+    }
+
+    // No preview: read the rest and decode at reduced scale
+    fseek(jpegFile, 0, SEEK_END);
+    long jpegSize = ftell(jpegFile);
+    fseek(jpegFile, 0, SEEK_SET);
+    jpegBuf.resize(jpegSize);
+    size_t got = fread(jpegBuf.data(), 1, jpegSize, jpegFile);
+    fclose(jpegFile);
+    std::cout << "No preview in " << path << ", decoding scaled" << std::endl;
+    return decodeScaled(jpegBuf.data(), got, minSize, rgb, width, height);
+}
+
+// Find the most recent .jpg file in TAPES_DIR, without the catalog
+static bool findMostRecentPhoto(std::string &mostRecent) {
     std::filesystem::file_time_type mostRecentTime;
     bool found = false;
 
@@ -248,653 +679,778 @@ void showMostRecentPhoto() {
         }
     } catch (const std::exception& e) {
         std::cerr << "Error scanning tapes directory: " << e.what() << std::endl;
-        return;
+        return false;
     }
 
     if (!found) {
         std::cout << "No photos found in " << TAPES_DIR << std::endl;
-        return;
     }
+    return found;
+}
 
-    std::cout << "Showing: " << mostRecent << std::endl;
-
-    // Read JPEG file
-    FILE* jpegFile = fopen(mostRecent.c_str(), "rb");
-    if (!jpegFile) {
-        std::cerr << "Failed to open JPEG file" << std::endl;
-        return;
+// The catalogued JPEG before `index`, or the newest with npos, skipping
+// files deleted since they were catalogued
+static constexpr int MAX_MISSING_PHOTOS = 32;  // Then give up and list the directory
+
+static bool findCataloguedPhoto(size_t &index, std::string &path) {
+    index = index == TapesCatalog::npos ? tapesCatalog.latest(CatalogKind::Jpeg)
+                                        : tapesCatalog.previous(index, CatalogKind::Jpeg);
+    CatalogEntry entry;
+    for (int missing = 0; missing < MAX_MISSING_PHOTOS && tapesCatalog.entry(index, entry); missing++) {
+        path = tapesCatalog.path(entry);
+        if (access(path.c_str(), F_OK) == 0) {
+            return true;
+        }
+        index = tapesCatalog.previous(index, CatalogKind::Jpeg);
     }
+    return false;
+}
 
-    fseek(jpegFile, 0, SEEK_END);
-    long jpegSize = ftell(jpegFile);
-    fseek(jpegFile, 0, SEEK_SET);
-
-    std::vector<unsigned char> jpegBuf(jpegSize);
-    fread(jpegBuf.data(), 1, jpegSize, jpegFile);
-    fclose(jpegFile);
-
-    // Decode JPEG
-    tjhandle tjDecompressor = tjInitDecompress();
-    if (!tjDecompressor) {
-        std::cerr << "Failed to init turbojpeg decompressor" << std::endl;
-        return;
-    }
+// Post the most recent photo to the LCD, or while a review is up, the one
+// before the photo shown. The catalog names it at once; decoding happens on
+// the display thread, so the event loop is free again at once.
+static size_t reviewIndex = TapesCatalog::npos;  // Catalog entry last shown
+static time_point<steady_clock> reviewShownAt;
 
-    int imgWidth, imgHeight, jpegSubsamp, jpegColorspace;
-    if (tjDecompressHeader3(tjDecompressor, jpegBuf.data(), jpegSize,
-                            &imgWidth, &imgHeight, &jpegSubsamp, &jpegColorspace) < 0) {
-        std::cerr << "Failed to read JPEG header: " << tjGetErrorStr2(tjDecompressor) << std::endl;
-        tjDestroy(tjDecompressor);
+void showMostRecentPhoto() {
+    if (!display.running()) {
+        std::cout << "No LCD, not showing photo" << std::endl;
         return;
     }
 
-    // Decode to RGB
-    std::vector<unsigned char> rgbBuf(imgWidth * imgHeight * 3);
-    if (tjDecompress2(tjDecompressor, jpegBuf.data(), jpegSize,
-                      rgbBuf.data(), imgWidth, 0, imgHeight, TJPF_RGB, TJFLAG_FASTDCT) < 0) {
-        std::cerr << "Failed to decompress JPEG: " << tjGetErrorStr2(tjDecompressor) << std::endl;
-        tjDestroy(tjDecompressor);
-        return;
+    auto now = steady_clock::now();
+    if (now - reviewShownAt >= REVIEW_DURATION) {
+        reviewIndex = TapesCatalog::npos;
     }
-    tjDestroy(tjDecompressor);
-
-    // Initialize LCD module
-    if (DEV_ModuleInit() != 0) {
-        std::cerr << "Failed to init LCD module" << std::endl;
-        return;
+    reviewShownAt = now;
+    bool older = reviewIndex != TapesCatalog::npos;
+    std::string path;
+    if (catalogOpen && !findCataloguedPhoto(reviewIndex, path)) {
+        path.clear();
+        if (older) {
+            std::cout << "No older photos" << std::endl;
+            return;
+        }
+        // None catalogued that is still there: list the directory
     }
 
-    // Turn on screen backlight (pin 24)
-    runCommand("raspi-gpio set 24 op dh");
+    display.show([path](std::vector<unsigned char> &rgb, int &width, int &height) {
+        std::string photo = path;
+        if (photo.empty() && !findMostRecentPhoto(photo)) {
+            return false;
+        }
+        std::cout << "Showing: " << photo << std::endl;
 
-    // Initialize LCD
-    LCD_1IN3_Init(HORIZONTAL);
-    LCD_1IN3_Clear(BLACK);
-    LCD_SetBacklight(1023);
+        // A screen-sized image: the embedded preview if there is one,
+        // otherwise a scaled-down decode of the full image
+        return decodeForReview(photo, LCD_1IN3_WIDTH, rgb, width, height);
+    }, REVIEW_DURATION);
+}
 
-    // Allocate LCD image buffer
-    UWORD* lcdImage = (UWORD*)malloc(LCD_1IN3_WIDTH * LCD_1IN3_HEIGHT * sizeof(UWORD));
-    if (!lcdImage) {
-        std::cerr << "Failed to allocate LCD buffer" << std::endl;
-        DEV_ModuleExit();
-        return;
+// --- Burst ---
+// Count one captured frame against the current burst
+static void takeBurstFrame() {
+    int left = burstFramesLeft.load();
+    while (left > 0 && !burstFramesLeft.compare_exchange_weak(left, left - 1)) {
     }
+}
 
-    Paint_NewImage(lcdImage, LCD_1IN3_WIDTH, LCD_1IN3_HEIGHT, 0, BLACK, 16);
-    Paint_Clear(BLACK);
-
-    // Scale image to fit 240x240 (center crop to square, then scale)
-    int srcSize = std::min(imgWidth, imgHeight);
-    int srcX = (imgWidth - srcSize) / 2;
-    int srcY = (imgHeight - srcSize) / 2;
-
-    // Simple nearest-neighbor scaling to 240x240 with 90° clockwise rotation
-    for (int y = 0; y < LCD_1IN3_HEIGHT; y++) {
-        for (int x = 0; x < LCD_1IN3_WIDTH; x++) {
-            // 90° clockwise: sample from (y, height-1-x) in scaled space
-            int srcPx = srcX + (y * srcSize) / LCD_1IN3_HEIGHT;
-            int srcPy = srcY + ((LCD_1IN3_WIDTH - 1 - x) * srcSize) / LCD_1IN3_WIDTH;
-            int srcIdx = (srcPy * imgWidth + srcPx) * 3;
-
-            unsigned char r = rgbBuf[srcIdx];
-            unsigned char g = rgbBuf[srcIdx + 1];
-            unsigned char b = rgbBuf[srcIdx + 2];
-
-            // Convert to RGB565
-            UWORD color = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
-            Paint_SetPixel(x, y, color);
-        }
+// --- Exposure meter ---
+static std::string shutterName(int32_t exposureTimeUs) {
+    if (exposureTimeUs >= 1000000) {
+        return std::to_string(exposureTimeUs / 1000000) + " s";
     }
-
-    // Display on LCD
-    LCD_1IN3_Display(lcdImage);
-
-    // Wait 2 seconds
-    DEV_Delay_ms(2000);
-
-    // Clear and turn off
-    LCD_1IN3_Clear(BLACK);
-    LCD_SetBacklight(0);
-
-    free(lcdImage);
-    DEV_ModuleExit();
-
-    // Turn off screen backlight
-    runCommand("raspi-gpio set 24 op dl");
+    return "1/" + std::to_string((1000000 + exposureTimeUs / 2) / exposureTimeUs) + " s";
 }
 
-void writeExifMetadata(const std::string& filepath, const CaptureJob& job) {
-    try {
-        auto image = Exiv2::ImageFactory::open(filepath);
-        if (!image.get()) {
-            std::cerr << "Failed to open image for EXIF: " << filepath << std::endl;
-            return;
-        }
-
-        image->readMetadata();
-        Exiv2::ExifData& exifData = image->exifData();
-
-        // Dimensions
-        exifData["Exif.Photo.PixelXDimension"] = static_cast<uint32_t>(job.width);
-        exifData["Exif.Photo.PixelYDimension"] = static_cast<uint32_t>(job.height);
-
-        // Exposure time (microseconds -> rational seconds)
-        exifData["Exif.Photo.ExposureTime"] = Exiv2::URational(job.exposureTimeUs, 1000000);
-
-        // ISO = gain * 100
-        exifData["Exif.Photo.ISOSpeedRatings"] = static_cast<uint16_t>(job.analogueGain * 100);
-
-        // Timestamps
-        exifData["Exif.Photo.DateTimeOriginal"] = job.timestamp;
-        exifData["Exif.Photo.DateTimeDigitized"] = job.timestamp;
-
-        // Camera identification
-        exifData["Exif.Image.Make"] = "Raspberry Pi";
-        exifData["Exif.Image.Model"] = "MPI Camera";
-
-        image->writeMetadata();
-    } catch (const Exiv2::Error& e) {
-        std::cerr << "EXIF error: " << e.what() << std::endl;
+// Measure a streamed frame and update the suggestion on the viewfinder.
+// Runs on the camera thread, well under a millisecond per frame.
+static void meterFrame(const SourceFrame &frame) {
+    const YuvFrame &image = frame.viewfinder.planes[0] ? frame.viewfinder : frame.image;
+    LumaStats stats;
+    measureLuma(image, METER_SAMPLES, stats);
+
+    int32_t exposure = frame.exposureTimeUs > 0 ? frame.exposureTimeUs : currentExposureTime.load();
+    float gain = frame.analogueGain > 0 ? frame.analogueGain : GAIN_VALUES[currentGainIndex.load()];
+    ExposureSuggestion suggestion = exposureAssistant->update(stats, exposure, gain);
+    if (!suggestion.valid) {
+        return;
+    }
+    display.setExposureMeter(suggestion.ev, suggestion.clipping);
+
+    static int32_t suggestedExposure = 0;
+    static float suggestedGain = 0;
+    if (suggestion.exposureTimeUs != suggestedExposure || suggestion.analogueGain != suggestedGain) {
+        suggestedExposure = suggestion.exposureTimeUs;
+        suggestedGain = suggestion.analogueGain;
+        std::cout << std::fixed << std::setprecision(1) << "Meter: mean " << stats.mean << ", "
+                  << stats.clipped * 100 << "% clipped, " << stats.shadows * 100 << "% shadows; suggest "
+                  << shutterName(suggestedExposure) << " at gain " << suggestedGain << " ("
+                  << std::showpos << suggestion.ev << std::noshowpos << " EV)" << std::defaultfloat << std::endl;
     }
 }
 
-// --- Encoder thread function ---
-void encoderThreadFunc() {
-    while (true) {
-        CaptureJob job;
-        {
-            std::unique_lock<std::mutex> lock(captureMutex);
-            captureCV.wait(lock, [] { return !captureQueue.empty() || !running; });
+// --- Frame callback ---
+// Runs on the camera thread for every frame. Frames that are neither captured
+// nor kept in the zero shutter lag ring go back to the camera as soon as this
+// returns.
+static void frameArrived(const SourceFrame &frame) {
+    // Update watchdog timer
+    lastFrameTime.store(frame.arrival);
+    metrics.add(Counter::FramesDelivered);
+    static bool firstFrame = true;
+    if (firstFrame) {
+        firstFrame = false;
+        cameraEvents.notify();  // For the startup report
+    }
 
-            if (!running && captureQueue.empty()) {
-                break;
-            }
+    // Hand the viewfinder image to the display: a copy, or a skip if the
+    // display is busy with the last one, so it never holds up a capture
+    if (frame.viewfinder.planes[0]) {
+        display.offerViewfinder(frame.viewfinder);
+    }
+    if (exposureAssistant) {
+        meterFrame(frame);
+    }
 
-            job = std::move(captureQueue.front());
-            captureQueue.pop();
+    static thread_local bool traceNamed = false;
+    if (!traceNamed) {
+        latencyTrace.nameThread("camera");
+        if (realtimeEnabled) {
+            setRealtimePriority("Camera thread", CAMERA_THREAD_PRIORITY);
         }
+        traceNamed = true;
+    }
 
-        // Encode using turbojpeg
-        const uint8_t *yPlane = job.yuvData.data() + job.plane0Offset;
-        const uint8_t *uPlane = job.yuvData.data() + job.plane1Offset;
-        const uint8_t *vPlane = job.yuvData.data() + job.plane2Offset;
-
-        // Build planar YUV buffer for turbojpeg (I420 format)
-        // turbojpeg expects contiguous planes without padding
-        int ySize = job.width * job.height;
-        int uvSize = (job.width / 2) * (job.height / 2);
-        std::vector<uint8_t> yuvPlanar(ySize + uvSize * 2);
-
-        // Copy Y plane (removing stride padding)
-        for (int y = 0; y < job.height; y++) {
-            std::memcpy(&yuvPlanar[y * job.width], &yPlane[y * job.yStride], job.width);
+    frameSelector->push(frame);
+
+    // A press takes the frame the selector picks for it, plus any newer
+    // frames it kept, for a burst. The rest of a burst is then captured back
+    // to back.
+    std::vector<SourceFrame> frames;
+    if (capturePending.load()) {
+        FrameSelector::Press press;
+        press.at = shutterPressed.load();
+        press.exposureTimeUs = currentExposureTime.load();
+        press.analogueGain = GAIN_VALUES[currentGainIndex.load()];
+        frames = frameSelector->select(press, frame);
+        if (frames.empty()) {
+            latencyTrace.mark("waiting frame", frame.arrival);
+            metrics.add(Counter::FramesWaiting);
+            return;
         }
+    } else if (burstFramesLeft.load() > 0) {
+        frames.push_back(frame);
+    } else {
+        return;
+    }
 
-        // Copy U plane
-        uint8_t *uDst = yuvPlanar.data() + ySize;
-        for (int y = 0; y < job.height / 2; y++) {
-            std::memcpy(&uDst[y * (job.width / 2)], &uPlane[y * job.uvStride], job.width / 2);
+    bool firstOfBurst = capturePending.load();
+    for (const SourceFrame &chosen : frames) {
+        if (!firstOfBurst && burstFramesLeft.load() <= 0) {
+            break;
         }
 
-        // Copy V plane
-        uint8_t *vDst = uDst + uvSize;
-        for (int y = 0; y < job.height / 2; y++) {
-            std::memcpy(&vDst[y * (job.width / 2)], &vPlane[y * job.uvStride], job.width / 2);
+        bool reduced = false;
+        if (!pipeline->admit(reduced)) {
+            // Encoder backlog is full: keep the press pending and retry on the
+            // next frame, which selects again
+            metrics.add(Counter::CapturesBlocked);
+            return;
         }
 
-        // Compress to JPEG
-        unsigned char *jpegBuf = nullptr;
-        unsigned long jpegSize = 0;
-
-        int result = tjCompressFromYUV(
-            tjInstance,
-            yuvPlanar.data(),
-            job.width,
-            1,  // pad (1 = no padding since we removed it)
-            job.height,
-            TJSAMP_420,
-            &jpegBuf,
-            &jpegSize,
-            JPEG_QUALITY,
-            TJFLAG_FASTDCT
-        );
-
-        if (result == 0 && jpegBuf) {
-            // Write to file
-            FILE *outfile = fopen(job.path.c_str(), "wb");
-            if (outfile) {
-                fwrite(jpegBuf, 1, jpegSize, outfile);
-                fclose(outfile);
-                std::cout << "Saved: " << job.path << " (" << jpegSize / 1024 << " KB)" << std::endl;
-                writeExifMetadata(job.path, job);
-                setLedPin(true);
-                std::this_thread::sleep_for(milliseconds(30));
-                setLedPin(false);
-            } else {
-                std::cerr << "Failed to open output file: " << job.path << std::endl;
-            }
-            tjFree(jpegBuf);
-        } else {
-            std::cerr << "JPEG encoding failed: " << tjGetErrorStr2(tjInstance) << std::endl;
+        CaptureInfo info;
+        info.name = "mpi_" + getTimestamp();
+        info.exposureTimeUs = chosen.exposureTimeUs > 0 ? chosen.exposureTimeUs : currentExposureTime.load();
+        info.analogueGain = chosen.analogueGain > 0 ? chosen.analogueGain : GAIN_VALUES[currentGainIndex.load()];
+        info.timestamp = getExifTimestamp();
+        info.shutterTime = firstOfBurst ? shutterPressed.load() : chosen.arrival;
+
+        // Stacked frames are added at full size as they arrive, and the
+        // burst counts them off
+        uint64_t sequence = pipelineSettings.stackFrames > 0
+            ? pipeline->submitStacked(chosen, burstCount - burstFramesLeft.load(), std::move(info))
+            : pipeline->submit(chosen, reduced, std::move(info));
+        metrics.add(Counter::CapturesAccepted);
+        if (firstOfBurst) {
+            // Press to having the frame in hand, which with zero shutter lag
+            // can be before the press was read
+            auto selected = steady_clock::now();
+            latencyTrace.record(LatencyStage::PressToFrame, sequence, shutterPressed.load(), selected);
+            auto offset = duration_cast<milliseconds>(chosen.exposureStart - shutterPressed.load()).count();
+            std::cout << "Frame " << chosen.index << " exposed from " << offset << " ms after the press" << std::endl;
+            setShutterPin(true);
+            capturePending.store(false);
+            firstOfBurst = false;
         }
+        takeBurstFrame();
     }
+    frameSelector->clear();
 }
 
-// --- Request completed callback ---
-static void requestComplete(Request *request) {
-    if (request->status() == Request::RequestCancelled) {
-        return;
-    }
+// File committed: have the event loop blink the LED, so the writer thread
+// goes straight on to the next file
+static std::mutex savedMutex;
+static std::vector<std::pair<uint64_t, time_point<steady_clock>>> savedCaptures;  // Guarded by savedMutex
 
-    // Check for camera errors - exit so systemd can restart
-    if (request->status() != Request::RequestComplete) {
-        std::cerr << "Camera error detected, exiting..." << std::endl;
-        running = false;
-        captureCV.notify_all();
+static void captureSaved(uint64_t sequence, const WriteResult &result) {
+    if (!result.ok) {
         return;
     }
+    {
+        std::lock_guard<std::mutex> lock(savedMutex);
+        savedCaptures.emplace_back(sequence, steady_clock::now());
+    }
+    savedEvents.notify();
+}
 
-    // Update watchdog timer
-    lastFrameTime.store(steady_clock::now());
-
-    // Countdown mechanism: skip frames to get a fresh, fully-exposed one
-    int countdown = captureCountdown.load();
-    if (countdown > 0) {
-        int prev = captureCountdown.fetch_sub(1);
-        if (prev > 1) {
-            if (prev == 2) {
-                // Next frame is the capture frame — fire flash now
-                setShutterPin(false);
-            }
-            // Still counting down, skip this frame
-            request->reuse(Request::ReuseBuffers);
-            camera->queueRequest(request);
-            return;
-        }
-        // countdown reached 1, capture this frame (falls through)
-        const auto &buffers = request->buffers();
-        for (auto &bufferPair : buffers) {
-            const Stream *stream = bufferPair.first;
-            FrameBuffer *buffer = bufferPair.second;
-            const auto &planes = buffer->planes();
-
-            if (planes.empty()) {
-                std::cerr << "No planes in buffer" << std::endl;
-                continue;
-            }
-
-            // Get stream configuration
-            const StreamConfiguration &streamConfig = stream->configuration();
-            int width = streamConfig.size.width;
-            int height = streamConfig.size.height;
-            int yStride = streamConfig.stride;
-            std::string formatStr = streamConfig.pixelFormat.toString();
-
-            // Only support YUV420 for now (most common on Pi)
-            if (formatStr != "YUV420") {
-                std::cerr << "Unsupported format for fast encoding: " << formatStr << std::endl;
-                continue;
-            }
-
-            std::cout << "Capture: " << width << "x" << height << " (queuing for encoding)" << std::endl;
-
-            // Calculate total buffer size
-            size_t totalSize = 0;
-            for (const auto &plane : planes) {
-                size_t planeEnd = plane.offset + plane.length;
-                if (planeEnd > totalSize) totalSize = planeEnd;
-            }
-
-            // Map buffer
-            void *mappedBuffer = mmap(nullptr, totalSize, PROT_READ, MAP_SHARED,
-                                       planes[0].fd.get(), 0);
-            if (mappedBuffer == MAP_FAILED) {
-                std::cerr << "mmap failed: " << strerror(errno) << std::endl;
-                continue;
-            }
-
-            // Create capture job and copy data
-            CaptureJob job;
-            job.width = width;
-            job.height = height;
-            job.yStride = yStride;
-            job.uvStride = yStride / 2;
-            job.path = TAPES_DIR + "/mpi_" + getTimestamp() + ".jpg";
-            job.exposureTimeUs = currentExposureTime.load();
-            job.analogueGain = GAIN_VALUES[currentGainIndex.load()];
-            job.timestamp = getExifTimestamp();
-            job.numPlanes = planes.size();
-            job.yuvData.resize(totalSize);
-            std::memcpy(job.yuvData.data(), mappedBuffer, totalSize);
-            setShutterPin(true);
-
-            // Set plane offsets
-            job.plane0Offset = planes[0].offset;
-            if (planes.size() >= 3) {
-                job.plane1Offset = planes[1].offset;
-                job.plane2Offset = planes[2].offset;
-            } else if (planes.size() == 1) {
-                // Single plane - calculate offsets
-                job.plane1Offset = yStride * height;
-                job.plane2Offset = job.plane1Offset + (yStride / 2) * (height / 2);
-            }
-
-            munmap(mappedBuffer, totalSize);
+static void capturesSaved() {
+    std::vector<std::pair<uint64_t, time_point<steady_clock>>> saved;
+    {
+        std::lock_guard<std::mutex> lock(savedMutex);
+        saved.swap(savedCaptures);
+    }
+    blinkLed(1);
+    auto lit = steady_clock::now();
+    for (const auto &capture : saved) {
+        latencyTrace.record(LatencyStage::LedAck, capture.first, capture.second, lit);
+    }
+}
 
-            // Queue job for encoding thread
-            {
-                std::lock_guard<std::mutex> lock(captureMutex);
-                captureQueue.push(std::move(job));
-            }
-            captureCV.notify_one();
+// Runs on the writer threads as each JPEG or DNG is renamed into place
+static void captureCommitted(const WriteResult &result, const CaptureInfo &info) {
+    CatalogEntry entry = catalogEntry(result.path, result.bytes, result.hash);
+    snprintf(entry.captureTime, sizeof(entry.captureTime), "%s", info.timestamp.c_str());
+    entry.exposureTimeUs = info.exposureTimeUs;
+    entry.analogueGain = info.analogueGain;
+    tapesCatalog.append(entry);
+}
 
-        }
+// --- Camera setup ---
+static void cameraError(const std::string &error) {
+    metrics.add(Counter::CameraErrors);
+    if (!cameraFailed.exchange(true)) {
+        std::cerr << error << ", recovering camera..." << std::endl;
+        cameraEvents.notify();
     }
+}
 
-    // Re-queue the request with current exposure and gain
-    request->reuse(Request::ReuseBuffers);
-    request->controls().set(controls::ExposureTime, currentExposureTime.load());
-    request->controls().set(controls::AnalogueGain, GAIN_VALUES[currentGainIndex.load()]);
-    if (camera->queueRequest(request) < 0) {
-        std::cerr << "Failed to re-queue request, exiting..." << std::endl;
-        running = false;
-        captureCV.notify_all();
+// What to ask the camera for in a profile
+static FrameFormat profileFormat(const CaptureProfile &profile) {
+    FrameFormat format;
+    format.width = profile.width;
+    format.height = profile.height;
+    format.sensorWidth = profile.sensorWidth;
+    format.sensorHeight = profile.sensorHeight;
+    format.sensorBitDepth = profile.sensorBitDepth;
+    format.frameRate = profile.frameRate;
+    // The selector's ring holds buffers of its own
+    format.bufferCount = BUFFER_COUNT + zslDepth;
+    if (viewfinderEnabled && display.running()) {
+        format.viewfinderWidth = VIEWFINDER_WIDTH;
+        format.viewfinderHeight = VIEWFINDER_HEIGHT;
     }
+    format.raw = rawEnabled;
+    return format;
 }
 
-// --- Camera cleanup ---
-void cleanupCamera() {
-    if (camera) {
-        camera->stop();
-        camera->requestCompleted.disconnect(requestComplete);
-        camera->release();
-        camera.reset();
-    }
-    if (allocator) {
-        delete allocator;
-        allocator = nullptr;
+static void logProfile(const FrameFormat &format) {
+    std::cout << "Profile " << PROFILES[currentProfile].name << ": " << format.width << "x" << format.height;
+    if (format.sensorWidth > 0) {
+        std::cout << " from a " << format.sensorWidth << "x" << format.sensorHeight << " "
+                  << format.sensorBitDepth << "-bit sensor mode";
     }
-    requests.clear();
-    if (cameraManager) {
-        cameraManager->stop();
-        cameraManager.reset();
+    if (format.frameRate > 0) {
+        std::cout << ", up to " << format.frameRate << " fps";
     }
-    config.reset();
+    std::cout << std::endl;
 }
 
-// --- Camera setup ---
+// Open the camera and configure it for the current profile
+static bool openCamera(FrameFormat &format) {
+    frameSource = std::make_unique<LibcameraSource>(currentExposureTime.load(),
+                                                    GAIN_VALUES[currentGainIndex.load()]);
+    format = profileFormat(PROFILES[currentProfile]);
+    return frameSource->configure(format);
+}
+
+// Configure the camera, size the pipeline for its stream and start streaming
 bool setupCamera() {
-    cameraManager = std::make_unique<CameraManager>();
-    if (cameraManager->start()) {
-        std::cerr << "Failed to start camera manager" << std::endl;
-        return false;
+    frameSelector = std::make_unique<FrameSelector>(zslDepth);
+    if (meterEnabled) {
+        exposureAssistant = std::make_unique<ExposureAssistant>(
+            std::vector<int32_t>(std::begin(EXPOSURE_PRESETS), std::end(EXPOSURE_PRESETS)),
+            std::vector<float>(std::begin(GAIN_VALUES), std::end(GAIN_VALUES)));
     }
-
-    if (cameraManager->cameras().empty()) {
-        std::cerr << "No cameras found" << std::endl;
+    FrameFormat format;
+    if (!openCamera(format)) {
         return false;
     }
-
-    camera = cameraManager->cameras()[0];
-    if (camera->acquire()) {
-        std::cerr << "Failed to acquire camera" << std::endl;
-        return false;
+    cameraFormat = format;
+    display.setViewfinder(format.viewfinderWidth > 0);
+    startupPhase("camera");
+
+    pipeline = std::make_unique<CapturePipeline>(pipelineSettings, latencyTrace, metrics);
+    pipeline->onSaved = captureSaved;
+    if (catalogOpen) {
+        pipeline->onCommitted = captureCommitted;
     }
-
-    // Configure camera
-    config = camera->generateConfiguration({StreamRole::StillCapture});
-    if (!config) {
-        std::cerr << "Failed to generate configuration" << std::endl;
+    if (!pipeline->start(format)) {
         return false;
     }
+    startupPhase("pipeline");
 
-    StreamConfiguration &streamConfig = config->at(0);
-    streamConfig.size.width = WIDTH;
-    streamConfig.size.height = HEIGHT;
-    streamConfig.bufferCount = 1;
-
-    if (config->validate() == CameraConfiguration::Invalid) {
-        std::cerr << "Invalid camera configuration" << std::endl;
+    if (!frameSource->start(frameArrived, cameraError)) {
         return false;
     }
+    startupPhase("stream start");
 
-    if (camera->configure(config.get())) {
-        std::cerr << "Failed to configure camera" << std::endl;
-        return false;
+    std::cout << "Camera initialized: " << format.width << "x" << format.height
+              << " (" << format.bufferCount << " buffers, " << pipeline->jpegStrips() << " JPEG strips)" << std::endl;
+    logProfile(format);
+    if (format.viewfinderWidth > 0) {
+        std::cout << "Viewfinder: " << format.viewfinderWidth << "x" << format.viewfinderHeight << std::endl;
+    }
+    if (format.rawLayout.width > 0) {
+        std::cout << "Raw: " << format.rawLayout.width << "x" << format.rawLayout.height << ", "
+                  << format.rawLayout.bits << " bits, saved as DNG" << std::endl;
     }
+    return true;
+}
 
-    // Allocate buffers
-    allocator = new FrameBufferAllocator(camera);
-    Stream *stream = streamConfig.stream();
+// --- Camera recovery ---
+// Bring the camera back after an error or a stall without restarting the
+// app: the pipeline keeps encoding and writing. The camera is stopped, then
+// closed once no capture holds one of its buffers, which the watchdog polls
+// for on the event loop so buttons are handled meanwhile, then opened and
+// started again. A press or burst in progress carries on with the frames
+// after it.
+static bool recovering = false;  // From beginRecovery() until finishRecovery() or giving up
+static time_point<steady_clock> recoveryStart;
+
+void beginRecovery() {
+    recovering = true;
+    recoveryStart = steady_clock::now();
+    frameSource->stop();
+    frameSelector->clear();
+}
+
+bool finishRecovery() {
+    NormalPriorityScope normalPriority;  // The threads started here must not inherit SCHED_FIFO
+    auto released = steady_clock::now();
+    frameSource.reset();
 
-    if (allocator->allocate(stream) < 0) {
-        std::cerr << "Failed to allocate buffers" << std::endl;
+    FrameFormat format;
+    if (!openCamera(format)) {
+        std::cerr << "Failed to reopen the camera" << std::endl;
         return false;
     }
-
-    // Create requests
-    for (const std::unique_ptr<FrameBuffer> &buffer : allocator->buffers(stream)) {
-        std::unique_ptr<Request> request = camera->createRequest();
-        if (!request) {
-            std::cerr << "Failed to create request" << std::endl;
-            return false;
-        }
-        if (request->addBuffer(stream, buffer.get())) {
-            std::cerr << "Failed to add buffer to request" << std::endl;
+    // Resize the pipeline only if the camera came back with another format
+    if (format.width != cameraFormat.width || format.height != cameraFormat.height ||
+        format.rawLayout.width != cameraFormat.rawLayout.width ||
+        format.rawLayout.stride != cameraFormat.rawLayout.stride) {
+        cameraFormat = FrameFormat();  // A failed restart is retried next time
+        pipeline->stop();
+        if (!pipeline->start(format)) {
             return false;
         }
-        requests.push_back(std::move(request));
     }
-
-    // Connect signal and start camera
-    camera->requestCompleted.connect(requestComplete);
-
-    // Set up initial controls
-    ControlList startControls;
-    startControls.set(controls::AeEnable, false);
-    startControls.set(controls::ExposureTime, currentExposureTime.load());
-    startControls.set(controls::AnalogueGain, 4.0f);
-
-    if (camera->start(&startControls)) {
-        std::cerr << "Failed to start camera" << std::endl;
+    cameraFormat = format;
+    if (!frameSource->start(frameArrived, cameraError)) {
         return false;
     }
+    auto done = steady_clock::now();
+    lastFrameTime.store(done);
+    metrics.add(Counter::CameraRecoveries);
+    std::cout << "Camera recovered in " << duration_cast<milliseconds>(done - recoveryStart).count() << " ms ("
+              << duration_cast<milliseconds>(released - recoveryStart).count() << " ms waiting for captures)"
+              << std::endl;
+    return true;
+}
 
-    // Queue all requests with controls
-    for (auto &request : requests) {
-        request->controls().set(controls::AeEnable, false);
-        request->controls().set(controls::ExposureTime, currentExposureTime.load());
-        request->controls().set(controls::AnalogueGain, 4.0f);
-        camera->queueRequest(request.get());
+// --- Profile switch ---
+// Move to the next profile without closing the camera: stop streaming, let
+// the pipeline finish the captures still holding camera buffers, then
+// configure both for the new format and stream again. Runs on the event loop.
+bool switchProfile() {
+    if (capturePending.load() || burstFramesLeft.load() > 0) {
+        std::cout << "Capture in progress, not switching profile" << std::endl;
+        return true;
     }
-
-    std::cout << "Camera initialized: " << WIDTH << "x" << HEIGHT << std::endl;
+    if (recovering) {
+        std::cout << "Camera recovering, not switching profile" << std::endl;
+        return true;
+    }
+    NormalPriorityScope normalPriority;  // The threads started here must not inherit SCHED_FIFO
+    auto start = steady_clock::now();
+    frameSource->stop();
+    frameSelector->clear();  // The camera thread is idle until the restart
+    pipeline->stop();
+    auto drained = steady_clock::now();
+
+    currentProfile = (currentProfile + 1) % std::size(PROFILES);
+    FrameFormat format = profileFormat(PROFILES[currentProfile]);
+    if (!frameSource->configure(format) || !pipeline->start(format) ||
+        !frameSource->start(frameArrived, cameraError)) {
+        std::cerr << "Failed to switch to profile " << PROFILES[currentProfile].name << std::endl;
+        return false;
+    }
+    cameraFormat = format;
+    auto done = steady_clock::now();
+    lastFrameTime.store(done);
+    metrics.add(Counter::ProfileSwitches);
+
+    logProfile(format);
+    std::cout << "Switched in " << duration_cast<milliseconds>(done - start).count() << " ms ("
+              << duration_cast<milliseconds>(drained - start).count() << " ms finishing captures)" << std::endl;
     return true;
 }
 
+// --- Camera cleanup ---
+// Stop the camera, then let the pipeline encode and write what it captured
+void cleanupCamera() {
+    if (frameSource) {
+        frameSource->stop();
+    }
+    if (pipeline) {
+        pipeline->stop();
+        pipeline.reset();
+    }
+    frameSource.reset();
+}
+
 // --- GPIO button handling ---
-void buttonThread() {
-    // Try different chip names (gpiochip4 for Pi 5, gpiochip0 for Pi 4 and earlier)
-    const char *chipNames[] = {"gpiochip4", "gpiochip0", "pinctrl-bcm2835", nullptr};
-    struct gpiod_chip *chip = nullptr;
+// The button lines are requested once and their edges read on the event
+// loop, as soon as the kernel has them
+static struct gpiod_chip *buttonChip = nullptr;
+static struct gpiod_line_bulk buttonLines;
+static bool buttonsRequested = false;
+static struct gpiod_line *buttonShowPhotoLine = nullptr;
+
+// When the kernel saw the edge. Line events are stamped with CLOCK_MONOTONIC,
+// which steady_clock reads, on current kernels; older ones used
+// CLOCK_REALTIME, so a stamp that is not just before now is not trusted.
+static time_point<steady_clock> eventTime(const struct gpiod_line_event &event, time_point<steady_clock> now) {
+    time_point<steady_clock> stamp(duration_cast<steady_clock::duration>(
+        seconds(event.ts.tv_sec) + nanoseconds(event.ts.tv_nsec)));
+    if (stamp > now || now - stamp > seconds(1)) {
+        return now;
+    }
+    return stamp;
+}
 
-    for (int i = 0; chipNames[i] != nullptr; i++) {
-        chip = gpiod_chip_open_by_name(chipNames[i]);
-        if (chip) {
-            std::cout << "Opened GPIO chip: " << chipNames[i] << std::endl;
-            break;
+// What a button press or release does. Runs on the event loop; the only
+// slow work, a profile switch, waits for the camera anyway.
+static void buttonEvent(int pin, const struct gpiod_line_event &event) {
+    auto now = steady_clock::now();
+    auto last = lastPressed.load();
+
+    if (event.event_type == GPIOD_LINE_EVENT_RISING_EDGE) {
+        // Shutter released: end a held burst. Ignore contact bounce right
+        // after the press.
+        if (pin == BUTTON_PIN && burstHold && duration_cast<milliseconds>(now - last).count() > 50) {
+            burstFramesLeft.store(0);
+            latencyTrace.mark("shutter release", now);
         }
+        return;
     }
 
-    if (!chip) {
-        std::cerr << "Failed to open any GPIO chip" << std::endl;
+    // Debounce: ignore presses within 300ms
+    if (duration_cast<milliseconds>(now - last).count() <= 300) {
         return;
     }
+    lastPressed.store(now);
+
+    if (pin == BUTTON_PIN) {
+        // Check if a capture or burst is already in progress. A backlog in
+        // the encoder is handled by backpressure.
+        bool busy = capturePending.load() || burstFramesLeft.load() > 0;
+        if (busy) {
+            std::cout << "Capture busy, ignoring button press" << std::endl;
+        } else {
+            std::cout << "Button pressed, capturing..." << std::endl;
+            // Fire the flash until the frame is chosen
+            setShutterPin(false);
+            auto pressedAt = eventTime(event, now);
+            shutterPressed.store(pressedAt);
+            latencyTrace.mark("shutter press", pressedAt);
+            burstFramesLeft.store(burstHold ? INT_MAX : burstCount);
+            capturePending.store(true);
+        }
+    } else if (pin == SHOW_PHOTO_PIN) {
+        showMostRecentPhoto();
+    } else if (pin == GAIN_PIN && gpiod_line_get_value(buttonShowPhotoLine) == 0) {
+        // Show-photo held: next profile
+        std::cout << "Switching capture profile..." << std::endl;
+        if (!switchProfile()) {
+            eventLoop.stop();
+        }
+    // } else if (pin == GAIN_PIN) {
+    //     cycleAnalogueGain();
+    } else {
+        setExposureTime(pin);
+    }
+}
+
+// Request the button lines and have the event loop read their edges
+bool setupButtons() {
+    buttonChip = openGpioChip();
+    if (!buttonChip) {
+        return false;
+    }
 
     // All pins to monitor
     const int pins[] = {BUTTON_PIN, EXPOSURE_PIN_250, EXPOSURE_PIN_60, EXPOSURE_PIN_15, EXPOSURE_PIN_2, SHOW_PHOTO_PIN, GAIN_PIN};
-    const int numPins = sizeof(pins) / sizeof(pins[0]);
-    struct gpiod_line *lines[numPins];
-    struct gpiod_line_bulk bulk;
-
-    gpiod_line_bulk_init(&bulk);
-
-    for (int i = 0; i < numPins; i++) {
-        lines[i] = gpiod_chip_get_line(chip, pins[i]);
-        if (!lines[i]) {
-            std::cerr << "Failed to get GPIO line " << pins[i] << std::endl;
-            gpiod_chip_close(chip);
-            return;
+    gpiod_line_bulk_init(&buttonLines);
+    for (int pin : pins) {
+        struct gpiod_line *line = gpiod_chip_get_line(buttonChip, pin);
+        if (!line) {
+            std::cerr << "Failed to get GPIO line " << pin << std::endl;
+            return false;
         }
-        gpiod_line_bulk_add(&bulk, lines[i]);
+        gpiod_line_bulk_add(&buttonLines, line);
     }
+    // Held while the gain button is pressed, it switches profiles
+    buttonShowPhotoLine = gpiod_chip_get_line(buttonChip, SHOW_PHOTO_PIN);
 
-    // Request with pull-up bias and falling edge events
+    // Request with pull-up bias; both edges so a held shutter can be tracked
     struct gpiod_line_request_config config = {
         .consumer = "picam-button",
-        .request_type = GPIOD_LINE_REQUEST_EVENT_FALLING_EDGE,
+        .request_type = GPIOD_LINE_REQUEST_EVENT_BOTH_EDGES,
         .flags = GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP,
     };
-
-    if (gpiod_line_request_bulk(&bulk, &config, nullptr) < 0) {
+    if (gpiod_line_request_bulk(&buttonLines, &config, nullptr) < 0) {
         std::cerr << "Failed to request GPIO lines (error: " << strerror(errno) << ")" << std::endl;
-        gpiod_chip_close(chip);
-        return;
+        return false;
+    }
+    buttonsRequested = true;
+
+    // One event per wakeup; the loop comes back while more are queued
+    for (unsigned int i = 0; i < gpiod_line_bulk_num_lines(&buttonLines); i++) {
+        struct gpiod_line *line = gpiod_line_bulk_get_line(&buttonLines, i);
+        bool watched = eventLoop.watch(gpiod_line_event_get_fd(line), [line] {
+            struct gpiod_line_event event;
+            if (gpiod_line_event_read(line, &event) == 0) {
+                buttonEvent(static_cast<int>(gpiod_line_offset(line)), event);
+            }
+        });
+        if (!watched) {
+            return false;
+        }
     }
 
     std::cout << "Button monitoring started on GPIOs: " << BUTTON_PIN
               << ", " << EXPOSURE_PIN_250 << ", " << EXPOSURE_PIN_60
               << ", " << EXPOSURE_PIN_15 << ", " << EXPOSURE_PIN_2
               << ", " << SHOW_PHOTO_PIN << ", " << GAIN_PIN << std::endl;
+    return true;
+}
 
-    while (running) {
-        struct gpiod_line_bulk eventBulk;
-        struct timespec timeout = {0, 100000000}; // 100ms timeout
-
-        int ret = gpiod_line_event_wait_bulk(&bulk, &timeout, &eventBulk);
-        if (ret < 0) {
-            std::cerr << "Error waiting for GPIO event" << std::endl;
-            break;
+void releaseButtons() {
+    if (buttonsRequested) {
+        for (unsigned int i = 0; i < gpiod_line_bulk_num_lines(&buttonLines); i++) {
+            eventLoop.unwatch(gpiod_line_event_get_fd(gpiod_line_bulk_get_line(&buttonLines, i)));
         }
-        if (ret > 0) {
-            // Process events from all lines that triggered
-            for (unsigned int i = 0; i < gpiod_line_bulk_num_lines(&eventBulk); i++) {
-                struct gpiod_line *line = gpiod_line_bulk_get_line(&eventBulk, i);
-                struct gpiod_line_event event;
-                gpiod_line_event_read(line, &event);
-
-                int pin = gpiod_line_offset(line);
-                auto now = steady_clock::now();
-                auto last = lastPressed.load();
-
-                // Debounce: ignore presses within 300ms
-                if (duration_cast<milliseconds>(now - last).count() > 300) {
-                    lastPressed.store(now);
-
-                    if (pin == BUTTON_PIN) {
-                        // Check if capture already in progress
-                        bool busy = false;
-                        {
-                            std::lock_guard<std::mutex> lock(captureMutex);
-                            busy = !captureQueue.empty() || captureCountdown.load() > 0;
-                        }
-                        if (busy) {
-                            std::cout << "Capture busy, ignoring button press" << std::endl;
-                        } else {
-                            std::cout << "Button pressed, capturing..." << std::endl;
-                            captureCountdown.store(3);
-                        }
-                    } else if (pin == SHOW_PHOTO_PIN) {
-                        showMostRecentPhoto();
-                        // Drain any queued events on this line (non-blocking)
-                        int fd = gpiod_line_event_get_fd(line);
-                        int flags = fcntl(fd, F_GETFL);
-                        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-                        struct gpiod_line_event drainEvent;
-                        while (read(fd, &drainEvent, sizeof(drainEvent)) > 0) {}
-                        fcntl(fd, F_SETFL, flags);
-                    // } else if (pin == GAIN_PIN) {
-                    //     cycleAnalogueGain();
-                    } else {
-                        setExposureTime(pin);
-                    }
-                }
-            }
+        gpiod_line_release_bulk(&buttonLines);
+        buttonsRequested = false;
+    }
+    if (buttonChip) {
+        gpiod_chip_close(buttonChip);
+        buttonChip = nullptr;
+    }
+}
+
+// --- Camera watchdog ---
+// The watchdog timer fires once a timeout after the last frame, unless a
+// newer frame has moved it on; camera errors come in as camera events.
+static int recoveries = 0;  // Attempts since frames last came in
+static time_point<steady_clock> recoveredAt;
+static bool startupReported = false;
+
+static void recoveryDone(bool recovered) {
+    recovering = false;
+    if (!recovered) {
+        lastFrameTime.store(steady_clock::now());  // Try again after another timeout
+    }
+    recoveredAt = steady_clock::now();
+    watchdogTimer.arm(CAMERA_WATCHDOG_TIMEOUT);
+}
+
+// Re-armed until captures have given the stopped camera's buffers back
+static void releaseTimerExpired() {
+    if (pipeline->framesInFlight() > 0) {
+        if (steady_clock::now() - recoveryStart < CAMERA_RELEASE_TIMEOUT) {
+            releaseTimer.arm(CAMERA_RELEASE_POLL);
+            return;
         }
+        std::cerr << "Captures still hold camera buffers, cannot reopen the camera" << std::endl;
+        recoveryDone(false);
+        return;
+    }
+    recoveryDone(finishRecovery());
+}
+
+static void cameraFailure() {
+    if (recovering) {
+        return;  // Errors from the camera being stopped
+    }
+    if (recoveries >= CAMERA_RECOVERY_ATTEMPTS) {
+        std::cerr << "Camera did not recover after " << recoveries << " attempts, exiting..." << std::endl;
+        eventLoop.stop();
+        return;
+    }
+    recoveries++;
+    watchdogTimer.cancel();
+    beginRecovery();
+    releaseTimerExpired();
+}
+
+static void watchdogExpired() {
+    auto lastFrame = lastFrameTime.load();
+    auto sinceLastFrame = steady_clock::now() - lastFrame;
+    if (sinceLastFrame >= CAMERA_WATCHDOG_TIMEOUT) {
+        std::cerr << "Camera watchdog timeout - no frames for "
+                  << duration_cast<seconds>(sinceLastFrame).count() << " seconds" << std::endl;
+        metrics.add(Counter::WatchdogTimeouts);
+        cameraFailure();
+        return;
+    }
+    if (recoveries > 0 && lastFrame > recoveredAt) {
+        recoveries = 0;
+    }
+    watchdogTimer.arm(CAMERA_WATCHDOG_TIMEOUT - sinceLastFrame);
+}
+
+static void cameraEvent() {
+    if (!startupReported && lastFrameTime.load() > startupMark) {
+        startupPhase("first frame");
+        std::cout << "Startup: " << startupPhases << " (total "
+                  << duration_cast<milliseconds>(startupMark - startupBegin).count() << " ms)" << std::endl;
+        startupReported = true;
     }
+    if (cameraFailed.exchange(false)) {
+        cameraFailure();
+    }
+}
 
-    gpiod_line_release_bulk(&bulk);
-    gpiod_chip_close(chip);
+// --- Metrics ---
+// State the app keeps anyway, read when a snapshot is taken
+static void addGauges() {
+    metrics.addGauge("frames_in_flight", [] { return pipeline ? pipeline->framesInFlight() : 0; });
+    metrics.addGauge("capture_queue_depth", [] { return pipeline ? static_cast<double>(pipeline->queueDepth()) : 0; });
+    metrics.addGauge("capture_pending", [] { return capturePending.load() ? 1 : 0; });
+    metrics.addGauge("burst_frames_left", [] { return burstFramesLeft.load(); });
+    metrics.addGauge("seconds_since_last_frame",
+                     [] { return duration<double>(steady_clock::now() - lastFrameTime.load()).count(); });
+    metrics.addGauge("exposure_time_us", [] { return currentExposureTime.load(); });
+    metrics.addGauge("analogue_gain", [] { return GAIN_VALUES[currentGainIndex.load()]; });
+    metrics.addGauge("uptime_seconds", [] { return duration<double>(steady_clock::now() - startupBegin).count(); });
 }
 
-// --- Signal handler ---
-void signalHandler(int sig) {
+static void metricsTimerExpired() {
+    metrics.writeSnapshot(metricsFile);
+    metricsTimer.arm(METRICS_INTERVAL);
+}
+
+// Either can be turned off; neither failing to open stops the app
+static void startMetrics() {
+    addGauges();
+    std::string socketPath = getEnvString("MPI_METRICS_SOCKET", METRICS_SOCKET);
+    if (socketPath != "off" && metricsServer.open(eventLoop, socketPath)) {
+        std::cout << "Serving metrics on " << socketPath << std::endl;
+    }
+    metricsFile = getEnvString("MPI_METRICS_FILE", METRICS_FILE);
+    if (metricsFile == "off") {
+        metricsFile.clear();
+    } else if (metricsTimer.open(eventLoop, metricsTimerExpired)) {
+        std::cout << "Writing metrics to " << metricsFile << " every " << METRICS_INTERVAL.count() << " s"
+                  << std::endl;
+        metricsTimer.arm(METRICS_INTERVAL);
+    }
+}
+
+// --- Signals ---
+static void signalReceived(int signal) {
+    if (signal == SIGUSR1) {
+        latencyTrace.report(std::cout);
+        return;
+    }
     std::cout << "\nShutting down..." << std::endl;
-    running = false;
-    captureCV.notify_all();  // Wake up encoder thread
+    eventLoop.stop();
 }
 
 // --- Main ---
 int main() {
-    // Setup signal handlers
-    std::signal(SIGINT, signalHandler);
-    std::signal(SIGTERM, signalHandler);
-
-    // Initialize turbojpeg
-    tjInstance = tjInitCompress();
-    if (!tjInstance) {
-        std::cerr << "Failed to initialize turbojpeg" << std::endl;
+    // Signals, camera and writer notifications and timers go to the event
+    // loop. Signals are blocked before any thread starts, so all inherit it.
+    if (!eventLoop.open() ||
+        !eventSignals.open(eventLoop, {SIGINT, SIGTERM, SIGUSR1}, signalReceived) ||
+        !cameraEvents.open(eventLoop, cameraEvent) || !savedEvents.open(eventLoop, capturesSaved) ||
+        !watchdogTimer.open(eventLoop, watchdogExpired) || !releaseTimer.open(eventLoop, releaseTimerExpired) ||
+        !ledTimer.open(eventLoop, ledTimerExpired)) {
         return 1;
     }
 
+    loadCaptureSettings();
+
+    std::string traceFile = getEnvString("MPI_TRACE_FILE", "");
+    if (!traceFile.empty()) {
+        if (latencyTrace.openTraceFile(traceFile)) {
+            std::cout << "Writing latency trace to " << traceFile << std::endl;
+        } else {
+            std::cerr << "Failed to open trace file " << traceFile << ": " << strerror(errno) << std::endl;
+        }
+    }
+    startMetrics();
+
+    startupPhase("settings");
+
     // Turn off screen
     turnOffScreen();
+    startupPhase("GPIO and display");
 
-    // Create tapes directory
+    // Create tapes directory, and its catalog
     fs::create_directories(TAPES_DIR);
-
-    // Start encoder thread
-    encoderThread = std::thread(encoderThreadFunc);
+    catalogOpen = tapesCatalog.open(TAPES_DIR);
+    startupPhase("catalog");
 
     // Load cached shutter speed (defaults to 1/60 if not found)
     currentExposureTime.store(loadShutterSpeed());
     std::cout << "Shutter speed: " << currentExposureTime.load() << " us" << std::endl;
 
-    // Setup camera
+    // Setup camera and the capture pipeline
     if (!setupCamera()) {
-        running = false;
-        captureCV.notify_all();
-        encoderThread.join();
-        tjDestroy(tjInstance);
+        cleanupCamera();
+        stopDisplay();
+        releaseOutputLines();
         return 1;
     }
 
-    // Start button monitoring thread
-    std::thread buttonMonitor(buttonThread);
+    if (!setupButtons()) {
+        releaseButtons();
+    }
+    watchdogTimer.arm(CAMERA_WATCHDOG_TIMEOUT);
 
     std::cout << "Ready. Waiting for button press..." << std::endl;
-
-    // Main loop with watchdog
-    while (running) {
-        // Check if camera has timed out (no frames for 5 seconds)
-        auto timeSinceLastFrame = duration_cast<seconds>(steady_clock::now() - lastFrameTime.load()).count();
-        if (timeSinceLastFrame > 5) {
-            std::cerr << "Camera watchdog timeout - no frames for " << timeSinceLastFrame << " seconds, exiting..." << std::endl;
-            running = false;
-            break;
-        }
-        std::this_thread::sleep_for(milliseconds(100));
+    latencyTrace.nameThread("events");
+    // Only now: threads inherit the policy of the thread that starts them
+    if (realtimeEnabled) {
+        setRealtimePriority("Event loop", EVENT_LOOP_PRIORITY);
     }
+    eventLoop.run();
 
-    // Cleanup
-    buttonMonitor.join();
-
-    // Wait for encoder to finish pending jobs
-    captureCV.notify_all();
-    encoderThread.join();
-
+    // Cleanup: pending captures are encoded and written before exit
+    releaseButtons();
     cleanupCamera();
-    tjDestroy(tjInstance);
+    stopDisplay();
+    releaseOutputLines();
+
+    latencyTrace.report(std::cout);
+    latencyTrace.closeTraceFile();
+    metricsServer.close();
+    if (!metricsFile.empty()) {
+        metrics.writeSnapshot(metricsFile);
+    }
 
     std::cout << "Goodbye!" << std::endl;
     return 0;
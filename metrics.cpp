@@ -0,0 +1,138 @@
+#include "metrics.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const char *counterName(Counter counter) {
+    switch (counter) {
+        case Counter::FramesDelivered: return "frames_delivered_total";
+        case Counter::FramesWaiting: return "frames_waiting_total";
+        case Counter::CapturesAccepted: return "captures_accepted_total";
+        case Counter::CapturesBlocked: return "captures_blocked_total";
+        case Counter::CapturesDropped: return "captures_dropped_total";
+        case Counter::CapturesReduced: return "captures_reduced_total";
+        case Counter::FramesParked: return "frames_parked_total";
+        case Counter::FramesSpilled: return "frames_spilled_total";
+        case Counter::EncodeFailures: return "encode_failures_total";
+        case Counter::DngsSkipped: return "dngs_skipped_total";
+        case Counter::FilesWritten: return "files_written_total";
+        case Counter::BytesWritten: return "bytes_written_total";
+        case Counter::WriteFailures: return "write_failures_total";
+        case Counter::CameraErrors: return "camera_errors_total";
+        case Counter::WatchdogTimeouts: return "watchdog_timeouts_total";
+        case Counter::CameraRecoveries: return "camera_recoveries_total";
+        case Counter::ProfileSwitches: return "profile_switches_total";
+        case Counter::Count: break;
+    }
+    return "unknown";
+}
+
+void Metrics::addGauge(const std::string &name, Gauge gauge) {
+    gauges_.emplace_back(name, std::move(gauge));
+}
+
+std::string Metrics::snapshot() const {
+    std::ostringstream out;
+    for (int i = 0; i < static_cast<int>(Counter::Count); i++) {
+        out << "mpi_" << counterName(static_cast<Counter>(i)) << " " << counters_[i].value.load(std::memory_order_relaxed)
+            << "\n";
+    }
+    for (const auto &gauge : gauges_) {
+        out << "mpi_" << gauge.first << " " << gauge.second() << "\n";
+    }
+
+    // Stage durations in milliseconds, as the shutdown report has them
+    for (int i = 0; i < static_cast<int>(LatencyStage::Count); i++) {
+        const LatencyHistogram &h = trace_.histogram(static_cast<LatencyStage>(i));
+        const char *stage = latencyStageName(static_cast<LatencyStage>(i));
+        out << "mpi_latency_ms_count{stage=\"" << stage << "\"} " << h.count() << "\n";
+        if (h.count() == 0) {
+            continue;
+        }
+        out << "mpi_latency_ms{stage=\"" << stage << "\",quantile=\"0.5\"} " << h.percentile(0.50) / 1000.0 << "\n"
+            << "mpi_latency_ms{stage=\"" << stage << "\",quantile=\"0.99\"} " << h.percentile(0.99) / 1000.0 << "\n"
+            << "mpi_latency_ms_max{stage=\"" << stage << "\"} " << h.max() / 1000.0 << "\n";
+    }
+    return out.str();
+}
+
+bool Metrics::writeSnapshot(const std::string &path) const {
+    std::string text = snapshot();
+    std::string tempPath = path + ".tmp";
+    FILE *f = fopen(tempPath.c_str(), "w");
+    if (!f) {
+        std::cerr << "Failed to write metrics to " << tempPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tempPath.c_str(), path.c_str()) < 0) {
+        std::cerr << "Failed to write metrics to " << path << ": " << strerror(errno) << std::endl;
+        unlink(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// --- Server ---
+MetricsServer::~MetricsServer() {
+    close();
+}
+
+bool MetricsServer::open(EventLoop &loop, const std::string &path) {
+    sockaddr_un address{};
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Metrics socket path too long: " << path << std::endl;
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    // A socket left by an earlier run would make bind() fail
+    unlink(path.c_str());
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd_ < 0 || bind(fd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+        listen(fd_, 4) < 0) {
+        std::cerr << "Failed to open metrics socket " << path << ": " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    path_ = path;
+    loop_ = &loop;
+    return loop.watch(fd_, [this] { serve(); });
+}
+
+void MetricsServer::close() {
+    if (fd_ < 0) {
+        return;
+    }
+    if (loop_) {
+        loop_->unwatch(fd_);
+        loop_ = nullptr;
+    }
+    ::close(fd_);
+    fd_ = -1;
+    if (!path_.empty()) {
+        unlink(path_.c_str());
+        path_.clear();
+    }
+}
+
+// One snapshot per connection. The snapshot is a few KB, well within the
+// socket buffer, so the write does not block the loop.
+void MetricsServer::serve() {
+    int client;
+    while ((client = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+        std::string text = metrics_.snapshot();
+        if (send(client, text.data(), text.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+            std::cerr << "Failed to send metrics: " << strerror(errno) << std::endl;
+        }
+        ::close(client);
+    }
+}
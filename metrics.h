@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "event_loop.h"
+#include "latency_trace.h"
+
+// --- Metrics ---
+// Counters and gauges describing the running camera, for health checks and
+// dashboards. Counters are relaxed atomics on cache lines of their own, so
+// bumping one on a hot path costs a few nanoseconds and never contends with
+// another. Gauges are read only when a snapshot is taken, from state the app
+// keeps anyway. A snapshot also carries the latency histograms of a trace.
+//
+// Snapshots are plain text in the Prometheus exposition format, one
+// `mpi_<name> <value>` line per metric, served over a Unix socket and written
+// to a file.
+
+enum class Counter {
+    FramesDelivered,   // Frames from the camera
+    FramesWaiting,     // Frames passed over while a press waited for its frame
+    CapturesAccepted,  // Frames queued for capture
+    CapturesBlocked,   // Frames a capture could not take because of backpressure
+    CapturesDropped,   // Queued captures dropped by drop-oldest backpressure
+    CapturesReduced,   // Captures taken at half resolution
+    FramesParked,      // Queued frames copied to memory by spill backpressure
+    FramesSpilled,     // Queued frames copied to the spill file
+    EncodeFailures,
+    DngsSkipped,       // Raw frames dropped because the DNG writer was busy
+    FilesWritten,      // JPEGs, DNGs and spool files committed
+    BytesWritten,
+    WriteFailures,
+    CameraErrors,
+    WatchdogTimeouts,
+    CameraRecoveries,  // Successful in-place recoveries
+    ProfileSwitches,
+    Count,
+};
+
+const char *counterName(Counter counter);
+
+class Metrics {
+public:
+    using Gauge = std::function<double()>;
+
+    explicit Metrics(const LatencyTrace &trace) : trace_(trace) {}
+
+    void add(Counter counter, uint64_t amount = 1) {
+        counters_[static_cast<int>(counter)].value.fetch_add(amount, std::memory_order_relaxed);
+    }
+    uint64_t value(Counter counter) const {
+        return counters_[static_cast<int>(counter)].value.load(std::memory_order_relaxed);
+    }
+
+    // A value read at snapshot time, on the snapshot's thread. Register
+    // gauges before the first snapshot.
+    void addGauge(const std::string &name, Gauge gauge);
+
+    std::string snapshot() const;
+    // Replace the file with a snapshot, atomically
+    bool writeSnapshot(const std::string &path) const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value{0};
+    };
+
+    Slot counters_[static_cast<int>(Counter::Count)];
+    std::vector<std::pair<std::string, Gauge>> gauges_;
+    const LatencyTrace &trace_;
+};
+
+// Serves a snapshot to every client that connects to a Unix stream socket,
+// then closes the connection; e.g. `socat - UNIX-CONNECT:<path>`. Clients
+// are served on the event loop.
+class MetricsServer {
+public:
+    explicit MetricsServer(const Metrics &metrics) : metrics_(metrics) {}
+    ~MetricsServer();
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    bool open(EventLoop &loop, const std::string &path);
+    void close();
+
+private:
+    void serve();
+
+    const Metrics &metrics_;
+    EventLoop *loop_ = nullptr;
+    std::string path_;
+    int fd_ = -1;
+};
@@ -0,0 +1,377 @@
+#include "paced_source.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "yuv_scale.h"
+
+using namespace std::chrono;
+
+namespace {
+
+constexpr unsigned int DEFAULT_BUFFER_COUNT = 4;
+constexpr int STRIDE_ALIGNMENT = 64;  // Like the ISP's row alignment
+constexpr int RAW_BITS = 12;
+constexpr int RAW_BLACK_LEVEL = 256;  // In 12-bit units, like the common sensors
+
+bool readFully(int fd, uint8_t *dst, size_t length, off_t offset, std::string &error) {
+    while (length > 0) {
+        ssize_t got = pread(fd, dst, length, offset);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            error = got < 0 ? strerror(errno) : "unexpected end of file";
+            return false;
+        }
+        dst += got;
+        length -= static_cast<size_t>(got);
+        offset += got;
+    }
+    return true;
+}
+
+// Turn a YUV420 frame back into the RGGB mosaic a sensor would have read
+// out, packed two 12-bit samples to three bytes
+void mosaicYuv420(const YuvFrame &frame, const RawLayout &layout, uint8_t *dst) {
+    auto sample = [](int value) {
+        return RAW_BLACK_LEVEL + std::clamp(value, 0, 255) * ((1 << RAW_BITS) - 1 - RAW_BLACK_LEVEL) / 255;
+    };
+    for (int row = 0; row < layout.height; row++) {
+        const uint8_t *y = frame.planes[0] + static_cast<size_t>(row) * frame.strides[0];
+        const uint8_t *u = frame.planes[1] + static_cast<size_t>(row / 2) * frame.strides[1];
+        const uint8_t *v = frame.planes[2] + static_cast<size_t>(row / 2) * frame.strides[2];
+        uint8_t *out = dst + static_cast<size_t>(row) * layout.stride;
+        for (int col = 0; col + 2 <= layout.width; col += 2, out += 3) {
+            int cb = u[col / 2] - 128;
+            int cr = v[col / 2] - 128;
+            int s0, s1;
+            if (row % 2 == 0) {
+                s0 = sample(y[col] + (cr * 359 >> 8));                   // R
+                s1 = sample(y[col + 1] - ((cb * 88 + cr * 183) >> 8));  // G
+            } else {
+                s0 = sample(y[col] - ((cb * 88 + cr * 183) >> 8));      // G
+                s1 = sample(y[col + 1] + (cb * 454 >> 8));              // B
+            }
+            out[0] = static_cast<uint8_t>(s0 >> 4);
+            out[1] = static_cast<uint8_t>(s1 >> 4);
+            out[2] = static_cast<uint8_t>((s0 & 15) | (s1 & 15) << 4);
+        }
+    }
+}
+
+}  // namespace
+
+// --- Paced source ---
+PacedSource::PacedSource(double fps) : fps_(fps) {}
+
+PacedSource::~PacedSource() {
+    stop();
+}
+
+uint8_t *PacedSource::plane(uint8_t *buffer, int index) const {
+    size_t lumaSize = static_cast<size_t>(format_.stride) * format_.height;
+    size_t chromaSize = static_cast<size_t>(format_.stride / 2) * (format_.height / 2);
+    switch (index) {
+        case 0: return buffer;
+        case 1: return buffer + lumaSize;
+        default: return buffer + lumaSize + chromaSize;
+    }
+}
+
+bool PacedSource::configure(FrameFormat &format) {
+    if (format.width <= 0 || format.height <= 0 || format.width % 2 || format.height % 2) {
+        std::cerr << "Frame size must be positive and even, got " << format.width << "x" << format.height << std::endl;
+        return false;
+    }
+    if (format.stride == 0) {
+        format.stride = (format.width + STRIDE_ALIGNMENT - 1) / STRIDE_ALIGNMENT * STRIDE_ALIGNMENT;
+    }
+    if (format.stride < format.width || format.stride % 2) {
+        std::cerr << "Stride " << format.stride << " does not fit width " << format.width << std::endl;
+        return false;
+    }
+    if (format.bufferCount == 0) {
+        format.bufferCount = DEFAULT_BUFFER_COUNT;
+    }
+    if (format.viewfinderWidth < 0 || format.viewfinderHeight < 0 ||
+        format.viewfinderWidth % 2 || format.viewfinderHeight % 2 ||
+        (format.viewfinderWidth == 0) != (format.viewfinderHeight == 0)) {
+        std::cerr << "Viewfinder size must be even, got " << format.viewfinderWidth << "x"
+                  << format.viewfinderHeight << std::endl;
+        return false;
+    }
+    // No sensor modes here, and frames come at the pace set up front
+    format.sensorWidth = 0;
+    format.sensorHeight = 0;
+    format.sensorBitDepth = 0;
+    format.frameRate = fps_;
+    format.rawLayout = RawLayout();
+    if (format.raw) {
+        format.rawLayout.width = format.width;
+        format.rawLayout.height = format.height;
+        format.rawLayout.bits = RAW_BITS;
+        format.rawLayout.packing = RawPacking::Csi2;
+        format.rawLayout.stride = static_cast<int>(rawRowBytes(format.rawLayout) + 31) / 32 * 32;
+    }
+    format_ = format;
+
+    // The viewfinder image, if any, follows the frame in the same buffer, and
+    // the raw frame follows that
+    frameSize_ = static_cast<size_t>(format.stride) * format.height +
+                 2 * static_cast<size_t>(format.stride / 2) * (format.height / 2);
+    rawOffset_ = frameSize_ + yuv420Size(format.viewfinderWidth, format.viewfinderHeight);
+    size_t size = rawOffset_ + static_cast<size_t>(format.rawLayout.stride) * format.rawLayout.height;
+    storage_.assign(format.bufferCount, std::vector<uint8_t>(size));
+    mosaiced_.clear();
+
+    std::vector<uint8_t *> buffers;
+    for (auto &buffer : storage_) {
+        buffers.push_back(buffer.data());
+    }
+    if (!prepare(buffers)) {
+        return false;
+    }
+    free_ = buffers;
+    return true;
+}
+
+bool PacedSource::start(FrameHandler onFrame, ErrorHandler onError) {
+    onFrame_ = std::move(onFrame);
+    onError_ = std::move(onError);
+    stopping_ = false;
+    thread_ = std::thread(&PacedSource::threadFunc, this);
+    return true;
+}
+
+void PacedSource::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void PacedSource::setControls(int32_t exposureTimeUs, float analogueGain) {
+    exposureTimeUs_.store(exposureTimeUs);
+    analogueGain_.store(analogueGain);
+}
+
+void PacedSource::threadFunc() {
+    auto period = duration_cast<steady_clock::duration>(duration<double>(fps_ > 0 ? 1.0 / fps_ : 0.0));
+    auto next = steady_clock::now();
+    uint64_t delivered = 0;
+
+    while (true) {
+        uint8_t *buffer = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (fps_ > 0) {
+                if (cv_.wait_until(lock, next, [this] { return stopping_; })) {
+                    break;
+                }
+                // Stay on the frame clock, but never try to catch up in a burst
+                next = std::max(next + period, steady_clock::now() - period);
+                if (free_.empty()) {
+                    dropped_++;
+                    continue;
+                }
+            } else {
+                cv_.wait(lock, [this] { return stopping_ || !free_.empty(); });
+                if (stopping_) {
+                    break;
+                }
+            }
+            buffer = free_.back();
+            free_.pop_back();
+        }
+
+        SourceFrame frame;
+        frame.index = delivered;
+        frame.lease = std::shared_ptr<void>(buffer, [this](void *b) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                free_.push_back(static_cast<uint8_t *>(b));
+            }
+            cv_.notify_all();
+        });
+
+        std::string error;
+        if (!fill(buffer, delivered, error)) {
+            onError_(error);
+            break;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            frame.image.planes[i] = plane(buffer, i);
+            frame.image.strides[i] = i == 0 ? format_.stride : format_.stride / 2;
+        }
+        frame.image.width = format_.width;
+        frame.image.height = format_.height;
+        if (format_.viewfinderWidth > 0) {
+            // Scaled down from the frame, as the ISP would
+            uint8_t *small = buffer + frameSize_;
+            sampleYuv420(frame.image, small, format_.viewfinderWidth, format_.viewfinderHeight);
+            frame.viewfinder = packedYuv420(small, format_.viewfinderWidth, format_.viewfinderHeight);
+        }
+        if (format_.rawLayout.width > 0) {
+            uint8_t *raw = buffer + rawOffset_;
+            if (std::find(mosaiced_.begin(), mosaiced_.end(), buffer) == mosaiced_.end()) {
+                mosaicYuv420(frame.image, format_.rawLayout, raw);
+                mosaiced_.push_back(buffer);
+            }
+            frame.raw.data = raw;
+            frame.raw.layout = format_.rawLayout;
+            std::fill(std::begin(frame.raw.blackLevels), std::end(frame.raw.blackLevels),
+                      RAW_BLACK_LEVEL << (16 - RAW_BITS));
+        }
+        frame.arrival = steady_clock::now();
+        frame.exposureTimeUs = exposureTimeUs_.load();
+        if (frame.exposureTimeUs == 0) {
+            frame.exposureTimeUs = static_cast<int32_t>(duration_cast<microseconds>(period).count());
+        }
+        frame.exposureStart = frame.arrival - microseconds(frame.exposureTimeUs);
+        frame.analogueGain = analogueGain_.load();
+        delivered++;
+        onFrame_(frame);
+    }
+}
+
+// --- Synthetic source ---
+SyntheticSource::~SyntheticSource() {
+    stop();
+}
+
+std::string SyntheticSource::describe() const {
+    return "synthetic " + std::to_string(format().width) + "x" + std::to_string(format().height) +
+           " (stride " + std::to_string(format().stride) + ")";
+}
+
+bool SyntheticSource::prepare(const std::vector<uint8_t *> &buffers) {
+    const FrameFormat &f = format();
+    for (size_t b = 0; b < buffers.size(); b++) {
+        // Diagonal gradient with a little per-pixel noise, so the encoder
+        // does about as much work as on a real scene
+        uint32_t seed = 0x9e3779b9u * static_cast<uint32_t>(b + 1);
+        uint8_t *y = plane(buffers[b], 0);
+        for (int row = 0; row < f.height; row++) {
+            uint8_t *line = y + static_cast<size_t>(row) * f.stride;
+            for (int col = 0; col < f.width; col++) {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                int value = (row + col + static_cast<int>(b) * 64) * 192 / (f.width + f.height) + (seed & 31);
+                line[col] = static_cast<uint8_t>(std::min(value, 255));
+            }
+        }
+
+        uint8_t *u = plane(buffers[b], 1);
+        uint8_t *v = plane(buffers[b], 2);
+        int chromaStride = f.stride / 2;
+        for (int row = 0; row < f.height / 2; row++) {
+            for (int col = 0; col < f.width / 2; col++) {
+                u[static_cast<size_t>(row) * chromaStride + col] = static_cast<uint8_t>(96 + col * 64 / (f.width / 2));
+                v[static_cast<size_t>(row) * chromaStride + col] = static_cast<uint8_t>(96 + row * 64 / (f.height / 2));
+            }
+        }
+    }
+    return true;
+}
+
+bool SyntheticSource::fill(uint8_t *buffer, uint64_t frame, std::string &error) {
+    (void)error;
+    // Rewrite the top band of 16x16 blocks so consecutive frames differ
+    const FrameFormat &f = format();
+    uint8_t *y = plane(buffer, 0);
+    int band = std::min(16, f.height);
+    for (int row = 0; row < band; row++) {
+        uint8_t *line = y + static_cast<size_t>(row) * f.stride;
+        for (int col = 0; col < f.width; col++) {
+            line[col] = static_cast<uint8_t>(frame * 37 + static_cast<uint64_t>(col / 16) * 11);
+        }
+    }
+    return true;
+}
+
+// --- Replay source ---
+ReplaySource::ReplaySource(std::string path, double fps) : PacedSource(fps), path_(std::move(path)) {}
+
+ReplaySource::~ReplaySource() {
+    stop();
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+std::string ReplaySource::describe() const {
+    return "replay " + path_ + " (" + std::to_string(frameCount_) + " frames of " +
+           std::to_string(format().width) + "x" + std::to_string(format().height) + ")";
+}
+
+bool ReplaySource::prepare(const std::vector<uint8_t *> &buffers) {
+    (void)buffers;
+    // Opened on the first configure() and kept for the next ones
+    if (fd_ < 0) {
+        fd_ = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) {
+            std::cerr << "Failed to open " << path_ << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) < 0) {
+        std::cerr << "Failed to stat " << path_ << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    const FrameFormat &f = format();
+    uint64_t frameSize = static_cast<uint64_t>(f.width) * f.height * 3 / 2;
+    frameCount_ = static_cast<uint64_t>(st.st_size) / frameSize;
+    if (frameCount_ == 0) {
+        std::cerr << path_ << " is smaller than one " << f.width << "x" << f.height << " I420 frame" << std::endl;
+        return false;
+    }
+    if (static_cast<uint64_t>(st.st_size) % frameSize) {
+        std::cerr << "Ignoring trailing partial frame in " << path_ << std::endl;
+    }
+    return true;
+}
+
+bool ReplaySource::fill(uint8_t *buffer, uint64_t frame, std::string &error) {
+    // Frames on disk are packed; copy them into the strided buffer a plane (or
+    // a row, if the stride is padded) at a time
+    const FrameFormat &f = format();
+    uint64_t frameSize = static_cast<uint64_t>(f.width) * f.height * 3 / 2;
+    off_t offset = static_cast<off_t>((frame % frameCount_) * frameSize);
+
+    for (int i = 0; i < 3; i++) {
+        int width = i == 0 ? f.width : f.width / 2;
+        int height = i == 0 ? f.height : f.height / 2;
+        int stride = i == 0 ? f.stride : f.stride / 2;
+        uint8_t *dst = plane(buffer, i);
+
+        if (stride == width) {
+            if (!readFully(fd_, dst, static_cast<size_t>(width) * height, offset, error)) {
+                error = "Failed to read " + path_ + ": " + error;
+                return false;
+            }
+        } else {
+            for (int row = 0; row < height; row++) {
+                if (!readFully(fd_, dst + static_cast<size_t>(row) * stride, width, offset + static_cast<off_t>(row) * width, error)) {
+                    error = "Failed to read " + path_ + ": " + error;
+                    return false;
+                }
+            }
+        }
+        offset += static_cast<off_t>(width) * height;
+    }
+    return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_source.h"
+
+// --- Stand-in sources ---
+// Deliver YUV420 frames from memory on their own thread at a fixed rate, the
+// way the sensor would. When every buffer is still leased the frame is
+// dropped, like a camera with no request queued. At 0 fps frames are
+// delivered as fast as buffers come back, which measures pipeline throughput.
+// A viewfinder image is sampled from each frame when one is configured, and
+// a 12-bit CSI-2 packed RGGB raw frame is mosaiced from each buffer the first
+// time it is delivered when raw frames are.
+// Frames report the exposure and gain last set, as if the sensor applied
+// them at once, exposed up to their arrival.
+// Subclasses stop the thread in their destructor, before their state goes.
+class PacedSource : public FrameSource {
+public:
+    explicit PacedSource(double fps);
+    ~PacedSource() override;
+
+    bool configure(FrameFormat &format) override;
+    bool start(FrameHandler onFrame, ErrorHandler onError) override;
+    void stop() override;
+    void setControls(int32_t exposureTimeUs, float analogueGain) override;
+
+    uint64_t droppedFrames() const { return dropped_.load(); }
+
+protected:
+    // Called once the buffers exist, to give them their first contents
+    virtual bool prepare(const std::vector<uint8_t *> &buffers) = 0;
+    // Update a buffer for the given frame number, on the source thread
+    virtual bool fill(uint8_t *buffer, uint64_t frame, std::string &error) = 0;
+
+    const FrameFormat &format() const { return format_; }
+    // Y, U and V of a buffer, each plane's rows format().stride (Y) or
+    // format().stride / 2 (U, V) bytes apart
+    uint8_t *plane(uint8_t *buffer, int index) const;
+
+private:
+    void threadFunc();
+
+    double fps_;
+    FrameFormat format_;
+    size_t frameSize_ = 0;  // Bytes of a full frame, ahead of its viewfinder
+    size_t rawOffset_ = 0;  // Where the raw frame follows the viewfinder
+    std::vector<uint8_t *> mosaiced_;  // Buffers whose raw frame is made, source thread only
+    std::vector<std::vector<uint8_t>> storage_;
+    FrameHandler onFrame_;
+    ErrorHandler onError_;
+
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<uint8_t *> free_;  // Buffers not leased, guarded by mutex_
+    bool stopping_ = false;
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<int32_t> exposureTimeUs_{0};  // 0 = one frame period
+    std::atomic<float> analogueGain_{0.0f};
+};
+
+// Test pattern: a textured gradient with a band of blocks along the top that
+// changes every frame
+class SyntheticSource : public PacedSource {
+public:
+    using PacedSource::PacedSource;
+    ~SyntheticSource() override;
+    std::string describe() const override;
+
+protected:
+    bool prepare(const std::vector<uint8_t *> &buffers) override;
+    bool fill(uint8_t *buffer, uint64_t frame, std::string &error) override;
+};
+
+// Replays a file of back-to-back packed I420 frames of the configured size,
+// looping at the end
+class ReplaySource : public PacedSource {
+public:
+    ReplaySource(std::string path, double fps);
+    ~ReplaySource() override;
+    std::string describe() const override;
+
+protected:
+    bool prepare(const std::vector<uint8_t *> &buffers) override;
+    bool fill(uint8_t *buffer, uint64_t frame, std::string &error) override;
+
+private:
+    std::string path_;
+    int fd_ = -1;
+    uint64_t frameCount_ = 0;
+};
@@ -0,0 +1,45 @@
+#include "raw_frame.h"
+
+#include <cstdlib>
+
+bool parseRawFormat(const std::string &name, RawLayout &layout) {
+    // S<order><bits>[_CSI2P]
+    if (name.size() < 7 || name[0] != 'S') {
+        return false;
+    }
+    std::string order = name.substr(1, 4);
+    if (order == "RGGB") {
+        layout.order = BayerOrder::RGGB;
+    } else if (order == "GRBG") {
+        layout.order = BayerOrder::GRBG;
+    } else if (order == "GBRG") {
+        layout.order = BayerOrder::GBRG;
+    } else if (order == "BGGR") {
+        layout.order = BayerOrder::BGGR;
+    } else {
+        return false;
+    }
+
+    char *end = nullptr;
+    long bits = strtol(name.c_str() + 5, &end, 10);
+    std::string suffix = end;
+    if (suffix.empty() && bits >= 10 && bits <= 16) {
+        layout.bits = static_cast<int>(bits);
+        layout.packing = RawPacking::None;
+        return true;
+    }
+    if (suffix == "_CSI2P" && (bits == 10 || bits == 12)) {
+        layout.bits = static_cast<int>(bits);
+        layout.packing = RawPacking::Csi2;
+        return true;
+    }
+    return false;
+}
+
+size_t rawRowBytes(const RawLayout &layout) {
+    size_t width = static_cast<size_t>(layout.width);
+    if (layout.packing == RawPacking::None) {
+        return width * 2;
+    }
+    return layout.bits == 10 ? width * 5 / 4 : width * 3 / 2;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// --- Raw Bayer frame view ---
+// Non-owning view of a sensor's raw Bayer frame, as delivered next to the
+// processed frame, with the calibration that goes into a DNG.
+
+enum class BayerOrder { RGGB, GRBG, GBRG, BGGR };
+
+enum class RawPacking {
+    None,  // One sample per little-endian 16-bit word, in the low bits
+    Csi2,  // MIPI CSI-2: four 10-bit or two 12-bit samples, then their low bits
+};
+
+struct RawLayout {
+    int width = 0;   // 0 = no raw frame
+    int height = 0;
+    int stride = 0;  // Bytes per row
+    BayerOrder order = BayerOrder::RGGB;
+    int bits = 0;    // Significant bits per sample
+    RawPacking packing = RawPacking::None;
+};
+
+struct RawFrame {
+    const uint8_t *data = nullptr;  // Null without a raw frame
+    RawLayout layout;
+
+    // Sensor calibration, zero where the source reports none
+    int32_t blackLevels[4] = {0, 0, 0, 0};  // Per CFA channel (R, Gr, Gb, B), 16-bit scale
+    float colourGains[2] = {0, 0};          // Red and blue white balance gains
+    float colourMatrix[9] = {0};            // Camera RGB to sRGB, row-major
+};
+
+// Layout of a libcamera raw pixel format name such as "SRGGB10_CSI2P" or
+// "SBGGR16". Width, height and stride are left alone.
+bool parseRawFormat(const std::string &name, RawLayout &layout);
+
+// Bytes a row of `width` samples takes with the given packing
+size_t rawRowBytes(const RawLayout &layout);
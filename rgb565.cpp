@@ -0,0 +1,208 @@
+#include "rgb565.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// acc[i] += row[i]
+void accumulateRow(uint16_t *acc, const uint8_t *row, int count) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16) {
+        uint8x16_t v = vld1q_u8(row + i);
+        vst1q_u16(acc + i, vaddw_u8(vld1q_u16(acc + i), vget_low_u8(v)));
+        vst1q_u16(acc + i + 8, vaddw_u8(vld1q_u16(acc + i + 8), vget_high_u8(v)));
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        __m128i *a = reinterpret_cast<__m128i *>(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), _mm_unpacklo_epi8(v, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1), _mm_unpackhi_epi8(v, zero)));
+    }
+#endif
+    for (; i < count; i++) {
+        acc[i] += row[i];
+    }
+}
+
+// Pack 8-bit channels into RGB565
+void packRow(const uint16_t *r, const uint16_t *g, const uint16_t *b, uint16_t *out, int count, bool swapBytes) {
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        uint16x8_t p = vorrq_u16(vorrq_u16(vshlq_n_u16(vshrq_n_u16(vld1q_u16(r + i), 3), 11),
+                                           vshlq_n_u16(vshrq_n_u16(vld1q_u16(g + i), 2), 5)),
+                                 vshrq_n_u16(vld1q_u16(b + i), 3));
+        if (swapBytes) {
+            p = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(p)));
+        }
+        vst1q_u16(out + i, p);
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i rv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i));
+        __m128i gv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + i));
+        __m128i bv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+        __m128i p = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_srli_epi16(rv, 3), 11),
+                                              _mm_slli_epi16(_mm_srli_epi16(gv, 2), 5)),
+                                 _mm_srli_epi16(bv, 3));
+        if (swapBytes) {
+            p = _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), p);
+    }
+#endif
+    for (; i < count; i++) {
+        uint16_t p = static_cast<uint16_t>(((r[i] >> 3) << 11) | ((g[i] >> 2) << 5) | (b[i] >> 3));
+        out[i] = swapBytes ? static_cast<uint16_t>((p << 8) | (p >> 8)) : p;
+    }
+}
+
+constexpr int METER_DEPTH = 8;  // Pixels, from the bottom edge of the picture
+
+uint16_t panelOrder(uint16_t pixel, bool swapBytes) {
+    return swapBytes ? static_cast<uint16_t>((pixel << 8) | (pixel >> 8)) : pixel;
+}
+
+}  // namespace
+
+void renderRgb565(const uint8_t *rgb, int width, int height,
+                  uint16_t *out, int outWidth, int outHeight, bool swapBytes) {
+    // Centre crop to a square
+    int srcSize = std::min(width, height);
+    int srcX = (width - srcSize) / 2;
+    int srcY = (height - srcSize) / 2;
+
+    // Rotating 90 degrees clockwise puts source rows in output columns
+    // (right to left) and source columns in output rows. Averaged source
+    // rows are taken in bands, one per output column.
+    int bands = outWidth;
+    int cells = outHeight;
+
+    // Source column span of each cell, and a reciprocal for its area
+    std::vector<int> cellBegin(cells + 1);
+    for (int c = 0; c <= cells; c++) {
+        cellBegin[c] = static_cast<int>(static_cast<int64_t>(c) * srcSize / cells);
+    }
+
+    std::vector<uint16_t> acc(static_cast<size_t>(srcSize) * 3);
+    std::vector<uint16_t> channels(static_cast<size_t>(cells) * 3);
+    std::vector<uint16_t> packed(cells);
+    uint16_t *r = channels.data();
+    uint16_t *g = r + cells;
+    uint16_t *b = g + cells;
+
+    for (int band = 0; band < bands; band++) {
+        int y0 = static_cast<int>(static_cast<int64_t>(band) * srcSize / bands);
+        int y1 = std::max(y0 + 1, static_cast<int>(static_cast<int64_t>(band + 1) * srcSize / bands));
+        // 16-bit sums hold up to 257 rows of 255
+        y1 = std::min(y1, y0 + 257);
+
+        std::fill(acc.begin(), acc.end(), 0);
+        for (int y = y0; y < y1; y++) {
+            accumulateRow(acc.data(), rgb + (static_cast<size_t>(srcY + y) * width + srcX) * 3, srcSize * 3);
+        }
+
+        for (int c = 0; c < cells; c++) {
+            int x0 = cellBegin[c];
+            int x1 = std::max(x0 + 1, cellBegin[c + 1]);
+            uint32_t sums[3] = {0, 0, 0};
+            for (int x = x0; x < x1; x++) {
+                sums[0] += acc[x * 3];
+                sums[1] += acc[x * 3 + 1];
+                sums[2] += acc[x * 3 + 2];
+            }
+            uint32_t area = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+            uint32_t reciprocal = (65536 + area / 2) / area;
+            r[c] = static_cast<uint16_t>(std::min<uint32_t>((sums[0] * reciprocal + 32768) >> 16, 255));
+            g[c] = static_cast<uint16_t>(std::min<uint32_t>((sums[1] * reciprocal + 32768) >> 16, 255));
+            b[c] = static_cast<uint16_t>(std::min<uint32_t>((sums[2] * reciprocal + 32768) >> 16, 255));
+        }
+
+        packRow(r, g, b, packed.data(), cells, swapBytes);
+
+        // Band `band` is output column outWidth - 1 - band
+        uint16_t *column = out + (outWidth - 1 - band);
+        for (int c = 0; c < cells; c++) {
+            column[static_cast<size_t>(c) * outWidth] = packed[c];
+        }
+    }
+}
+
+void renderYuv420Rgb565(const YuvFrame &src, uint16_t *out, int outWidth, int outHeight, bool swapBytes) {
+    int srcSize = std::min(src.width, src.height) & ~1;
+    int srcX = ((src.width - srcSize) / 2) & ~1;
+    int srcY = ((src.height - srcSize) / 2) & ~1;
+
+    // Source column of each cell, at its centre
+    int cells = outHeight;
+    std::vector<int> cellX(cells);
+    for (int c = 0; c < cells; c++) {
+        cellX[c] = srcX + static_cast<int>((static_cast<int64_t>(c) * 2 + 1) * srcSize / (2 * cells));
+    }
+
+    std::vector<uint16_t> channels(static_cast<size_t>(cells) * 3);
+    std::vector<uint16_t> packed(cells);
+    uint16_t *r = channels.data();
+    uint16_t *g = r + cells;
+    uint16_t *b = g + cells;
+
+    for (int band = 0; band < outWidth; band++) {
+        int y = srcY + static_cast<int>((static_cast<int64_t>(band) * 2 + 1) * srcSize / (2 * outWidth));
+        const uint8_t *luma = src.planes[0] + static_cast<size_t>(y) * src.strides[0];
+        const uint8_t *cb = src.planes[1] + static_cast<size_t>(y / 2) * src.strides[1];
+        const uint8_t *cr = src.planes[2] + static_cast<size_t>(y / 2) * src.strides[2];
+
+        for (int c = 0; c < cells; c++) {
+            int x = cellX[c];
+            // 16.16 fixed point BT.601 coefficients
+            int l = luma[x] << 16;
+            int u = cb[x / 2] - 128;
+            int v = cr[x / 2] - 128;
+            r[c] = static_cast<uint16_t>(std::clamp((l + 91881 * v + 32768) >> 16, 0, 255));
+            g[c] = static_cast<uint16_t>(std::clamp((l - 22554 * u - 46802 * v + 32768) >> 16, 0, 255));
+            b[c] = static_cast<uint16_t>(std::clamp((l + 116130 * u + 32768) >> 16, 0, 255));
+        }
+
+        packRow(r, g, b, packed.data(), cells, swapBytes);
+
+        uint16_t *column = out + (outWidth - 1 - band);
+        for (int c = 0; c < cells; c++) {
+            column[static_cast<size_t>(c) * outWidth] = packed[c];
+        }
+    }
+}
+
+void drawExposureMeterRgb565(uint16_t *out, int outWidth, int outHeight, float ev, int range,
+                             bool clipping, bool swapBytes) {
+    // The picture is rotated clockwise: its bottom edge is the panel's first
+    // columns, and its left to right runs down the panel rows
+    int depth = std::min(METER_DEPTH, outWidth);
+    auto fill = [&](int from, int to, int columns, uint16_t colour) {
+        for (int row = std::max(from, 0); row < std::min(to, outHeight); row++) {
+            std::fill_n(out + static_cast<size_t>(row) * outWidth, columns, panelOrder(colour, swapBytes));
+        }
+    };
+    auto position = [&](float stops) {
+        return static_cast<int>((stops + range) * (outHeight - 1) / (2 * range) + 0.5f);
+    };
+
+    fill(0, outHeight, depth, 0x0000);
+    for (int stop = -range; stop <= range; stop++) {
+        fill(position(static_cast<float>(stop)), position(static_cast<float>(stop)) + 1,
+             stop == 0 ? depth : depth / 2, 0x8410);
+    }
+    uint16_t colour = clipping ? 0xF800 : std::fabs(ev) <= 1.0f / 3 ? 0x07E0 : 0xFD20;
+    int marker = position(std::clamp(ev, static_cast<float>(-range), static_cast<float>(range)));
+    fill(marker - 2, marker + 3, depth, colour);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+#include "yuv_frame.h"
+
+// --- RGB565 preview kernels ---
+// Turn a decoded RGB888 image or a camera frame into a frame for the LCD in
+// one pass: centre-crop to a square, scale to the panel size, rotate 90
+// degrees clockwise and pack as RGB565. Row accumulation and packing use
+// NEON or SSE2 when available, with a scalar fallback.
+
+// Area-averaged. `out` is outWidth x outHeight, row-major. swapBytes stores each pixel
+// high byte first, for panels fed straight from memory.
+void renderRgb565(const uint8_t *rgb, int width, int height,
+                  uint16_t *out, int outWidth, int outHeight, bool swapBytes);
+
+// Same for a YUV420 frame (full-range BT.601, as the camera delivers),
+// sampled rather than averaged: viewfinder frames arrive close to panel size.
+void renderYuv420Rgb565(const YuvFrame &src, uint16_t *out, int outWidth, int outHeight, bool swapBytes);
+
+// Exposure meter along the bottom edge of a frame drawn by the functions
+// above: a scale of whole stops from -range to +range with a marker at `ev`,
+// green when within a third of a stop, amber outside it, red when `clipping`.
+void drawExposureMeterRgb565(uint16_t *out, int outWidth, int outHeight, float ev, int range,
+                             bool clipping, bool swapBytes);
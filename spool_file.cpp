@@ -0,0 +1,361 @@
+#include "spool_file.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "yuv_scale.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr char MAGIC[4] = {'M', 'P', 'I', 'S'};
+constexpr uint16_t VERSION = 1;
+constexpr size_t MAX_TEXT = 255;      // Longest name or timestamp kept
+constexpr size_t HEADER_BOUND = 32 + 2 * (2 + MAX_TEXT);
+constexpr int MAX_STRIPS = 64;
+constexpr int BLOCK = 16;             // Pixels per bit-packed block
+constexpr size_t STRIP_SLACK = 8;     // Blocks are stored with 8-byte writes
+
+// --- Little-endian fields ---
+void put16(uint8_t *&p, uint16_t v) {
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+    p += 2;
+}
+
+void put32(uint8_t *&p, uint32_t v) {
+    put16(p, static_cast<uint16_t>(v));
+    put16(p, static_cast<uint16_t>(v >> 16));
+}
+
+void putText(uint8_t *&p, const std::string &text) {
+    size_t length = std::min(text.size(), MAX_TEXT);
+    put16(p, static_cast<uint16_t>(length));
+    memcpy(p, text.data(), length);
+    p += length;
+}
+
+struct Reader {
+    const uint8_t *p;
+    const uint8_t *end;
+
+    bool has(size_t n) const { return static_cast<size_t>(end - p) >= n; }
+    uint16_t get16() {
+        uint16_t v = static_cast<uint16_t>(p[0] | p[1] << 8);
+        p += 2;
+        return v;
+    }
+    uint32_t get32() {
+        uint32_t lo = get16();
+        return lo | static_cast<uint32_t>(get16()) << 16;
+    }
+    bool getText(std::string &text) {
+        if (!has(2)) {
+            return false;
+        }
+        uint16_t length = get16();
+        if (!has(length)) {
+            return false;
+        }
+        text.assign(reinterpret_cast<const char *>(p), length);
+        p += length;
+        return true;
+    }
+};
+
+// --- Row coding ---
+size_t rowBound(int width) {
+    int blocks = (width + BLOCK - 1) / BLOCK;
+    return static_cast<size_t>(blocks + 1) / 2 + static_cast<size_t>(blocks) * BLOCK;
+}
+
+// Folded left differences of a row into `out` (padded with zeros to whole
+// blocks), and the OR of each block's values into `widths`
+void foldRow(const uint8_t *row, const uint8_t *above, int width, uint8_t *out, uint8_t *widths) {
+    int blocks = (width + BLOCK - 1) / BLOCK;
+    out[0] = static_cast<uint8_t>(row[0] - (above ? above[0] : 128));
+    int x = 1;
+#if defined(__ARM_NEON)
+    for (; x + BLOCK <= width; x += BLOCK) {
+        int8x16_t d = vreinterpretq_s8_u8(vsubq_u8(vld1q_u8(row + x), vld1q_u8(row + x - 1)));
+        vst1q_u8(out + x, vreinterpretq_u8_s8(d));
+    }
+#elif defined(__SSE2__)
+    for (; x + BLOCK <= width; x += BLOCK) {
+        __m128i d = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x)),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x - 1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), d);
+    }
+#endif
+    for (; x < width; x++) {
+        out[x] = static_cast<uint8_t>(row[x] - row[x - 1]);
+    }
+    std::fill(out + width, out + blocks * BLOCK, 0);
+
+    // Zigzag: 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+    for (int b = 0; b < blocks; b++) {
+        uint8_t *v = out + b * BLOCK;
+#if defined(__ARM_NEON)
+        int8x16_t d = vreinterpretq_s8_u8(vld1q_u8(v));
+        uint8x16_t z = veorq_u8(vreinterpretq_u8_s8(vshlq_n_s8(d, 1)), vreinterpretq_u8_s8(vshrq_n_s8(d, 7)));
+        vst1q_u8(v, z);
+        uint8x8_t m = vpmax_u8(vget_low_u8(z), vget_high_u8(z));
+        m = vpmax_u8(m, m);
+        m = vpmax_u8(m, m);
+        m = vpmax_u8(m, m);
+        widths[b] = vget_lane_u8(m, 0);
+#elif defined(__SSE2__)
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(v));
+        __m128i sign = _mm_cmpgt_epi8(_mm_setzero_si128(), d);
+        __m128i z = _mm_xor_si128(_mm_add_epi8(d, d), sign);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(v), z);
+        __m128i m = _mm_max_epu8(z, _mm_srli_si128(z, 8));
+        m = _mm_max_epu8(m, _mm_srli_si128(m, 4));
+        m = _mm_max_epu8(m, _mm_srli_si128(m, 2));
+        m = _mm_max_epu8(m, _mm_srli_si128(m, 1));
+        widths[b] = static_cast<uint8_t>(_mm_cvtsi128_si32(m));
+#else
+        uint8_t m = 0;
+        for (int i = 0; i < BLOCK; i++) {
+            int8_t d = static_cast<int8_t>(v[i]);
+            v[i] = static_cast<uint8_t>((d * 2) ^ (d >> 7));
+            m = std::max(m, v[i]);
+        }
+        widths[b] = m;
+#endif
+    }
+}
+
+int bitWidth(uint8_t value) {
+    int bits = 0;
+    while (value >> bits) {
+        bits++;
+    }
+    return bits;
+}
+
+// Pairs of blocks: a byte with both widths, then each block as two halves of
+// eight values at `width` bits, `width` bytes each
+uint8_t *packRow(const uint8_t *row, const uint8_t *above, int width, uint8_t *folded, uint8_t *widths,
+                 uint8_t *out) {
+    foldRow(row, above, width, folded, widths);
+    int blocks = (width + BLOCK - 1) / BLOCK;
+    for (int b = 0; b < blocks; b += 2) {
+        int w0 = bitWidth(widths[b]);
+        int w1 = b + 1 < blocks ? bitWidth(widths[b + 1]) : 0;
+        *out++ = static_cast<uint8_t>(w0 | w1 << 4);
+        for (int k = 0; k < 2 && b + k < blocks; k++) {
+            int bits = k ? w1 : w0;
+            const uint8_t *v = folded + (b + k) * BLOCK;
+            for (int half = 0; half < 2; half++, v += BLOCK / 2) {
+                uint64_t word = 0;
+                for (int i = 0; i < BLOCK / 2; i++) {
+                    word |= static_cast<uint64_t>(v[i]) << (i * bits);
+                }
+                memcpy(out, &word, sizeof(word));  // Little-endian
+                out += bits;
+            }
+        }
+    }
+    return out;
+}
+
+const uint8_t *unpackRow(const uint8_t *in, const uint8_t *end, const uint8_t *above, int width, uint8_t *row) {
+    int blocks = (width + BLOCK - 1) / BLOCK;
+    int prev = above ? above[0] : 128;
+    int x = 0;
+    for (int b = 0; b < blocks; b += 2) {
+        if (in >= end) {
+            return nullptr;
+        }
+        int widths[2] = {*in & 15, *in >> 4};
+        in++;
+        for (int k = 0; k < 2 && b + k < blocks; k++) {
+            int bits = widths[k];
+            if (bits > 8 || end - in < 2 * bits) {
+                return nullptr;
+            }
+            uint64_t mask = (uint64_t{1} << bits) - 1;
+            for (int half = 0; half < 2; half++) {
+                uint64_t word = 0;
+                memcpy(&word, in, static_cast<size_t>(bits));
+                in += bits;
+                for (int i = 0; i < BLOCK / 2; i++, x++) {
+                    int z = static_cast<int>((word >> (i * bits)) & mask);
+                    prev = (prev + ((z >> 1) ^ -(z & 1))) & 255;
+                    if (x < width) {
+                        row[x] = static_cast<uint8_t>(prev);
+                    }
+                }
+            }
+        }
+    }
+    return in;
+}
+
+// Luma rows [row0, row1) of each strip, even so chroma rows split with them
+void stripRows(int height, int strips, int strip, int &row0, int &row1) {
+    int rows = ((height + strips - 1) / strips + 1) & ~1;
+    row0 = std::min(strip * rows, height);
+    row1 = std::min(row0 + rows, height);
+}
+
+struct Plane {
+    int width;
+    int row0;
+    int row1;
+};
+
+void stripPlanes(int width, int height, int strips, int strip, Plane planes[3]) {
+    int row0, row1;
+    stripRows(height, strips, strip, row0, row1);
+    planes[0] = {width, row0, row1};
+    planes[1] = planes[2] = {width / 2, row0 / 2, row1 / 2};
+}
+
+size_t stripBound(int width, int height, int strips, int strip) {
+    Plane planes[3];
+    stripPlanes(width, height, strips, strip, planes);
+    size_t bound = STRIP_SLACK;
+    for (const Plane &plane : planes) {
+        bound += rowBound(plane.width) * (plane.row1 - plane.row0);
+    }
+    return bound;
+}
+
+}  // namespace
+
+size_t spoolFileBound(int width, int height) {
+    size_t bound = HEADER_BOUND + MAX_STRIPS * (4 + STRIP_SLACK);
+    bound += rowBound(width) * height + 2 * rowBound(width / 2) * (height / 2);
+    return bound;
+}
+
+size_t packSpoolFile(WorkerPool &pool, const YuvFrame &frame, const SpoolInfo &info, uint8_t *out) {
+    int width = frame.width & ~1;
+    int height = frame.height & ~1;
+    int strips = std::clamp(static_cast<int>(pool.concurrency()), 1, std::min(MAX_STRIPS, std::max(1, height / 2)));
+
+    uint8_t *p = out;
+    memcpy(p, MAGIC, sizeof(MAGIC));
+    p += sizeof(MAGIC);
+    put16(p, VERSION);
+    put16(p, static_cast<uint16_t>(strips));
+    put32(p, static_cast<uint32_t>(width));
+    put32(p, static_cast<uint32_t>(height));
+    put32(p, static_cast<uint32_t>(info.exposureTimeUs));
+    uint32_t gain;
+    memcpy(&gain, &info.analogueGain, sizeof(gain));
+    put32(p, gain);
+    putText(p, info.name);
+    putText(p, info.timestamp);
+    uint8_t *sizes = p;
+    p += 4 * strips;
+
+    // Each strip packs into its own worst-case region, then they are closed up
+    std::vector<uint8_t *> starts(strips);
+    std::vector<size_t> lengths(strips);
+    starts[0] = p;
+    for (int s = 1; s < strips; s++) {
+        starts[s] = starts[s - 1] + stripBound(width, height, strips, s - 1);
+    }
+    pool.parallelFor(static_cast<size_t>(strips), [&](size_t s) {
+        std::vector<uint8_t> folded(static_cast<size_t>(width + BLOCK) / BLOCK * BLOCK);
+        std::vector<uint8_t> widths(folded.size() / BLOCK);
+        Plane planes[3];
+        stripPlanes(width, height, strips, static_cast<int>(s), planes);
+        uint8_t *q = starts[s];
+        for (int i = 0; i < 3; i++) {
+            for (int y = planes[i].row0; y < planes[i].row1; y++) {
+                const uint8_t *row = frame.planes[i] + static_cast<size_t>(y) * frame.strides[i];
+                const uint8_t *above = y > planes[i].row0 ? row - frame.strides[i] : nullptr;
+                q = packRow(row, above, planes[i].width, folded.data(), widths.data(), q);
+            }
+        }
+        lengths[s] = static_cast<size_t>(q - starts[s]);
+    });
+
+    for (int s = 0; s < strips; s++) {
+        memmove(p, starts[s], lengths[s]);
+        p += lengths[s];
+        uint8_t *field = sizes + 4 * s;
+        put32(field, static_cast<uint32_t>(lengths[s]));
+    }
+    return static_cast<size_t>(p - out);
+}
+
+namespace {
+
+bool readHeader(Reader &r, int &width, int &height, int &strips, SpoolInfo &info) {
+    if (!r.has(sizeof(MAGIC) + 20) || memcmp(r.p, MAGIC, sizeof(MAGIC)) != 0) {
+        return false;
+    }
+    r.p += sizeof(MAGIC);
+    if (r.get16() != VERSION) {
+        return false;
+    }
+    strips = r.get16();
+    width = static_cast<int>(r.get32());
+    height = static_cast<int>(r.get32());
+    info.exposureTimeUs = static_cast<int32_t>(r.get32());
+    uint32_t gain = r.get32();
+    memcpy(&info.analogueGain, &gain, sizeof(gain));
+    return strips > 0 && strips <= MAX_STRIPS && width > 0 && height > 0 && width % 2 == 0 &&
+           height % 2 == 0 && width <= 1 << 16 && height <= 1 << 16 && r.getText(info.name) &&
+           r.getText(info.timestamp);
+}
+
+}  // namespace
+
+bool readSpoolHeader(const uint8_t *data, size_t size, int &width, int &height, SpoolInfo &info) {
+    Reader r{data, data + size};
+    int strips;
+    return readHeader(r, width, height, strips, info);
+}
+
+bool unpackSpoolFile(WorkerPool &pool, const uint8_t *data, size_t size, uint8_t *yuv) {
+    Reader r{data, data + size};
+    int width, height, strips;
+    SpoolInfo info;
+    if (!readHeader(r, width, height, strips, info) || !r.has(4 * static_cast<size_t>(strips))) {
+        return false;
+    }
+    std::vector<const uint8_t *> starts(strips);
+    std::vector<size_t> lengths(strips);
+    const uint8_t *p = r.p + 4 * strips;
+    for (int s = 0; s < strips; s++) {
+        lengths[s] = r.get32();
+        starts[s] = p;
+        if (static_cast<size_t>(r.end - p) < lengths[s]) {
+            return false;
+        }
+        p += lengths[s];
+    }
+
+    YuvFrame frame = packedYuv420(yuv, width, height);
+    std::atomic<bool> ok{true};
+    pool.parallelFor(static_cast<size_t>(strips), [&](size_t s) {
+        Plane planes[3];
+        stripPlanes(width, height, strips, static_cast<int>(s), planes);
+        const uint8_t *q = starts[s];
+        const uint8_t *end = q + lengths[s];
+        for (int i = 0; i < 3 && q; i++) {
+            for (int y = planes[i].row0; y < planes[i].row1 && q; y++) {
+                uint8_t *row = const_cast<uint8_t *>(frame.planes[i]) + static_cast<size_t>(y) * frame.strides[i];
+                const uint8_t *above = y > planes[i].row0 ? row - frame.strides[i] : nullptr;
+                q = unpackRow(q, end, above, planes[i].width, row);
+            }
+        }
+        if (!q) {
+            ok = false;
+        }
+    });
+    return ok;
+}
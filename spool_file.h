@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "worker_pool.h"
+#include "yuv_frame.h"
+
+// --- Spool files ---
+// A capture held losslessly until it is encoded as a JPEG, for deferred
+// encoding. Each plane row is stored as its differences from the pixel to the
+// left (the first from the pixel above), folded to small unsigned values and
+// bit-packed in blocks of 16 at the width of the block's largest value. That
+// runs at close to memory speed and typically halves camera frames.
+//
+// The frame is cut into strips of rows that are packed and unpacked
+// independently on the worker pool. A file is a little-endian header (size,
+// capture info and strip sizes) followed by the strips.
+
+constexpr char SPOOL_EXTENSION[] = ".spool";
+
+struct SpoolInfo {
+    std::string name;  // File name stem of the capture
+    int32_t exposureTimeUs = 0;
+    float analogueGain = 0;
+    std::string timestamp;  // EXIF DateTime
+};
+
+// Worst-case size of a spool file for a frame of this size
+size_t spoolFileBound(int width, int height);
+
+// Pack a frame (even width and height) into `out`, at least spoolFileBound()
+// bytes. Returns the file's size.
+size_t packSpoolFile(WorkerPool &pool, const YuvFrame &frame, const SpoolInfo &info, uint8_t *out);
+
+// Read a spool file's frame size and capture info. False if it is not a
+// spool file or is cut short.
+bool readSpoolHeader(const uint8_t *data, size_t size, int &width, int &height, SpoolInfo &info);
+
+// Unpack a spool file into a packedYuv420() frame in `yuv`, of
+// yuv420Size(width, height) bytes. False if the file is damaged.
+bool unpackSpoolFile(WorkerPool &pool, const uint8_t *data, size_t size, uint8_t *yuv);
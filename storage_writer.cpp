@@ -0,0 +1,258 @@
+#include "storage_writer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr const char *TEMP_PREFIX = ".";
+constexpr const char *TEMP_SUFFIX = ".tmp";
+constexpr int MAX_NAME_ATTEMPTS = 1000;
+constexpr size_t STREAM_CHUNK_SIZE = 1 << 20;
+
+// Rename without replacing an existing file. Falls back to a plain rename on
+// filesystems without RENAME_NOREPLACE, after checking for the target.
+int renameNoReplace(const std::string &from, const std::string &to) {
+#ifdef RENAME_NOREPLACE
+    if (renameat2(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), RENAME_NOREPLACE) == 0) {
+        return 0;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        return -1;
+    }
+#endif
+    if (access(to.c_str(), F_OK) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return rename(from.c_str(), to.c_str());
+}
+
+}  // namespace
+
+// --- Content hash ---
+void ContentHash::update(const uint8_t *data, size_t size) {
+    // Finish the word the last call left partial
+    while (tailBytes_ > 0 && size > 0) {
+        tail_ |= static_cast<uint64_t>(*data++) << (8 * tailBytes_);
+        size--;
+        if (++tailBytes_ == 8) {
+            mix(tail_);
+            tail_ = 0;
+            tailBytes_ = 0;
+        }
+    }
+    // Little-endian loads, as on the Pi
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        mix(word);
+    }
+    for (; size > 0; size--) {
+        tail_ |= static_cast<uint64_t>(*data++) << (8 * tailBytes_++);
+    }
+}
+
+uint64_t ContentHash::digest() const {
+    ContentHash last = *this;
+    if (last.tailBytes_ > 0) {
+        last.mix(last.tail_);
+    }
+    return last.hash_;
+}
+
+// --- Storage writer ---
+StorageWriter::StorageWriter(std::string directory, FsyncPolicy policy)
+    : directory_(std::move(directory)), policy_(policy) {}
+
+StorageWriter::~StorageWriter() {
+    stop();
+}
+
+void StorageWriter::start() {
+    stopping_ = false;
+    thread_ = std::thread(&StorageWriter::threadFunc, this);
+}
+
+void StorageWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void StorageWriter::submit(WriteJob job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push(std::move(job));
+    }
+    cv_.notify_one();
+}
+
+void StorageWriter::removeStaleTempFiles() const {
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(directory_, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind(TEMP_PREFIX, 0) == 0 && name.size() > strlen(TEMP_SUFFIX) &&
+            name.compare(name.size() - strlen(TEMP_SUFFIX), std::string::npos, TEMP_SUFFIX) == 0) {
+            std::cout << "Removing incomplete file " << name << std::endl;
+            fs::remove(entry.path(), ec);
+        }
+    }
+}
+
+void StorageWriter::threadFunc() {
+    while (true) {
+        WriteJob job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                break;  // Stopping and drained
+            }
+            job = std::move(queue_.front());
+            queue_.pop();
+        }
+
+        WriteResult result;
+        result.started = std::chrono::steady_clock::now();
+        result.ok = commit(job, result);
+        result.finished = std::chrono::steady_clock::now();
+        if (job.onDone) {
+            job.onDone(result);
+        }
+    }
+}
+
+bool StorageWriter::writeSegments(int fd, const std::vector<WriteJob::Segment> &segments, size_t &bytes,
+                                  ContentHash &hash) {
+    std::vector<iovec> iov;
+    bytes = 0;
+    for (const auto &segment : segments) {
+        iov.push_back({const_cast<uint8_t *>(segment.data), segment.size});
+        bytes += segment.size;
+        hash.update(segment.data, segment.size);  // Still in cache from encoding
+    }
+
+    // writev() may stop short; advance through the vector until done
+    size_t index = 0;
+    while (index < iov.size()) {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - index, IOV_MAX));
+        ssize_t written = writev(fd, &iov[index], count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        size_t remaining = static_cast<size_t>(written);
+        while (index < iov.size() && remaining >= iov[index].iov_len) {
+            remaining -= iov[index].iov_len;
+            index++;
+        }
+        if (remaining > 0) {
+            iov[index].iov_base = static_cast<uint8_t *>(iov[index].iov_base) + remaining;
+            iov[index].iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+bool StorageWriter::writeStream(int fd, WriteJob &job, size_t &bytes, ContentHash &hash) {
+    if (staging_.empty()) {
+        staging_.resize(STREAM_CHUNK_SIZE);
+    }
+    bytes = 0;
+    while (size_t produced = job.stream(staging_.data(), staging_.size())) {
+        hash.update(staging_.data(), produced);
+        size_t done = 0;
+        while (done < produced) {
+            ssize_t written = write(fd, staging_.data() + done, produced - done);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            done += static_cast<size_t>(written);
+        }
+        bytes += produced;
+    }
+    return true;
+}
+
+bool StorageWriter::commit(WriteJob &job, WriteResult &result) {
+    std::string &path = result.path;
+    size_t &bytes = result.bytes;
+    std::string fileName = job.stem + job.extension;
+    std::string tempPath = directory_ + "/" + TEMP_PREFIX + fileName + TEMP_SUFFIX;
+
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to open output file " << tempPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Reserve the blocks up front so the card sees one contiguous extent
+    size_t total = job.streamSize;
+    for (const auto &segment : job.segments) {
+        total += segment.size;
+    }
+    posix_fallocate(fd, 0, static_cast<off_t>(total));
+
+    ContentHash hash;
+    bool ok = writeSegments(fd, job.segments, bytes, hash);
+    if (ok && job.stream) {
+        size_t streamed = 0;
+        ok = writeStream(fd, job, streamed, hash);
+        bytes += streamed;
+    }
+    result.hash = hash.digest();
+    if (ok && policy_ != FsyncPolicy::None && fsync(fd) < 0) {
+        ok = false;
+    }
+    if (close(fd) < 0) {
+        ok = false;
+    }
+    if (!ok) {
+        std::cerr << "Failed to write " << tempPath << ": " << strerror(errno) << std::endl;
+        unlink(tempPath.c_str());
+        return false;
+    }
+
+    // Pick the first free name; the rename itself refuses to replace a file
+    for (int attempt = 0; attempt < MAX_NAME_ATTEMPTS; attempt++) {
+        path = directory_ + "/" + job.stem + (attempt ? "_" + std::to_string(attempt) : "") + job.extension;
+        if (renameNoReplace(tempPath, path) == 0) {
+            if (policy_ == FsyncPolicy::FileAndDir) {
+                int dirFd = open(directory_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (dirFd >= 0) {
+                    fsync(dirFd);
+                    close(dirFd);
+                }
+            }
+            return true;
+        }
+        if (errno != EEXIST) {
+            break;
+        }
+    }
+
+    std::cerr << "Failed to commit " << tempPath << ": " << strerror(errno) << std::endl;
+    unlink(tempPath.c_str());
+    return false;
+}
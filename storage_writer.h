@@ -0,0 +1,100 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+// --- Storage writer ---
+// Dedicated thread that puts encoded captures on storage, so slow SD card
+// writes never stall encoding. Each file is written to a hidden temp file in
+// the target directory, optionally fsynced, and renamed into place, so the
+// directory only ever contains complete files. Names are made unique at
+// commit time: "<stem>.jpg", then "<stem>_1.jpg", "<stem>_2.jpg", ...
+
+enum class FsyncPolicy {
+    None,        // Leave flushing to the kernel
+    File,        // fsync the file before it is renamed into place
+    FileAndDir,  // Also fsync the directory after the rename
+};
+
+// 64-bit FNV-1a over 8-byte little-endian words, the last one zero-padded.
+// A word at a time, so it is cheap enough to take of every file while it is
+// written; it tells copies apart, it is not for security.
+class ContentHash {
+public:
+    void update(const uint8_t *data, size_t size);
+    uint64_t digest() const;
+
+private:
+    void mix(uint64_t word) { hash_ = (hash_ ^ word) * 1099511628211ull; }
+
+    uint64_t hash_ = 14695981039346656037ull;
+    uint64_t tail_ = 0;  // A partial word from the last update()
+    int tailBytes_ = 0;
+};
+
+struct WriteResult {
+    std::string path;  // Final name of the committed file
+    size_t bytes = 0;
+    uint64_t hash = 0;  // ContentHash of the file
+    bool ok = false;
+    std::chrono::steady_clock::time_point started;   // Writer picked the job up
+    std::chrono::steady_clock::time_point finished;  // File committed (or failed)
+};
+
+struct WriteJob {
+    struct Segment {
+        const uint8_t *data;
+        size_t size;
+    };
+
+    std::string stem;                           // File name without suffix or extension
+    std::string extension;                      // e.g. ".jpg"
+    std::vector<Segment> segments;              // Written back to back
+    std::vector<std::vector<uint8_t>> storage;  // Bytes owned by the job, referenced by segments
+    // Optional tail produced while it is written, after the segments: called
+    // on the writer thread to fill up to `capacity` bytes, returning how many
+    // it wrote and 0 at the end. streamSize is what it will produce in total.
+    std::function<size_t(uint8_t *buffer, size_t capacity)> stream;
+    size_t streamSize = 0;
+    // Called on the writer thread once the file is committed (or failed), so
+    // the submitter can release the buffers behind the segments
+    std::function<void(const WriteResult &result)> onDone;
+};
+
+class StorageWriter {
+public:
+    StorageWriter(std::string directory, FsyncPolicy policy);
+    ~StorageWriter();
+
+    void start();
+    // Write everything still queued, then stop the thread
+    void stop();
+
+    void submit(WriteJob job);
+
+    // Delete temp files left behind by an interrupted run
+    void removeStaleTempFiles() const;
+
+private:
+    void threadFunc();
+    bool commit(WriteJob &job, WriteResult &result);
+    bool writeSegments(int fd, const std::vector<WriteJob::Segment> &segments, size_t &bytes, ContentHash &hash);
+    bool writeStream(int fd, WriteJob &job, size_t &bytes, ContentHash &hash);
+
+    std::string directory_;
+    FsyncPolicy policy_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::queue<WriteJob> queue_;
+    bool stopping_ = false;
+    std::vector<uint8_t> staging_;  // Stream buffer, writer thread only
+};
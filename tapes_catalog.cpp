@@ -0,0 +1,348 @@
+#include "tapes_catalog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr const char *CATALOG_NAME = ".catalog";
+constexpr const char *MANIFEST_NAME = ".manifest";
+constexpr char MAGIC[8] = {'M', 'P', 'I', 'C', 'A', 'T', '1', '\0'};
+constexpr size_t HEADER_SIZE = 16;  // Magic, record size, reserved
+constexpr size_t INITIAL_CAPACITY = 4096;
+
+bool writeAll(int fd, const void *data, size_t size) {
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+}  // namespace
+
+const char *catalogKindName(CatalogKind kind) {
+    switch (kind) {
+        case CatalogKind::Jpeg: return "jpeg";
+        case CatalogKind::Dng: return "dng";
+        case CatalogKind::Count: break;
+    }
+    return "unknown";
+}
+
+CatalogEntry catalogEntry(const std::string &path, uint64_t bytes, uint64_t hash) {
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    CatalogEntry entry;
+    snprintf(entry.name, sizeof(entry.name), "%s", name.c_str());
+    bool dng = name.size() > 4 && name.compare(name.size() - 4, 4, ".dng") == 0;
+    entry.kind = dng ? CatalogKind::Dng : CatalogKind::Jpeg;
+    entry.bytes = bytes;
+    entry.hash = hash;
+    return entry;
+}
+
+TapesCatalog::~TapesCatalog() {
+    close();
+}
+
+// --- Open ---
+bool TapesCatalog::open(const std::string &directory) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!openLocked(directory)) {
+        release();
+        return false;
+    }
+    return true;
+}
+
+bool TapesCatalog::openLocked(const std::string &directory) {
+    directory_ = directory;
+    std::string path = directory + "/" + CATALOG_NAME;
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    manifestFd_ = ::open((directory + "/" + MANIFEST_NAME).c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd_ < 0 || manifestFd_ < 0 || fstat(fd_, &st) < 0) {
+        std::cerr << "Failed to open catalog " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(st.st_size);
+    bool created = size < HEADER_SIZE;
+    if (created) {
+        char header[HEADER_SIZE] = {};
+        uint32_t recordSize = sizeof(CatalogEntry);
+        memcpy(header, MAGIC, sizeof(MAGIC));
+        memcpy(header + sizeof(MAGIC), &recordSize, sizeof(recordSize));
+        if (ftruncate(fd_, 0) < 0 || !writeAll(fd_, header, sizeof(header))) {
+            std::cerr << "Failed to create catalog " << path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        size = HEADER_SIZE;
+    } else {
+        char header[HEADER_SIZE] = {};
+        uint32_t recordSize = 0;
+        bool read = pread(fd_, header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+        memcpy(&recordSize, header + sizeof(MAGIC), sizeof(recordSize));
+        if (!read || memcmp(header, MAGIC, sizeof(MAGIC)) != 0 || recordSize != sizeof(CatalogEntry)) {
+            std::cerr << "Not a catalog, or another version: " << path << std::endl;
+            return false;
+        }
+    }
+
+    // A record cut short by a crash mid-append is dropped
+    count_ = (size - HEADER_SIZE) / sizeof(CatalogEntry);
+    if (HEADER_SIZE + count_ * sizeof(CatalogEntry) != size) {
+        std::cout << "Catalog: dropping an incomplete record" << std::endl;
+        if (ftruncate(fd_, static_cast<off_t>(HEADER_SIZE + count_ * sizeof(CatalogEntry))) < 0) {
+            return false;
+        }
+    }
+    if (!mapEntries(std::max(INITIAL_CAPACITY, count_ * 2))) {
+        return false;
+    }
+
+    // The newest of each kind is near the end
+    const CatalogEntry *entries = mappedEntries();
+    std::fill(std::begin(latest_), std::end(latest_), npos);
+    size_t missing = std::size(latest_);
+    for (size_t i = count_; i-- > 0 && missing > 0;) {
+        size_t &latest = latest_[static_cast<int>(entries[i].kind) % std::size(latest_)];
+        if (latest == npos) {
+            latest = i;
+            missing--;
+        }
+    }
+
+    if (created) {
+        size_t imported = importDirectory();
+        if (imported > 0) {
+            std::cout << "Catalog: imported " << imported << " files from " << directory << std::endl;
+        }
+    }
+    if (!syncManifest()) {
+        std::cerr << "Failed to update manifest: " << strerror(errno) << std::endl;
+    }
+    std::cout << "Catalog: " << count_ << " files" << std::endl;
+    return true;
+}
+
+void TapesCatalog::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    release();
+}
+
+void TapesCatalog::release() {
+    if (map_) {
+        munmap(map_, mapSize_);
+        map_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (manifestFd_ >= 0) {
+        ::close(manifestFd_);
+        manifestFd_ = -1;
+    }
+    count_ = 0;
+    capacity_ = 0;
+}
+
+const CatalogEntry *TapesCatalog::mappedEntries() const {
+    return reinterpret_cast<const CatalogEntry *>(static_cast<const char *>(map_) + HEADER_SIZE);
+}
+
+// Map room for `capacity` records, past the end of the file: pages beyond it
+// are never touched, and records appended with write() show up in the
+// mapping as they go in
+bool TapesCatalog::mapEntries(size_t capacity) {
+    if (map_) {
+        munmap(map_, mapSize_);
+        map_ = nullptr;
+    }
+    mapSize_ = HEADER_SIZE + capacity * sizeof(CatalogEntry);
+    void *map = mmap(nullptr, mapSize_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (map == MAP_FAILED) {
+        std::cerr << "Failed to map catalog: " << strerror(errno) << std::endl;
+        capacity_ = 0;
+        return false;
+    }
+    map_ = map;
+    capacity_ = capacity;
+    return true;
+}
+
+// Files already in the directory, oldest first
+size_t TapesCatalog::importDirectory() {
+    std::vector<std::tuple<time_t, std::string, CatalogEntry>> found;
+    std::error_code ec;
+    for (const auto &file : fs::directory_iterator(directory_, ec)) {
+        std::string extension = file.path().extension().string();
+        std::string name = file.path().filename().string();
+        struct stat st;
+        if ((extension != ".jpg" && extension != ".dng") || name.size() >= sizeof(CatalogEntry::name) ||
+            stat(file.path().c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        CatalogEntry entry = catalogEntry(name, static_cast<uint64_t>(st.st_size), 0);
+        std::tm tm;
+        localtime_r(&st.st_mtime, &tm);
+        strftime(entry.captureTime, sizeof(entry.captureTime), "%Y:%m:%d %H:%M:%S", &tm);
+        found.emplace_back(st.st_mtime, name, entry);
+    }
+    std::sort(found.begin(), found.end(), [](const auto &a, const auto &b) {
+        return std::tie(std::get<0>(a), std::get<1>(a)) < std::tie(std::get<0>(b), std::get<1>(b));
+    });
+    size_t imported = 0;
+    for (const auto &file : found) {
+        if (!appendLocked(std::get<2>(file))) {
+            break;
+        }
+        imported++;
+    }
+    return imported;
+}
+
+// --- Manifest ---
+bool TapesCatalog::writeManifestLine(const CatalogEntry &entry) {
+    char line[256];
+    int length = snprintf(line, sizeof(line), "%s\t%s\t%" PRIu64 "\t%s\t%" PRId32 "\t%.2f\t%016" PRIx64 "\n",
+                          entry.name, catalogKindName(entry.kind), entry.bytes, entry.captureTime,
+                          entry.exposureTimeUs, entry.analogueGain, entry.hash);
+    return writeAll(manifestFd_, line, static_cast<size_t>(std::min<int>(length, sizeof(line) - 1)));
+}
+
+// The manifest is appended after the catalog, so a crash between the two
+// leaves it short, or ending in part of a line; it is then completed from the
+// catalog. One that does not match is rewritten.
+bool TapesCatalog::syncManifest() {
+    size_t lines = 0;
+    char buffer[64 * 1024];
+    ssize_t got;
+    off_t offset = 0;
+    off_t complete = 0;  // End of the last whole line
+    while ((got = pread(manifestFd_, buffer, sizeof(buffer), offset)) > 0) {
+        for (ssize_t i = 0; i < got; i++) {
+            if (buffer[i] == '\n') {
+                lines++;
+                complete = offset + i + 1;
+            }
+        }
+        offset += got;
+    }
+    if (got < 0) {
+        return false;
+    }
+
+    size_t from = lines;
+    if (lines > count_) {
+        std::cout << "Catalog: manifest does not match, rewriting it" << std::endl;
+        complete = 0;
+        from = 0;
+    }
+    if (complete != offset && ftruncate(manifestFd_, complete) < 0) {
+        return false;
+    }
+    const CatalogEntry *entries = mappedEntries();
+    for (size_t i = from; i < count_; i++) {
+        if (!writeManifestLine(entries[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// --- Append ---
+bool TapesCatalog::append(const CatalogEntry &entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return appendLocked(entry);
+}
+
+bool TapesCatalog::appendLocked(const CatalogEntry &entry) {
+    if (!map_) {
+        return false;
+    }
+    if (count_ == capacity_ && !mapEntries(capacity_ * 2)) {
+        return false;
+    }
+    if (!writeAll(fd_, &entry, sizeof(entry))) {
+        std::cerr << "Failed to add " << entry.name << " to the catalog: " << strerror(errno) << std::endl;
+        // Drop whatever part of the record made it in; the next open() drops
+        // it otherwise
+        if (ftruncate(fd_, static_cast<off_t>(HEADER_SIZE + count_ * sizeof(CatalogEntry))) < 0) {
+            std::cerr << "Failed to trim the catalog: " << strerror(errno) << std::endl;
+        }
+        return false;
+    }
+    latest_[static_cast<int>(entry.kind) % std::size(latest_)] = count_;
+    count_++;
+    if (!writeManifestLine(entry)) {
+        std::cerr << "Failed to add " << entry.name << " to the manifest: " << strerror(errno) << std::endl;
+    }
+    return true;
+}
+
+// --- Lookup ---
+size_t TapesCatalog::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_;
+}
+
+size_t TapesCatalog::latest(CatalogKind kind) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_ > 0 ? latest_[static_cast<int>(kind) % std::size(latest_)] : npos;
+}
+
+size_t TapesCatalog::previous(size_t index, CatalogKind kind) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const CatalogEntry *entries = mappedEntries();
+    for (size_t i = std::min(index, count_); i-- > 0;) {
+        if (entries[i].kind == kind) {
+            return i;
+        }
+    }
+    return npos;
+}
+
+size_t TapesCatalog::next(size_t index, CatalogKind kind) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const CatalogEntry *entries = mappedEntries();
+    for (size_t i = index == npos ? count_ : index + 1; i < count_; i++) {
+        if (entries[i].kind == kind) {
+            return i;
+        }
+    }
+    return npos;
+}
+
+bool TapesCatalog::entry(size_t index, CatalogEntry &out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index >= count_) {
+        return false;
+    }
+    const CatalogEntry *entries = mappedEntries();
+    out = entries[index];
+    return true;
+}
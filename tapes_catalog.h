@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// --- Tapes catalog ---
+// An append-only index of the files committed to the tapes directory, so the
+// newest photo, and the ones either side of it, are found without listing
+// the directory. Kept in two hidden files next to the photos:
+//
+//   .catalog   a 16-byte header then fixed-size CatalogEntry records, in
+//              commit order, memory-mapped for lookups
+//   .manifest  the same records as tab-separated text, one line per file, for
+//              export tools: a tool that remembers how many lines it has
+//              seen copies only the lines after them
+//
+// Entries are appended once their file has been renamed into place, so an
+// entry never names a file that was not complete, though files may since
+// have been deleted. A catalog created for a directory that already holds
+// photos first imports them, oldest first, without hashes or exposure.
+
+enum class CatalogKind : uint32_t { Jpeg, Dng, Count };
+
+const char *catalogKindName(CatalogKind kind);
+
+struct CatalogEntry {
+    char name[64] = {};         // File name within the directory
+    char captureTime[20] = {};  // EXIF DateTime, "YYYY:MM:DD HH:MM:SS"
+    CatalogKind kind = CatalogKind::Jpeg;
+    uint64_t bytes = 0;
+    uint64_t hash = 0;  // ContentHash of the file, 0 if imported
+    int32_t exposureTimeUs = 0;
+    float analogueGain = 0;
+    uint8_t reserved[16] = {};
+};
+static_assert(sizeof(CatalogEntry) == 128, "catalog records are 128 bytes on disk");
+
+// An entry for a committed file, named and typed after its path. Names too
+// long for the record are cut short.
+CatalogEntry catalogEntry(const std::string &path, uint64_t bytes, uint64_t hash);
+
+class TapesCatalog {
+public:
+    static constexpr size_t npos = SIZE_MAX;
+
+    TapesCatalog() = default;
+    ~TapesCatalog();
+    TapesCatalog(const TapesCatalog &) = delete;
+    TapesCatalog &operator=(const TapesCatalog &) = delete;
+
+    // Open the directory's catalog, creating it if there is none
+    bool open(const std::string &directory);
+    void close();
+
+    // Safe from any thread; the writer threads append as files are committed
+    bool append(const CatalogEntry &entry);
+
+    size_t size() const;
+    // Indexes of the newest entry of a kind and the ones either side of an
+    // entry, or npos. Constant time, but for skipping entries of other kinds.
+    size_t latest(CatalogKind kind) const;
+    size_t previous(size_t index, CatalogKind kind) const;
+    size_t next(size_t index, CatalogKind kind) const;
+    // Copy an entry out; the mapping moves as the catalog grows
+    bool entry(size_t index, CatalogEntry &out) const;
+    std::string path(const CatalogEntry &entry) const { return directory_ + "/" + entry.name; }
+
+private:
+    bool openLocked(const std::string &directory);
+    void release();
+    bool mapEntries(size_t capacity);
+    const CatalogEntry *mappedEntries() const;
+    bool appendLocked(const CatalogEntry &entry);
+    bool writeManifestLine(const CatalogEntry &entry);
+    bool syncManifest();
+    size_t importDirectory();
+
+    std::string directory_;
+    mutable std::mutex mutex_;
+    int fd_ = -1;
+    int manifestFd_ = -1;
+    void *map_ = nullptr;
+    size_t mapSize_ = 0;
+    size_t capacity_ = 0;  // Entries the mapping covers
+    size_t count_ = 0;
+    size_t latest_[static_cast<int>(CatalogKind::Count)];
+};
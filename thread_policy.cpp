@@ -0,0 +1,71 @@
+#include "thread_policy.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+bool setRealtimePriority(const char *name, int priority) {
+    sched_param param{};
+    param.sched_priority = priority;
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error) {
+        std::cerr << name << ": no real-time priority (" << strerror(error)
+                  << "), using the normal scheduler" << std::endl;
+        return false;
+    }
+    std::cout << name << ": SCHED_FIFO priority " << priority << std::endl;
+    return true;
+}
+
+bool pinToCore(const char *name, unsigned int core) {
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error) {
+        std::cerr << name << ": not pinned to core " << core % cores << " (" << strerror(error) << ")" << std::endl;
+        return false;
+    }
+    std::cout << name << ": pinned to core " << core % cores << std::endl;
+    return true;
+}
+
+PiMutex::PiMutex() {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&mutex_, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+PiMutex::~PiMutex() {
+    pthread_mutex_destroy(&mutex_);
+}
+
+void PiMutex::lock() {
+    pthread_mutex_lock(&mutex_);
+}
+
+bool PiMutex::try_lock() {
+    return pthread_mutex_trylock(&mutex_) == 0;
+}
+
+void PiMutex::unlock() {
+    pthread_mutex_unlock(&mutex_);
+}
+
+NormalPriorityScope::NormalPriorityScope() {
+    pthread_getschedparam(pthread_self(), &policy_, &param_);
+    if (policy_ != SCHED_OTHER) {
+        sched_param normal{};
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &normal);
+    }
+}
+
+NormalPriorityScope::~NormalPriorityScope() {
+    if (policy_ != SCHED_OTHER) {
+        pthread_setschedparam(pthread_self(), policy_, &param_);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+
+// --- Thread policy ---
+// Scheduling and CPU affinity for the threads on the capture path. Each call
+// applies to the calling thread and logs what it did. Without the privilege
+// for it (CAP_SYS_NICE, or RLIMIT_RTPRIO for real-time priorities) the thread
+// is left as it was and the call returns false, so callers carry on with the
+// default policy.
+
+// Run the calling thread under SCHED_FIFO at `priority` (1-99). `name` is for
+// the log.
+bool setRealtimePriority(const char *name, int priority);
+// Keep the calling thread on one core
+bool pinToCore(const char *name, unsigned int core);
+
+// A mutex with priority inheritance: while a real-time thread waits for it,
+// the holder runs at the waiter's priority, so a normal thread preempted
+// while holding it cannot hold the real-time one up. Lockable, for
+// std::unique_lock and std::condition_variable_any.
+class PiMutex {
+public:
+    PiMutex();
+    ~PiMutex();
+    PiMutex(const PiMutex &) = delete;
+    PiMutex &operator=(const PiMutex &) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+private:
+    pthread_mutex_t mutex_;
+};
+
+// Runs the calling thread under the normal policy while in scope, so threads
+// it starts meanwhile do not inherit a real-time one, and restores it after
+class NormalPriorityScope {
+public:
+    NormalPriorityScope();
+    ~NormalPriorityScope();
+    NormalPriorityScope(const NormalPriorityScope &) = delete;
+    NormalPriorityScope &operator=(const NormalPriorityScope &) = delete;
+
+private:
+    int policy_ = SCHED_OTHER;
+    sched_param param_{};
+};
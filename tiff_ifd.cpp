@@ -0,0 +1,116 @@
+#include "tiff_ifd.h"
+
+void appendU16(std::vector<uint8_t> &out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void appendU32(std::vector<uint8_t> &out, uint32_t value) {
+    appendU16(out, static_cast<uint16_t>(value));
+    appendU16(out, static_cast<uint16_t>(value >> 16));
+}
+
+void writeTiffHeader(std::vector<uint8_t> &out, uint32_t firstIfdOffset) {
+    out.push_back('I');
+    out.push_back('I');
+    appendU16(out, 42);
+    appendU32(out, firstIfdOffset);
+}
+
+void TiffIfd::set(uint16_t tag, Type type, uint32_t count, std::vector<uint8_t> data) {
+    entries_[tag] = Entry{type, count, std::move(data)};
+}
+
+void TiffIfd::setShort(uint16_t tag, uint16_t value) {
+    setShorts(tag, {value});
+}
+
+void TiffIfd::setShorts(uint16_t tag, const std::vector<uint16_t> &values) {
+    std::vector<uint8_t> data;
+    for (uint16_t v : values) {
+        appendU16(data, v);
+    }
+    set(tag, SHORT, static_cast<uint32_t>(values.size()), std::move(data));
+}
+
+void TiffIfd::setLong(uint16_t tag, uint32_t value) {
+    setLongs(tag, {value});
+}
+
+void TiffIfd::setLongs(uint16_t tag, const std::vector<uint32_t> &values) {
+    std::vector<uint8_t> data;
+    for (uint32_t v : values) {
+        appendU32(data, v);
+    }
+    set(tag, LONG, static_cast<uint32_t>(values.size()), std::move(data));
+}
+
+void TiffIfd::setRational(uint16_t tag, uint32_t numerator, uint32_t denominator) {
+    setRationals(tag, {{numerator, denominator}});
+}
+
+void TiffIfd::setRationals(uint16_t tag, const std::vector<std::pair<uint32_t, uint32_t>> &values) {
+    std::vector<uint8_t> data;
+    for (const auto &v : values) {
+        appendU32(data, v.first);
+        appendU32(data, v.second);
+    }
+    set(tag, RATIONAL, static_cast<uint32_t>(values.size()), std::move(data));
+}
+
+void TiffIfd::setSRationals(uint16_t tag, const std::vector<std::pair<int32_t, int32_t>> &values) {
+    std::vector<uint8_t> data;
+    for (const auto &v : values) {
+        appendU32(data, static_cast<uint32_t>(v.first));
+        appendU32(data, static_cast<uint32_t>(v.second));
+    }
+    set(tag, SRATIONAL, static_cast<uint32_t>(values.size()), std::move(data));
+}
+
+void TiffIfd::setAscii(uint16_t tag, const std::string &value) {
+    std::vector<uint8_t> data(value.begin(), value.end());
+    data.push_back(0);
+    uint32_t count = static_cast<uint32_t>(data.size());
+    set(tag, ASCII, count, std::move(data));
+}
+
+void TiffIfd::setBytes(uint16_t tag, Type type, const std::vector<uint8_t> &data) {
+    set(tag, type, static_cast<uint32_t>(data.size()), data);
+}
+
+size_t TiffIfd::size() const {
+    size_t total = 2 + entries_.size() * 12 + 4;
+    for (const auto &entry : entries_) {
+        if (entry.second.data.size() > 4) {
+            total += (entry.second.data.size() + 1) & ~static_cast<size_t>(1);
+        }
+    }
+    return total;
+}
+
+void TiffIfd::write(std::vector<uint8_t> &out, uint32_t nextIfdOffset) const {
+    uint32_t dataOffset = static_cast<uint32_t>(out.size() + 2 + entries_.size() * 12 + 4);
+    std::vector<uint8_t> extra;
+
+    appendU16(out, static_cast<uint16_t>(entries_.size()));
+    for (const auto &item : entries_) {
+        const Entry &entry = item.second;
+        appendU16(out, item.first);
+        appendU16(out, entry.type);
+        appendU32(out, entry.count);
+        if (entry.data.size() <= 4) {
+            // Small values are stored in the entry itself, left-justified
+            std::vector<uint8_t> inlineValue(entry.data);
+            inlineValue.resize(4, 0);
+            out.insert(out.end(), inlineValue.begin(), inlineValue.end());
+        } else {
+            appendU32(out, dataOffset + static_cast<uint32_t>(extra.size()));
+            extra.insert(extra.end(), entry.data.begin(), entry.data.end());
+            if (extra.size() & 1) {
+                extra.push_back(0);  // Keep values word-aligned
+            }
+        }
+    }
+    appendU32(out, nextIfdOffset);
+    out.insert(out.end(), extra.begin(), extra.end());
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// --- TIFF IFD serialization ---
+// Builds little-endian TIFF image file directories, as used by EXIF blocks.
+// Entries are kept sorted by tag. Values that do not fit in the 4-byte entry
+// field are stored right after the directory, so an IFD occupies exactly
+// size() bytes from the offset it is written at.
+class TiffIfd {
+public:
+    enum Type : uint16_t {
+        BYTE = 1,
+        ASCII = 2,
+        SHORT = 3,
+        LONG = 4,
+        RATIONAL = 5,
+        UNDEFINED = 7,
+        SRATIONAL = 10,
+    };
+
+    void setShort(uint16_t tag, uint16_t value);
+    void setShorts(uint16_t tag, const std::vector<uint16_t> &values);
+    void setLong(uint16_t tag, uint32_t value);
+    void setLongs(uint16_t tag, const std::vector<uint32_t> &values);
+    void setRational(uint16_t tag, uint32_t numerator, uint32_t denominator);
+    void setRationals(uint16_t tag, const std::vector<std::pair<uint32_t, uint32_t>> &values);
+    void setSRationals(uint16_t tag, const std::vector<std::pair<int32_t, int32_t>> &values);
+    void setAscii(uint16_t tag, const std::string &value);
+    void setBytes(uint16_t tag, Type type, const std::vector<uint8_t> &data);
+
+    bool empty() const { return entries_.empty(); }
+
+    // Bytes taken by the directory and its out-of-line values
+    size_t size() const;
+
+    // Append the IFD to `out`, which must already hold everything before it
+    // (offsets are relative to the start of `out`, i.e. the TIFF header)
+    void write(std::vector<uint8_t> &out, uint32_t nextIfdOffset) const;
+
+private:
+    struct Entry {
+        Type type;
+        uint32_t count;
+        std::vector<uint8_t> data;
+    };
+
+    void set(uint16_t tag, Type type, uint32_t count, std::vector<uint8_t> data);
+
+    std::map<uint16_t, Entry> entries_;
+};
+
+// Little-endian helpers shared by TIFF-based writers
+void appendU16(std::vector<uint8_t> &out, uint16_t value);
+void appendU32(std::vector<uint8_t> &out, uint32_t value);
+
+// "II*\0" header pointing at the first IFD
+void writeTiffHeader(std::vector<uint8_t> &out, uint32_t firstIfdOffset);
@@ -0,0 +1,103 @@
+#include "worker_pool.h"
+
+WorkerPool::WorkerPool(unsigned int threads) {
+    for (unsigned int i = 0; i < threads; i++) {
+        threads_.emplace_back(&WorkerPool::workerFunc, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_) {
+        t.join();
+    }
+}
+
+// Take the next iteration of the oldest batch. Claiming happens under the
+// pool lock so a batch is never touched after its last index is handed out,
+// except through finish().
+bool WorkerPool::claim(Batch *&batch, size_t &index) {
+    if (batches_.empty()) {
+        return false;
+    }
+    batch = batches_.front();
+    index = batch->next++;
+    if (batch->next >= batch->count) {
+        batches_.pop_front();
+    }
+    return true;
+}
+
+void WorkerPool::finish(Batch *batch) {
+    std::lock_guard<std::mutex> lock(batch->doneMutex);
+    if (++batch->finished == batch->count) {
+        batch->doneCV.notify_all();
+    }
+}
+
+void WorkerPool::parallelFor(size_t count, const std::function<void(size_t)> &fn) {
+    if (count == 0) {
+        return;
+    }
+    if (threads_.empty() || count == 1) {
+        for (size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    Batch batch;
+    batch.fn = &fn;
+    batch.count = count;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batches_.push_back(&batch);
+    }
+    cv_.notify_all();
+
+    // Help out until this batch has no unclaimed iterations left
+    while (true) {
+        size_t index;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (batch.next >= batch.count) {
+                break;
+            }
+            index = batch.next++;
+            if (batch.next >= batch.count) {
+                for (auto it = batches_.begin(); it != batches_.end(); ++it) {
+                    if (*it == &batch) {
+                        batches_.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+        fn(index);
+        finish(&batch);
+    }
+
+    std::unique_lock<std::mutex> lock(batch.doneMutex);
+    batch.doneCV.wait(lock, [&batch] { return batch.finished == batch.count; });
+}
+
+void WorkerPool::workerFunc() {
+    while (true) {
+        Batch *batch = nullptr;
+        size_t index = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stopping_ || !batches_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            claim(batch, index);
+        }
+        (*batch->fn)(index);
+        finish(batch);
+    }
+}
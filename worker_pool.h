@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --- Worker pool ---
+// Fixed set of threads for data-parallel work on a single frame. parallelFor()
+// spreads the iterations over the workers and the calling thread, and returns
+// once every iteration has run. Several callers may submit at the same time;
+// their batches are served in order.
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned int threads);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    void parallelFor(size_t count, const std::function<void(size_t)> &fn);
+
+    // Threads taking part in parallelFor(), including the caller
+    unsigned int concurrency() const { return static_cast<unsigned int>(threads_.size()) + 1; }
+
+private:
+    struct Batch {
+        const std::function<void(size_t)> *fn;
+        size_t count;
+        size_t next = 0;       // Guarded by the pool mutex
+        size_t finished = 0;   // Guarded by doneMutex
+        std::mutex doneMutex;
+        std::condition_variable doneCV;
+    };
+
+    bool claim(Batch *&batch, size_t &index);
+    static void finish(Batch *batch);
+    void workerFunc();
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Batch *> batches_;
+    std::vector<std::thread> threads_;
+    bool stopping_ = false;
+};
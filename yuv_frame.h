@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+// --- YUV420 frame view ---
+// Non-owning view of a planar YUV420 image. Planes may carry stride padding;
+// nothing in the pipeline assumes rows are packed.
+struct YuvFrame {
+    const uint8_t *planes[3] = {nullptr, nullptr, nullptr};
+    int strides[3] = {0, 0, 0};
+    int width = 0;
+    int height = 0;
+};
@@ -0,0 +1,98 @@
+#include "yuv_scale.h"
+
+#include <algorithm>
+
+namespace {
+
+void halvePlane(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride,
+                int width, int rowBegin, int rowEnd) {
+    for (int y = rowBegin; y < rowEnd; y++) {
+        const uint8_t *r0 = src + static_cast<size_t>(2 * y) * srcStride;
+        const uint8_t *r1 = r0 + srcStride;
+        uint8_t *out = dst + static_cast<size_t>(y) * dstStride;
+        for (int x = 0; x < width; x++) {
+            out[x] = static_cast<uint8_t>((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+        }
+    }
+}
+
+void samplePlane(const uint8_t *src, int srcStride, int srcWidth, int srcHeight,
+                 uint8_t *dst, int width, int height) {
+    constexpr int GRID = 4;
+    for (int y = 0; y < height; y++) {
+        // Sample rows spread evenly over the source rows of this output row
+        int rows[GRID];
+        for (int i = 0; i < GRID; i++) {
+            rows[i] = static_cast<int>((static_cast<int64_t>(y) * GRID + i) * srcHeight / (height * GRID));
+        }
+        for (int x = 0; x < width; x++) {
+            int sum = 0;
+            for (int j = 0; j < GRID; j++) {
+                int col = static_cast<int>((static_cast<int64_t>(x) * GRID + j) * srcWidth / (width * GRID));
+                for (int i = 0; i < GRID; i++) {
+                    sum += src[static_cast<size_t>(rows[i]) * srcStride + col];
+                }
+            }
+            dst[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>((sum + GRID * GRID / 2) / (GRID * GRID));
+        }
+    }
+}
+
+}  // namespace
+
+size_t yuv420Size(int width, int height) {
+    return static_cast<size_t>(width) * height + 2 * static_cast<size_t>(width / 2) * (height / 2);
+}
+
+YuvFrame packedYuv420(uint8_t *buffer, int width, int height) {
+    YuvFrame frame;
+    frame.width = width;
+    frame.height = height;
+    frame.strides[0] = width;
+    frame.strides[1] = width / 2;
+    frame.strides[2] = width / 2;
+    frame.planes[0] = buffer;
+    frame.planes[1] = buffer + static_cast<size_t>(width) * height;
+    frame.planes[2] = frame.planes[1] + static_cast<size_t>(width / 2) * (height / 2);
+    return frame;
+}
+
+YuvFrame halfSizeYuv420(const YuvFrame &src, uint8_t *buffer) {
+    return packedYuv420(buffer, (src.width / 2) & ~1, (src.height / 2) & ~1);
+}
+
+void halveYuv420(const YuvFrame &src, uint8_t *buffer, int rowBegin, int rowEnd) {
+    YuvFrame dst = halfSizeYuv420(src, buffer);
+    rowEnd = std::min(rowEnd, dst.height);
+    uint8_t *planes[3] = {buffer, buffer + (dst.planes[1] - dst.planes[0]),
+                          buffer + (dst.planes[2] - dst.planes[0])};
+
+    halvePlane(src.planes[0], src.strides[0], planes[0], dst.strides[0], dst.width, rowBegin, rowEnd);
+    for (int p = 1; p < 3; p++) {
+        halvePlane(src.planes[p], src.strides[p], planes[p], dst.strides[p],
+                   dst.width / 2, rowBegin / 2, rowEnd / 2);
+    }
+}
+
+void fitYuv420(const YuvFrame &src, int maxWidth, int maxHeight, int &width, int &height) {
+    width = maxWidth;
+    height = static_cast<int>(static_cast<int64_t>(maxWidth) * src.height / src.width);
+    if (height > maxHeight) {
+        height = maxHeight;
+        width = static_cast<int>(static_cast<int64_t>(maxHeight) * src.width / src.height);
+    }
+    width = std::max(2, width & ~1);
+    height = std::max(2, height & ~1);
+}
+
+void sampleYuv420(const YuvFrame &src, uint8_t *buffer, int width, int height) {
+    YuvFrame dst = packedYuv420(buffer, width, height);
+    uint8_t *planes[3] = {buffer, buffer + (dst.planes[1] - dst.planes[0]),
+                          buffer + (dst.planes[2] - dst.planes[0])};
+
+    samplePlane(src.planes[0], src.strides[0], src.width, src.height, planes[0], width, height);
+    for (int p = 1; p < 3; p++) {
+        samplePlane(src.planes[p], src.strides[p], src.width / 2, src.height / 2,
+                    planes[p], width / 2, height / 2);
+    }
+}
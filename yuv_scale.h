@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "yuv_frame.h"
+
+// --- YUV420 scaling ---
+
+// Bytes needed for a packed (stride == width) YUV420 frame
+size_t yuv420Size(int width, int height);
+
+// Lay out a packed YUV420 frame of the given size in `buffer`
+YuvFrame packedYuv420(uint8_t *buffer, int width, int height);
+
+// Half-size layout for `src` (dimensions rounded down to even) in `buffer`
+YuvFrame halfSizeYuv420(const YuvFrame &src, uint8_t *buffer);
+
+// 2x2 box-filter `src` into the halfSizeYuv420() layout in `buffer`, for
+// destination luma rows [rowBegin, rowEnd). Both bounds must be even so
+// bands can be run in parallel.
+void halveYuv420(const YuvFrame &src, uint8_t *buffer, int rowBegin, int rowEnd);
+
+// Largest even size within maxWidth x maxHeight with the aspect ratio of `src`
+void fitYuv420(const YuvFrame &src, int maxWidth, int maxHeight, int &width, int &height);
+
+// Shrink `src` to width x height (even) into the packedYuv420() layout in
+// `buffer`. Each output pixel averages a 4x4 grid of samples spread over its
+// source area, so the cost depends on the output size rather than the frame.
+// Meant for large reductions such as thumbnails.
+void sampleYuv420(const YuvFrame &src, uint8_t *buffer, int width, int height);